@@ -0,0 +1,424 @@
+#include <benchmark/benchmark.h>
+#include <Editor.hpp>
+
+#include <stdio.h>
+#include <sys/stat.h>
+#include <unistd.h>
+#include <zlib.h>
+
+#include <string>
+#include <vector>
+
+// Largest synthetic file the size-parameterized benchmarks use. CMake sets
+// this from KILO_BENCHMARK_MAX_BYTES; raise it for GB-scale runs.
+#ifndef KILO_BENCHMARK_MAX_BYTES
+#define KILO_BENCHMARK_MAX_BYTES (16 << 20)
+#endif
+
+// C source that gives the highlighter keywords, numbers, strings, comments
+// and tabs to chew on.
+static char const *const SampleLines[] = {
+    "int main(int argc, char **argv) {",
+    "  for (int i = 0; i < 42; ++i) /* loop */",
+    "    printf(\"%d\\n\", i * 3.14);",
+    "\tif (argc > 1) return 1; // bail out",
+    "  return 0;",
+    "}",
+};
+static int const NumSampleLines = sizeof(SampleLines) / sizeof(*SampleLines);
+
+static std::string tempPath(char const *name) {
+  char const *dir = getenv("TMPDIR");
+  return std::string(dir ? dir : "/tmp") + "/" + name;
+}
+
+// Writes (once) a C file of about `bytes` bytes and returns its path.
+static std::string syntheticFile(int64_t bytes) {
+  std::string path =
+      tempPath(("kilo-bench-" + std::to_string(bytes) + ".c").c_str());
+  struct stat st;
+  if (stat(path.c_str(), &st) == 0 && st.st_size >= bytes)
+    return path;
+
+  FILE *fp = fopen(path.c_str(), "w");
+  for (int64_t written = 0, i = 0; written < bytes; ++i) {
+    char const *line = SampleLines[i % NumSampleLines];
+    written += fprintf(fp, "%s\n", line);
+  }
+  fclose(fp);
+  return path;
+}
+
+// Writes (once) a gzip copy of syntheticFile(bytes) and returns its path.
+static std::string syntheticGzipFile(int64_t bytes) {
+  std::string path = syntheticFile(bytes) + ".gz";
+  struct stat st;
+  if (stat(path.c_str(), &st) == 0)
+    return path;
+
+  gzFile gz = gzopen(path.c_str(), "wb");
+  for (int64_t written = 0, i = 0; written < bytes; ++i) {
+    char const *line = SampleLines[i % NumSampleLines];
+    written += gzprintf(gz, "%s\n", line);
+  }
+  gzclose(gz);
+  return path;
+}
+
+// Shows a new C buffer of about `bytes` bytes, fully highlighted.
+static void fillBuffer(int64_t bytes) {
+  if (E.buf == nullptr)
+    initEditor();
+  editorSwitchBuffer(editorNewBuffer("bench.c"));
+  editorSelectSyntaxHighlight();
+  for (int64_t added = 0, i = 0; added < bytes; ++i) {
+    char const *line = SampleLines[i % NumSampleLines];
+    editorInsertRow(E.buf->numRows, const_cast<char *>(line), strlen(line));
+    added += strlen(line) + 1;
+  }
+  editorHighlightSome(E.buf, E.buf->numRows);
+  E.buf->dirty = 0;
+}
+
+static void bufferSizes(benchmark::internal::Benchmark *b) {
+  b->RangeMultiplier(8)->Range(64 << 10, KILO_BENCHMARK_MAX_BYTES);
+}
+
+static void BenchmarkOpen(benchmark::State &state) {
+  if (E.buf == nullptr)
+    initEditor();
+  std::string path = syntheticFile(state.range(0));
+  for (auto _ : state) {
+    Buffer *buf = editorOpen(path.c_str());
+    editorFinishLoad(buf);
+    state.PauseTiming();
+    editorCloseBuffer(buf);
+    state.ResumeTiming();
+  }
+  state.SetBytesProcessed(state.iterations() * state.range(0));
+}
+
+// Until editorOpen returns with the first screenful, which is what stands
+// between starting kilo and its first frame. It should not grow with the
+// file; the rest is cancelled unread.
+static void BenchmarkOpenFirstScreen(benchmark::State &state) {
+  if (E.buf == nullptr)
+    initEditor();
+  std::string path = syntheticFile(state.range(0));
+  for (auto _ : state) {
+    Buffer *buf = editorOpen(path.c_str());
+    state.PauseTiming();
+    editorCloseBuffer(buf);
+    state.ResumeTiming();
+  }
+}
+
+// Inflates while loading; bytes are the uncompressed size.
+static void BenchmarkOpenGzip(benchmark::State &state) {
+  if (E.buf == nullptr)
+    initEditor();
+  std::string path = syntheticGzipFile(state.range(0));
+  for (auto _ : state) {
+    Buffer *buf = editorOpen(path.c_str());
+    editorFinishLoad(buf);
+    state.PauseTiming();
+    editorCloseBuffer(buf);
+    state.ResumeTiming();
+  }
+  state.SetBytesProcessed(state.iterations() * state.range(0));
+}
+
+// Until the file is loaded and highlighted in full, the way a file is
+// reopened with range(1) = 1: cut at the line lengths of its session and
+// highlighted from its saved comment states. range(1) = 0 scans and
+// highlights it from scratch.
+static void BenchmarkOpenSession(benchmark::State &state) {
+  if (E.buf == nullptr)
+    initEditor();
+  std::string path = syntheticFile(state.range(0));
+  std::string dir = tempPath("kilo-bench-sessions");
+  E.sessionDir = dir;
+  // Leaves the session behind as it closes.
+  Buffer *first = editorOpen(path.c_str());
+  editorFinishLoad(first);
+  editorHighlightSome(first, first->numRows);
+  editorCloseBuffer(first);
+  if (state.range(1) == 0)
+    E.sessionDir.clear();
+
+  for (auto _ : state) {
+    Buffer *buf = editorOpen(path.c_str());
+    editorFinishLoad(buf);
+    editorHighlightSome(buf, buf->numRows);
+    state.PauseTiming();
+    editorCloseBuffer(buf);
+    state.ResumeTiming();
+  }
+  state.SetBytesProcessed(state.iterations() * state.range(0));
+  E.sessionDir.clear();
+}
+
+// range(1) is where the row goes: 0 = top, 1 = middle, 2 = bottom.
+static void BenchmarkInsertRow(benchmark::State &state) {
+  fillBuffer(state.range(0));
+  int at = state.range(1) * E.buf->numRows / 2;
+  char line[] = "  int inserted = 1; // new row";
+  for (auto _ : state) {
+    editorInsertRow(at, line, sizeof(line) - 1);
+    state.PauseTiming();
+    editorDelRow(at);
+    state.ResumeTiming();
+  }
+  editorCloseBuffer(E.buf);
+}
+
+// Types into a single row of range(0) bytes at range(1) percent of its width.
+static void BenchmarkRowInsertChar(benchmark::State &state) {
+  fillBuffer(0);
+  std::string text(state.range(0), 'x');
+  editorInsertRow(0, text.data(), text.size());
+  Row *row = &E.buf->row[0];
+  int at = state.range(1) * row->size / 100;
+  for (auto _ : state) {
+    editorRowInsertChar(row, at, 'y');
+    state.PauseTiming();
+    editorRowDelChar(row, at);
+    state.ResumeTiming();
+  }
+  editorCloseBuffer(E.buf);
+}
+
+static void BenchmarkUpdateSyntax(benchmark::State &state) {
+  fillBuffer(state.range(0));
+  for (auto _ : state) {
+    E.buf->highlightFrom = 0;
+    editorHighlightSome(E.buf, E.buf->numRows);
+  }
+  state.SetBytesProcessed(state.iterations() * state.range(0));
+  editorCloseBuffer(E.buf);
+}
+
+static void BenchmarkDrawRows(benchmark::State &state) {
+  fillBuffer(1 << 20);
+  E.screenRows = state.range(0);
+  E.screenCols = state.range(1);
+  int64_t bytes = 0;
+  for (auto _ : state) {
+    AppendBuffer ab;
+    editorDrawRows(ab);
+    bytes += ab.length;
+    E.view.rowOffset = (E.view.rowOffset + 1) % (E.buf->numRows / 2);
+  }
+  state.SetBytesProcessed(bytes);
+  state.counters["bytes/frame"] =
+      benchmark::Counter(bytes, benchmark::Counter::kAvgIterations);
+  editorCloseBuffer(E.buf);
+}
+
+// Scrolls down a line per frame, sending only what the terminal can't shift.
+static void BenchmarkScrollRows(benchmark::State &state) {
+  fillBuffer(1 << 20);
+  E.screenRows = state.range(0);
+  E.screenCols = state.range(1);
+  editorInvalidateScreen();
+  int64_t bytes = 0;
+  for (auto _ : state) {
+    AppendBuffer ab;
+    editorDrawChangedRows(ab);
+    bytes += ab.length;
+    E.view.rowOffset = (E.view.rowOffset + 1) % (E.buf->numRows / 2);
+  }
+  state.SetBytesProcessed(bytes);
+  state.counters["bytes/frame"] =
+      benchmark::Counter(bytes, benchmark::Counter::kAvgIterations);
+  editorCloseBuffer(E.buf);
+}
+
+// Pans along a single row of range(0) bytes a screen width per frame, so
+// every few frames bring a new piece of it into view.
+static void BenchmarkScrollLongRow(benchmark::State &state) {
+  fillBuffer(0);
+  std::string text(state.range(0), 'x');
+  for (size_t j = 7; j < text.size(); j += 8)
+    text[j] = '\t';
+  editorInsertRow(0, text.data(), text.size());
+  E.screenRows = 24;
+  E.screenCols = 80;
+  int width = editorRowCxToRx(&E.buf->row[0], E.buf->row[0].size);
+  for (auto _ : state) {
+    AppendBuffer ab;
+    editorDrawRows(ab);
+    E.view.colOffset = (E.view.colOffset + E.screenCols) % width;
+  }
+  editorCloseBuffer(E.buf);
+}
+
+// Jumps a screen at a time through a buffer packed down to a tiny budget, so
+// every frame unpacks the rows it shows.
+static void BenchmarkColdPages(benchmark::State &state) {
+  fillBuffer(state.range(0));
+  E.screenRows = 24;
+  E.screenCols = 80;
+  E.memoryBudget = 1;
+  while (editorCompactSome(E.buf, E.buf->numRows))
+    ;
+  state.counters["packed KiB"] = RowPool.BytesInUse() / 1024;
+  int64_t bytes = 0;
+  for (auto _ : state) {
+    E.view.rowOffset = (E.view.rowOffset + 997 * E.screenRows) %
+                       (E.buf->numRows - E.screenRows);
+    AppendBuffer ab;
+    editorDrawRows(ab);
+    bytes += ab.length;
+  }
+  state.SetBytesProcessed(bytes);
+  E.memoryBudget = 0;
+  editorCloseBuffer(E.buf);
+}
+
+// Searches for a string that only occurs on the last row.
+static void BenchmarkFind(benchmark::State &state) {
+  fillBuffer(state.range(0));
+  char needle[] = "needle_in_a_haystack";
+  editorInsertRow(E.buf->numRows, needle, sizeof(needle) - 1);
+  for (auto _ : state) {
+    editorFindCallback(needle, 0);
+    editorFindCallback(needle, '\r');
+  }
+  state.SetBytesProcessed(state.iterations() * state.range(0));
+  editorCloseBuffer(E.buf);
+}
+
+// Renames `argc`, which is on a third of the rows, and undoes it untimed.
+static void BenchmarkReplaceAll(benchmark::State &state) {
+  fillBuffer(state.range(0));
+  for (auto _ : state) {
+    editorReplaceAll("argc", "count");
+    state.PauseTiming();
+    editorUndo();
+    state.ResumeTiming();
+  }
+  state.SetBytesProcessed(state.iterations() * state.range(0));
+  editorCloseBuffer(E.buf);
+}
+
+// Types a character at range(0) cursors spread over a 1 MiB buffer, and
+// deletes it again untimed.
+static void BenchmarkMultiCursorType(benchmark::State &state) {
+  fillBuffer(1 << 20);
+  std::vector<Cursor> cursors;
+  for (int j = 0; j < state.range(0); ++j)
+    cursors.push_back({2, static_cast<int>(j * E.buf->numRows /
+                                           state.range(0))});
+  E.view.cursorX = cursors[0].x;
+  E.view.cursorY = cursors[0].y;
+  editorSetCursors(std::move(cursors));
+  for (auto _ : state) {
+    editorMultiCursorKey('x');
+    state.PauseTiming();
+    editorMultiCursorKey(Key::BackSpace);
+    state.ResumeTiming();
+  }
+  editorClearCursors();
+  editorCloseBuffer(E.buf);
+}
+
+// Copies a whole buffer of range(0) bytes and pastes it at the end, then
+// cuts the pasted copy again untimed.
+static void BenchmarkCopyPaste(benchmark::State &state) {
+  fillBuffer(state.range(0));
+  int numRows = E.buf->numRows;
+  for (auto _ : state) {
+    E.view.anchor = {0, 0};
+    E.view.selecting = true;
+    E.view.cursorX = 0;
+    E.view.cursorY = numRows;
+    editorCopy();
+    editorPaste();
+    state.PauseTiming();
+    E.view.anchor = {0, numRows};
+    E.view.selecting = true;
+    E.view.cursorX = 0;
+    E.view.cursorY = E.buf->numRows;
+    editorCut();
+    state.ResumeTiming();
+  }
+  state.SetBytesProcessed(state.iterations() * state.range(0));
+  editorCloseBuffer(E.buf);
+}
+
+// Runs a whole buffer of range(0) bytes through `cat`, which leaves it as it
+// was, so each pass has the same rows to send.
+static void BenchmarkFilter(benchmark::State &state) {
+  fillBuffer(state.range(0));
+  for (auto _ : state) {
+    std::string error;
+    if (!editorFilterRows(0, E.buf->numRows, "cat", error))
+      state.SkipWithError(error.c_str());
+  }
+  state.SetBytesProcessed(state.iterations() * state.range(0));
+  editorCloseBuffer(E.buf);
+}
+
+static void BenchmarkSave(benchmark::State &state) {
+  fillBuffer(state.range(0));
+  std::string path = tempPath("kilo-bench-save.c");
+  free(E.buf->filename);
+  E.buf->filename = strdup(path.c_str());
+  for (auto _ : state) {
+    E.buf->dirty = 1;
+    editorSave();
+  }
+  state.SetBytesProcessed(state.iterations() * state.range(0));
+  editorCloseBuffer(E.buf);
+  unlink(path.c_str());
+}
+
+// Files load on a thread of their own, so these time the wall clock.
+BENCHMARK(BenchmarkOpen)
+    ->Apply(bufferSizes)
+    ->Unit(benchmark::kMillisecond)
+    ->UseRealTime();
+BENCHMARK(BenchmarkOpenFirstScreen)
+    ->Apply(bufferSizes)
+    ->Unit(benchmark::kMicrosecond)
+    ->UseRealTime();
+BENCHMARK(BenchmarkOpenGzip)
+    ->Apply(bufferSizes)
+    ->Unit(benchmark::kMillisecond)
+    ->UseRealTime();
+BENCHMARK(BenchmarkOpenSession)
+    ->ArgsProduct({{1 << 20, KILO_BENCHMARK_MAX_BYTES}, {0, 1}})
+    ->Unit(benchmark::kMillisecond)
+    ->UseRealTime();
+BENCHMARK(BenchmarkInsertRow)
+    ->ArgsProduct({{64 << 10, KILO_BENCHMARK_MAX_BYTES}, {0, 1, 2}});
+BENCHMARK(BenchmarkRowInsertChar)
+    ->ArgsProduct(
+        {{80, 64 << 10, 1 << 20, KILO_BENCHMARK_MAX_BYTES}, {0, 50, 100}});
+BENCHMARK(BenchmarkUpdateSyntax)
+    ->Apply(bufferSizes)
+    ->Unit(benchmark::kMillisecond);
+BENCHMARK(BenchmarkDrawRows)->Args({24, 80})->Args({60, 240});
+BENCHMARK(BenchmarkScrollRows)->Args({24, 80})->Args({60, 240});
+BENCHMARK(BenchmarkScrollLongRow)->Arg(1 << 20)->Arg(KILO_BENCHMARK_MAX_BYTES);
+BENCHMARK(BenchmarkColdPages)
+    ->Arg(KILO_BENCHMARK_MAX_BYTES)
+    ->Unit(benchmark::kMicrosecond);
+BENCHMARK(BenchmarkFind)->Apply(bufferSizes)->Unit(benchmark::kMillisecond);
+BENCHMARK(BenchmarkReplaceAll)
+    ->Apply(bufferSizes)
+    ->Unit(benchmark::kMillisecond);
+BENCHMARK(BenchmarkMultiCursorType)
+    ->Arg(100)
+    ->Arg(10000)
+    ->Unit(benchmark::kMicrosecond);
+BENCHMARK(BenchmarkCopyPaste)
+    ->Apply(bufferSizes)
+    ->Unit(benchmark::kMillisecond);
+// The command runs in a process of its own, so this times the wall clock.
+BENCHMARK(BenchmarkFilter)
+    ->Apply(bufferSizes)
+    ->Unit(benchmark::kMillisecond)
+    ->UseRealTime();
+BENCHMARK(BenchmarkSave)->Apply(bufferSizes)->Unit(benchmark::kMillisecond);
@@ -0,0 +1,100 @@
+#include <benchmark/benchmark.h>
+#include <Lexer.hpp>
+
+#include <dirent.h>
+#include <stdio.h>
+
+#include <algorithm>
+#include <string>
+#include <vector>
+
+static unsigned char const Output[Lexer::NumTokens] = {0, 1, 2, 3, 4, 5, 6};
+
+// About 1 MiB of rows in the shape of `spec`'s language: keywords and types
+// among identifiers, numbers, strings, and comments of each kind it has.
+static std::vector<std::string> makeRows(LexerSpec const &spec) {
+  std::vector<std::string> rows;
+  size_t bytes = 0;
+  for (size_t i = 0; bytes < (1 << 20); ++i) {
+    std::string row = "    ";
+    if (!spec.keywords.empty())
+      row += spec.keywords[i % spec.keywords.size()] + " ";
+    if (!spec.types.empty())
+      row += spec.types[i % spec.types.size()] + " ";
+    row += "identifier_" + std::to_string(i) + " = ";
+    if (!spec.quotes.empty())
+      row += std::string(1, spec.quotes[0]) + "a string with \\" +
+             spec.quotes[0] + " in it" + spec.quotes[0] + " + ";
+    row += std::to_string(i * 31) + ".5 * (x[" + std::to_string(i % 7) +
+           "] - y);";
+    if (!spec.lineComments.empty() && i % 3 == 0)
+      row += " " + spec.lineComments[0] + " trailing comment";
+    if (!spec.blockCommentStart.empty() && i % 10 == 0)
+      row += " " + spec.blockCommentStart + " opens";
+    if (!spec.blockCommentEnd.empty() && i % 10 == 1)
+      row = "   closes " + spec.blockCommentEnd + row;
+    bytes += row.size() + 1;
+    rows.push_back(std::move(row));
+  }
+  return rows;
+}
+
+static void lexRows(benchmark::State &state, Lexer const *lexer,
+                    std::vector<std::string> const *rows) {
+  size_t widest = 0;
+  size_t bytes = 0;
+  for (auto const &row : *rows) {
+    widest = std::max(widest, row.size());
+    bytes += row.size();
+  }
+  std::vector<unsigned char> hl(widest);
+  for (auto _ : state) {
+    bool inBlock = false;
+    for (auto const &row : *rows)
+      inBlock = lexer->Scan(row.data(), row.size(), hl.data(), inBlock);
+    benchmark::DoNotOptimize(hl.data());
+  }
+  state.SetBytesProcessed(state.iterations() * bytes);
+  state.counters["states"] = lexer->NumStates();
+  state.counters["classes"] = lexer->NumClasses();
+}
+
+// One benchmark per definition shipped in syntax/, named after its language.
+static int registerLanguages() {
+  DIR *dir = opendir(KILO_SYNTAX_DIR);
+  if (!dir)
+    return 0;
+  std::vector<std::string> paths;
+  while (struct dirent *entry = readdir(dir)) {
+    std::string name = entry->d_name;
+    if (name.size() > 7 && name.compare(name.size() - 7, 7, ".syntax") == 0)
+      paths.push_back(std::string(KILO_SYNTAX_DIR) + "/" + name);
+  }
+  closedir(dir);
+  std::sort(paths.begin(), paths.end());
+
+  for (auto const &path : paths) {
+    std::string text;
+    if (FILE *fp = fopen(path.c_str(), "r")) {
+      char chunk[4096];
+      size_t n;
+      while ((n = fread(chunk, 1, sizeof(chunk), fp)) > 0)
+        text.append(chunk, n);
+      fclose(fp);
+    }
+    LexerSpec spec;
+    std::string error;
+    if (!parseLexerSpec(text, spec, error))
+      continue;
+    // Leaked on purpose: benchmarks run after this returns, until exit.
+    Lexer *lexer = Lexer::Compile(spec, Output, error).release();
+    if (!lexer)
+      continue;
+    auto *rows = new std::vector<std::string>(makeRows(spec));
+    benchmark::RegisterBenchmark(("BenchmarkLexer/" + spec.name).c_str(),
+                                 lexRows, lexer, rows);
+  }
+  return paths.size();
+}
+
+static int const NumLanguages = registerLanguages();
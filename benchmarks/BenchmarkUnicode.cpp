@@ -0,0 +1,48 @@
+#include <benchmark/benchmark.h>
+#include <string>
+#include <Unicode.hpp>
+
+static std::string makeText(size_t size, bool ascii) {
+  std::string text;
+  text.reserve(size + 4);
+  while (text.size() < size) {
+    text += "int main() { return 0; } ";
+    if (!ascii)
+      text += "caf\xc3\xa9 \xe4\xbd\xa0\xe5\xa5\xbd ";
+  }
+  text.resize(size);
+  return text;
+}
+
+static void BenchmarkIsAscii(benchmark::State &state) {
+  std::string const text = makeText(state.range(0), true);
+  for (auto _ : state)
+    benchmark::DoNotOptimize(utf8IsAscii(text.data(), text.size()));
+  state.SetBytesProcessed(state.iterations() * text.size());
+}
+
+static void decodeAll(benchmark::State &state, bool ascii) {
+  std::string const text = makeText(state.range(0), ascii);
+  for (auto _ : state) {
+    int columns = 0;
+    for (size_t i = 0; i < text.size();) {
+      uint32_t codepoint;
+      i += utf8Decode(&text[i], text.size() - i, &codepoint);
+      columns += codepointWidth(codepoint);
+    }
+    benchmark::DoNotOptimize(columns);
+  }
+  state.SetBytesProcessed(state.iterations() * text.size());
+}
+
+static void BenchmarkDecodeAscii(benchmark::State &state) {
+  decodeAll(state, true);
+}
+
+static void BenchmarkDecodeMixed(benchmark::State &state) {
+  decodeAll(state, false);
+}
+
+BENCHMARK(BenchmarkIsAscii)->Range(64, 1 << 22);
+BENCHMARK(BenchmarkDecodeAscii)->Range(64, 1 << 22);
+BENCHMARK(BenchmarkDecodeMixed)->Range(64, 1 << 22);
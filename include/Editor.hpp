@@ -0,0 +1,575 @@
+#pragma once
+
+#include <stdio.h>
+#include <sys/types.h>
+#include <termios.h>
+#include <time.h>
+
+#include <algorithm>
+#include <cstdlib>
+#include <cstring>
+#include <string>
+#include <vector>
+
+#include <LineIndex.hpp>
+#include <Pool.hpp>
+
+class Lexer;
+
+#define HL_HIGHLIGHT_NUMBERS (1 << 0)
+#define HL_HIGHLIGHT_STRINGS (1 << 1)
+
+struct Row;
+
+struct EditorSyntax {
+  char const *filetype;
+  char const **filematch;
+  // Fills in `row->hl`. The row starts inside a multi-line comment if
+  // `state` is 1; returns 1 if it ends inside one. The piece of a long row
+  // in a chunk may also start and end inside a string, which is some
+  // state of Lexer::InString or more.
+  int (*highlight)(EditorSyntax const *syntax, Row *row, int state);
+  // The compiled definition, for syntaxes loaded from files.
+  Lexer const *lexer;
+};
+
+// https://vt100.net/docs/vt100-ug/chapter3.html
+extern const char *ClearScreen;
+extern const char *MoveCursorHome;
+extern char const *MakeCursorInvisible;
+extern char const *MakeCursorVisible;
+extern char const *PleaseReportActivePosition;
+extern char const *ClearRow;
+std::string moveCursorUp(int n);
+std::string moveCursorDown(int n);
+std::string moveCursorRight(int n);
+std::string moveCursorLeft(int n);
+extern char const *DefaultForegroundColor;
+std::string setColor_m(int n);
+extern char const *ResetColor;
+extern char const *ColorFormatString;
+extern char const *ReverseVideo;
+extern char const *ReverseVideoOff;
+extern char const *EraseLine;
+std::string setCursorPosition(int x, int y);
+std::string setScrollRegion(int top, int bottom);
+extern char const *ResetScrollRegion;
+std::string scrollUp(int n);
+std::string scrollDown(int n);
+extern char const *BeginSynchronizedUpdate;
+extern char const *EndSynchronizedUpdate;
+
+inline constexpr char addCtrl(char c) { return c & 0x1f; }
+
+// A character in `chars` that does not map one byte to one byte of `render`
+// and one screen column: a tab, or a multibyte UTF-8 sequence. Each row keeps
+// these sorted so conversions between byte offsets in `chars`, byte offsets
+// in `render`, and screen columns are a binary search instead of a walk from
+// column 0. Between two stops every axis advances in lockstep.
+struct ColumnStop {
+  int cx;
+  int cxEnd;
+  int rxEnd;
+  int renderEnd;
+};
+
+struct ColdChunk;
+struct Loader;
+struct Pager;
+struct RowChunks;
+struct Server;
+struct Session;
+
+uint const TabSize = 4;
+
+// Rows of at least this many bytes are kept in chunks; see Chunks.cpp.
+int const LongRowBytes = 64 * 1024;
+
+struct Row {
+  int idx;
+  int size;
+  int rsize;
+  char *chars;
+  char *render;
+  unsigned char *hl;
+  int hl_open_comment;
+  ColumnStop *stops;
+  int numStops;
+  // Set while the row is cold: `chars`, `render`, `hl` and `stops` are null,
+  // and its text is `size` bytes at `coldOffset` in the unpacked chunk.
+  ColdChunk *cold;
+  int coldOffset;
+  // Set for a long row, whose text is split into chunks that are rendered
+  // and highlighted only near the view: `chars`, `render`, `hl` and `stops`
+  // are null, and `rsize` is the length of the whole rendering.
+  RowChunks *chunks;
+  // Set while `hl` is plain because the row's comment state came from a
+  // session cache instead of highlighting it: knowing that, it can be
+  // highlighted on its own once it is shown. See Session.cpp.
+  bool lazy;
+};
+
+// The unpacked text of the last cold chunk read through it, and the joined
+// text of the last long row. Each thread that reads such rows needs its own.
+struct ColdCache {
+  ColdChunk const *chunk = nullptr;
+  std::string text;
+  RowChunks const *joined = nullptr;
+  uint64_t joinedVersion = 0;
+  std::string joinedText;
+};
+
+struct Cursor {
+  int x;
+  int y;
+
+  bool operator<(Cursor const &other) const {
+    return y != other.y ? y < other.y : x < other.x;
+  }
+  bool operator==(Cursor const &other) const {
+    return x == other.x && y == other.y;
+  }
+};
+
+// The cursor and scroll position of a window onto a buffer.
+struct View {
+  int cursorX;
+  int renderX;
+  int cursorY;
+  int rowOffset;
+  int colOffset;
+  // Cursors besides (cursorX, cursorY), in order and all on rows of the
+  // buffer. Typing and deleting happen at every one of them; see Cursors.cpp.
+  std::vector<Cursor> cursors;
+  // While `selecting`, the selection runs between `anchor` and the cursor.
+  bool selecting;
+  Cursor anchor;
+};
+
+// Which rows of a buffer may still be warm: every row outside
+// [warmFrom, warmTo] is cold. While the row pool is over budget the idle
+// worker sweeps that range from `next`, packing rows away from the view, and
+// narrows it to the rows it had to keep, [keptFrom, keptTo].
+struct ColdSweep {
+  int warmFrom;
+  int warmTo;
+  int next;
+  int keptFrom;
+  int keptTo;
+};
+
+// Undoes one replace: the text its rows had before. Only applies to the
+// buffer version it produced, since rows are saved by index.
+struct UndoStep {
+  struct SavedRow {
+    int idx;
+    char *chars;
+    int size;
+  };
+  unsigned long before;
+  unsigned long after;
+  std::vector<SavedRow> rows;
+};
+
+// The file a buffer was last read from or written to in full, for the
+// session cache to know whether the buffer and the file still match.
+struct FileStamp {
+  bool valid;
+  uint64_t size;
+  int64_t mtimeNs;
+  // CRC-32 of the contents.
+  uint32_t hash;
+  // The buffer's version then; any edit since leaves the stamp stale.
+  unsigned long version;
+};
+
+// A file's contents and everything derived from them. Buffers stay resident
+// while other buffers are shown, so switching between them is instant.
+struct Buffer {
+  Row *row;
+  int numRows;
+  int rowCapacity;
+  LineIndex lineIndex;
+  int dirty;
+  // Bumped by every edit, unlike `dirty` which saving resets.
+  unsigned long version;
+  // Saved through gzip: it was read from a gzip file, or is named *.gz.
+  bool gzip;
+  char *filename;
+  dev_t device;
+  ino_t inode;
+  struct EditorSyntax *syntax;
+  // First row the highlighting worker has not reached yet, or -1 once every
+  // row is highlighted. Rows from here on are drawn plain until it gets there.
+  int highlightFrom;
+  // The view to restore when this buffer is shown again.
+  View savedView;
+  // Oldest first.
+  std::vector<UndoStep> undo;
+  ColdSweep cold;
+  // Set while the rest of the file is still being read in, see Load.cpp.
+  // Its rows arrive at the end, so nothing may be added there meanwhile.
+  Loader *loader;
+  // Set while a file is loading with its session cache, see Session.cpp.
+  Session *session;
+  FileStamp stamp;
+};
+
+// Live numbers for the performance HUD. Nothing is measured while the HUD is
+// hidden. Times are CLOCK_MONOTONIC microseconds; the HUD drawn in a frame
+// shows the numbers of the frame before it.
+struct PerfHud {
+  bool shown;
+  // When the key being handled was read, or 0 once its frame is out.
+  long keyMicros;
+  // Building and writing the last frame.
+  long frameMicros;
+  long frameBytes;
+  // Highlighting done by edits since the last key, and how many rows of it
+  // only happened because a multi-line comment opened or closed above them.
+  long highlightMicros;
+  int cascadeRows;
+  // From reading a key to the frame answering it being written.
+  long latencyMicros;
+};
+
+// What the text area of the terminal shows as of the last frame: the bytes
+// drawn on each line, and where in which buffer they came from. An empty line
+// has unknown contents and is always redrawn.
+struct Screen {
+  std::vector<std::string> lines;
+  Buffer *buf;
+  int rowOffset;
+  int colOffset;
+  int cols;
+};
+
+// A search prompt's place: the last match and which way to look for the
+// next, and the row whose highlighting shows the match, to put back. Under
+// --server each client has its own, as any of them may be searching.
+struct SearchState {
+  int lastMatch = -1;
+  int direction = 1;
+  // The buffer and row the match is marked in, or nullptr. Its highlighting
+  // before is kept in `savedHl`, unless it is in chunks, whose renderings
+  // are dropped instead.
+  Buffer *buf = nullptr;
+  int line = 0;
+  char *savedHl = nullptr;
+  int savedSize = 0;
+  bool chunks = false;
+};
+
+struct EditorConfig {
+  Buffer *buf;
+  View view;
+  std::vector<Buffer *> buffers;
+  int screenRows;
+  int screenCols;
+  char statusmsg[80];
+  time_t statusmsg_time;
+  SearchState search;
+  struct termios originalTermios;
+  PerfHud hud;
+  Screen screen;
+  // Bytes the row pool may hold before rows start being packed, or 0 for no
+  // limit.
+  size_t memoryBudget;
+  // 0-9 for gzip files written by editorSave, or -1 for zlib's default.
+  int gzipLevel;
+  // Files opened are followed as they grow, like `tail -f`; see Load.cpp.
+  bool follow;
+  // The lines last copied or cut, sharing their storage with the rows they
+  // came from; see Clipboard.cpp. Joined by newlines, they are the text.
+  std::vector<Row> clipboard;
+  // Set under --view: the file is paged through read-only, straight from a
+  // mapping of it, instead of being loaded into a buffer; see Pager.cpp.
+  Pager *pager;
+  // Where sessions are cached, or empty for none; see Session.cpp.
+  std::string sessionDir;
+  // The terminal keys are read from and frames drawn to. Under --server it
+  // is that of the client being served, set along with `server`; see
+  // Server.cpp.
+  int inputFd;
+  int outputFd;
+  Server *server;
+};
+
+extern EditorConfig E;
+
+// Row text, render copies, highlighting and the row arrays of every buffer
+// come out of this one pool, each counted under one of these categories so
+// Ctrl-K and --memory-stats can say where the memory goes; see Hud.cpp.
+extern Pool RowPool;
+
+enum Memory {
+  OtherMemory,
+  TextMemory,
+  RenderMemory,
+  HighlightMemory,
+  StopsMemory,
+  RowArrayMemory,
+  ColdMemory,
+  SearchMemory,
+  FrameMemory,
+  NumMemory
+};
+
+enum Key {
+  BackSpace = 127,
+  ArrowLeft = 1000,
+  ArrowRight,
+  ArrowUp,
+  ArrowDown,
+  Delete,
+  PageUp,
+  PageDown,
+  Home,
+  End,
+  // Returned by editorReadKey when idle work changed something on screen.
+  Idle,
+};
+
+enum Highlight {
+  Normal = 0,
+  Comment,
+  MultiLineComment,
+  String,
+  Number,
+  Keyword1,
+  Keyword2,
+  Match,
+};
+
+template <typename T> void free(T *t) { free(reinterpret_cast<void *>(t)); }
+
+template <typename T> void free(T const *t) {
+  free(reinterpret_cast<void *>(const_cast<char *>(t)));
+}
+
+struct AppendBuffer {
+  char *buffer;
+  int length;
+
+  AppendBuffer() : buffer{nullptr}, length{0} {}
+
+  // Grows by doubling, so a frame of many small appends is copied a few
+  // times at most.
+  void append(char const *s, int length) {
+    size_t size = this->length + length;
+    size_t capacity = RowPool.Capacity(this->buffer);
+    if (size > capacity) {
+      char *n = static_cast<char *>(RowPool.Reallocate(
+          this->buffer, std::max(size, capacity * 2), FrameMemory));
+      if (n == nullptr)
+        return;
+      this->buffer = n;
+    }
+
+    memcpy(&this->buffer[this->length], s, length);
+    this->length += length;
+  }
+
+  ~AppendBuffer() { RowPool.Deallocate(buffer); }
+};
+
+char const *const KiloVersion = "0.0.1";
+int const KiloQuitTimes = 3;
+
+// Terminal.cpp
+void die(const char *s);
+int editorReadKey();
+int getCursorPosition(int *rows, int *cols);
+int getWindowSize(int *rows, int *cols);
+void editorUpdateWindowSize();
+void disableRawMode();
+void enableRawMode();
+bool editorInputPending();
+void editorWriteOutput(char const *data, size_t length);
+
+// Syntax.cpp
+void editorUpdateSyntax(Buffer *buf, Row *row);
+void editorUpdateSyntaxRange(Buffer *buf, int first, int last);
+void editorCascadeSyntax(Buffer *buf, int last);
+bool editorHighlightSome(Buffer *buf, int count);
+int editorLoadSyntaxDir(char const *dir, std::string &errors);
+void editorSelectSyntaxHighlight();
+int editorSyntaxToColor(int hl);
+
+// Row.cpp
+void editorRenderRow(Row *row, int column = 0);
+void editorUpdateRow(Row *row);
+void editorMarkChanged(Buffer *buf);
+void editorInsertRows(int at, Row *rows, int count);
+void editorInsertRow(int at, char *s, size_t len);
+void editorRowInsertChar(Row *row, int at, int c);
+void editorRowInsertString(Row *row, int at, char const *s, size_t len);
+void editorInsertChar(int c);
+void editorInsertNewLine();
+void editorInsertText(char const *s, size_t len);
+void editorRowDelChar(Row *row, int at);
+void editorFreeRow(Row *row);
+void editorRowAppendString(Row *row, char *s, size_t len);
+void editorDelRows(int at, int count, Row *taken = nullptr);
+void editorDelRow(int at);
+void editorDelChar();
+int editorRowCxToRx(Row *row, int cursorX);
+int editorRowRxToCx(Row *row, int renderX);
+int editorRowRenderToCx(Row *row, int renderIndex);
+int editorRowRxToRender(Row *row, int renderX);
+int editorRowRenderToRx(Row *row, int renderIndex);
+
+// Buffer.cpp
+char *editorRowsToString(size_t *buflen);
+bool editorHasGzipExtension(char const *filename);
+Buffer *editorNewBuffer(char const *filename);
+void editorSwitchBuffer(Buffer *buf);
+void editorCloseBuffer(Buffer *buf);
+Buffer *editorOpen(char const *filename);
+void editorSave();
+int editorBufferIndex(Buffer *buf);
+bool editorAnyBufferDirty();
+bool editorAnyBufferLoading();
+
+// Load.cpp
+Row editorBuildRow(char const *line, size_t len);
+void editorStartLoad(Buffer *buf, int fd, bool gzip, bool follow);
+bool editorLoadSome(Buffer *buf, bool wait);
+void editorFinishLoad(Buffer *buf);
+void editorCancelLoad(Buffer *buf);
+bool editorFollowing(Buffer const *buf);
+bool editorLoadCaughtUp(Buffer const *buf);
+int editorLoadPercent(Buffer const *buf);
+
+// Search.cpp
+void editorFindCallback(char *query, int key);
+void editorFind();
+int editorReplaceAll(char const *query, char const *replacement,
+                     int *rows = nullptr);
+void editorReplace();
+void editorAddCursorsAtMatches();
+std::vector<std::string> const &editorSearchHistory();
+void editorAddSearchHistory(std::string const &query);
+
+// Cursors.cpp
+void editorSetCursors(std::vector<Cursor> &&cursors);
+void editorClearCursors();
+bool editorMultiCursorKey(int c);
+
+// Clipboard.cpp
+void editorToggleSelection();
+bool editorSelection(Cursor *from, Cursor *to);
+void editorCopy();
+void editorCut();
+void editorPaste();
+void editorWriteSelection();
+
+// Filter.cpp
+bool editorFilterRows(int first, int end, char const *command,
+                      std::string &error);
+void editorFilter();
+
+// Undo.cpp
+void editorPushUndo(Buffer *buf, UndoStep &&step);
+void editorUndo();
+void editorFreeUndo(Buffer *buf);
+
+// Cold.cpp
+bool editorOverBudget();
+char const *editorRowText(Row const *row);
+char const *editorRowText(Row const *row, ColdCache &cache);
+void editorDropCold(Row *row);
+char *editorTakeRowText(Row *row);
+Row editorShareRow(Row const *row);
+void editorNoteWarm(Buffer *buf, int y);
+void editorShiftCold(Buffer *buf, int at, int delta);
+void editorWarmRow(Buffer *buf, Row *row);
+void editorWarmRows(Buffer *buf, int first, int last);
+void editorCompactLoaded(Buffer *buf, int first);
+bool editorCompactSome(Buffer *buf, int count);
+
+// Chunks.cpp
+bool editorChunkText(Row *row, char const *s, int len);
+bool editorChunkRow(Row *row);
+void editorChunkRows(Buffer *buf, int first, int last);
+void editorDropChunks(Row *row);
+void editorForgetChunks(Row *row);
+Row editorShareChunks(Row const *row);
+void editorCopyChunks(Row const *row, char *out);
+char const *editorChunksText(Row const *row, ColdCache &cache);
+int editorChunkCount(Row const *row);
+int editorChunkAt(Row const *row, int ColumnStop::*axis, int value);
+ColumnStop editorChunkPiece(Buffer *buf, Row *row, int k, Row *piece);
+bool editorHighlightChunks(Buffer *buf, Row *row, int first);
+void editorChunkInsert(Buffer *buf, Row *row, int at, char const *s, int len);
+void editorChunkDelete(Buffer *buf, Row *row, int at, int len);
+int editorRowNextBoundary(Row const *row, int at);
+int editorRowPrevBoundary(Row const *row, int at);
+int editorRowCharStart(Row const *row, int at);
+
+// Session.cpp
+int64_t editorMtimeNs(struct stat const &st);
+Session *editorOpenSession(char const *filename, struct stat const &st,
+                           EditorSyntax const *syntax);
+void editorCloseSession(Session *session);
+uint32_t editorSessionRows(Session const *session);
+uint32_t editorSessionLength(Session const *session, uint32_t row);
+int editorSessionRowsLoaded(Buffer *buf, int first, int last);
+bool editorSessionLoaded(Buffer *buf, uint32_t hash);
+void editorSaveSession(Buffer const *buf);
+
+// Server.cpp
+std::string editorDefaultSocketPath();
+int editorRunServer(char const *path);
+int editorRunClient(char const *path, std::vector<std::string> const &files);
+bool editorServerInputPending();
+bool editorClientGone();
+bool editorClientWaitKey();
+void editorClientWrite(char const *data, size_t length);
+bool editorClientBacklogged();
+void editorDetachClient();
+void editorServerForgetBuffer(Buffer *buf);
+
+// Hud.cpp
+long editorMicros();
+long editorResidentKiB();
+void editorToggleHud();
+void editorDrawHud(AppendBuffer &ab);
+// Shows RowPool's memory by category on the status bar, largest first.
+void editorShowMemory();
+// Writes a table of each category's current and peak bytes to `fp`.
+void editorPrintMemoryStats(FILE *fp);
+
+// Pager.cpp
+bool editorStartPager(char const *filename);
+void editorDrawPagerRows(AppendBuffer &ab);
+void editorPagerStatus(char *status, char *rstatus, size_t size);
+bool editorPagerIdle();
+void editorPagerKey(int c);
+
+// Render.cpp
+void editorSetStatusMessage(char const *fmt, ...);
+void editorScroll();
+void editorDrawRowText(AppendBuffer &ab, Row *row, int fileRow);
+void editorDrawRows(AppendBuffer &ab);
+void editorDrawScreenLines(AppendBuffer &ab, int shift,
+                           void (*drawLine)(AppendBuffer &, int));
+void editorDrawChangedRows(AppendBuffer &ab);
+void editorInvalidateScreen();
+void editorDrawStatusBar(AppendBuffer &ab);
+void editorDrawMessageBar(AppendBuffer &ab);
+void editorRefreshScreen();
+
+// Editor.cpp
+void initEditor();
+char *editorPrompt(char *prompt, void (*callback)(char *, int) = nullptr,
+                   bool allowEmpty = false,
+                   std::vector<std::string> const *history = nullptr);
+void editorMoveCursor(int key);
+void editorClampCursor();
+bool editorGoto(char const *target);
+void editorGotoPrompt();
+bool editorRunIdleWork();
+void editorOpenPrompt();
+void editorNextBuffer();
+void editorProcessKeypress();
@@ -0,0 +1,100 @@
+#pragma once
+
+#include <cstdint>
+#include <memory>
+#include <string>
+#include <vector>
+
+// A language's lexical rules as read from a syntax definition file:
+//
+//   # Comments start a line with '#'.
+//   name = go
+//   files = .go
+//   keywords = break case chan const continue
+//   keywords = default defer else
+//   types = bool byte int string
+//   line_comment = //
+//   block_comment = /* */
+//   strings = " ' `
+//   numbers = yes
+//
+// List values are separated by spaces and repeated keys add to the list.
+// `escape` names the character that escapes the next one inside strings; it
+// is a backslash unless set to another character or `none`.
+struct LexerSpec {
+  std::string name;
+  std::vector<std::string> files;
+  std::vector<std::string> keywords;
+  std::vector<std::string> types;
+  std::vector<std::string> lineComments;
+  std::string blockCommentStart;
+  std::string blockCommentEnd;
+  std::string quotes;
+  // Escapes the character after it inside a string; 0 for none.
+  char escape = '\\';
+  bool numbers = false;
+};
+
+// Parses a definition into `spec`. On failure returns false and describes
+// the first problem, with its line number, in `error`.
+bool parseLexerSpec(std::string const &text, LexerSpec &spec,
+                    std::string &error);
+
+// A lexer compiled from a LexerSpec into one DFA over bytes. Scanning a row is
+// a table lookup per byte, taking the longest token at each position, and a
+// fill of the token's highlighting once it ends. Bytes that no column of the
+// table tells apart share a class, which keeps the table a few KiB.
+class Lexer {
+public:
+  enum Token {
+    Normal,
+    Comment,
+    BlockComment,
+    String,
+    Number,
+    Keyword,
+    Type,
+    NumTokens,
+  };
+
+  // Builds the lexer for `spec`, writing `output[t]` into the highlighting
+  // for bytes of token t. Returns nullptr and sets `error` if the spec can't
+  // be lexed this way.
+  static std::unique_ptr<Lexer> Compile(LexerSpec const &spec,
+                                        unsigned char const output[NumTokens],
+                                        std::string &error);
+
+  // Fills `hl[0, length)` for the row `text`. `inBlockComment` says whether
+  // the row starts inside a block comment; returns whether it ends in one.
+  bool Scan(char const *text, int length, unsigned char *hl,
+            bool inBlockComment) const;
+
+  // Where a piece of a row starts and ends: outside any token, inside a
+  // block comment, or inside a string at InString plus some DFA state.
+  // String states only carry between pieces of one row, which is how long
+  // rows are highlighted a chunk at a time.
+  static constexpr int Outside = 0;
+  static constexpr int InBlockComment = 1;
+  static constexpr int InString = 0x100;
+
+  // The same for a piece of a row, starting from what scanning the piece
+  // before it returned.
+  int ScanFrom(char const *text, int length, unsigned char *hl,
+               int from) const;
+
+  int NumStates() const { return m_accepting.size(); }
+  int NumClasses() const { return m_numClasses; }
+
+private:
+  Lexer() = default;
+
+  uint8_t m_classes[256];
+  int m_numClasses = 0;
+  std::vector<uint16_t> m_table;
+  std::vector<unsigned char> m_output;
+  std::vector<uint8_t> m_accepting;
+  std::vector<uint8_t> m_inBlock;
+  std::vector<uint8_t> m_inString;
+  uint16_t m_start = 0;
+  uint16_t m_blockStart = 0;
+};
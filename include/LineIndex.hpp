@@ -0,0 +1,52 @@
+#pragma once
+
+#include <cstddef>
+#include <cstdint>
+#include <vector>
+
+// Cumulative byte lengths of the rows of a buffer, so that the byte offset
+// of a line and the line containing a byte offset are both O(log n).
+//
+// The lengths are kept in blocks of a few hundred lines, with Fenwick trees
+// over the blocks' line counts and byte sums. Any edit, at the end or in the
+// middle, changes one block and O(log n) nodes of the trees. Only when
+// blocks split or merge are the trees rebuilt, and they have a node per
+// block, not per line.
+class LineIndex {
+  struct Block {
+    std::vector<uint64_t> lengths;
+    uint64_t bytes = 0;
+  };
+  std::vector<Block> m_blocks;
+  // Fenwick trees over m_blocks, 1-based: line counts and byte sums.
+  std::vector<uint64_t> m_lines = {0};
+  std::vector<uint64_t> m_bytes = {0};
+  size_t m_size = 0;
+
+  void Rebuild();
+  void AddBlock(uint64_t length);
+  void Grow(size_t block, int64_t lines, int64_t bytes);
+  // The block holding `line`, and where in it the line is.
+  size_t Find(size_t line, size_t *within) const;
+  void SplitOrMerge(size_t block);
+
+public:
+  size_t Size() const { return m_size; }
+  uint64_t Length(size_t line) const;
+
+  void Clear();
+  void Append(uint64_t length);
+  void Insert(size_t line, uint64_t length) { Insert(line, &length, 1); }
+  void Erase(size_t line) { Erase(line, 1); }
+  // The same for a run of `count` lines.
+  void Insert(size_t line, uint64_t const *lengths, size_t count);
+  void Erase(size_t line, size_t count);
+  void Set(size_t line, uint64_t length);
+
+  // Byte offset of the start of `line`; `Offset(Size())` is the total size.
+  uint64_t Offset(size_t line) const;
+  uint64_t TotalBytes() const;
+
+  // The line containing byte `offset`, clamped to the last line.
+  size_t LineAt(uint64_t offset) const;
+};
@@ -0,0 +1,98 @@
+#pragma once
+
+#include <atomic>
+#include <cstddef>
+#include <cstdint>
+#include <mutex>
+#include <vector>
+
+// A size-class allocator for the many small, frequently resized blocks that
+// hold row text and its derived data. Freed blocks go onto a free list for
+// their class and are reused, so editing does not churn malloc, and every
+// buffer draws from the same pool so memory use can be read off in one place.
+//
+// Blocks up to `LargestClass` bytes are carved from slabs; larger ones go
+// straight to malloc. Each class has its own lock, so threads that build rows
+// off the main thread can share the pool.
+//
+// A block can have several owners, so rows can share their text instead of
+// copying it. `Reallocate` copies a shared block rather than resizing it in
+// place, and anyone about to write into a block they may share calls
+// `Unshare` first.
+//
+// Every block is counted against a category chosen by the caller, 0 unless
+// given, so the pool can say what its memory holds: the bytes each category
+// has now and the most it ever had. Counting is a couple of relaxed atomic
+// adds per call, cheap enough to leave on.
+class Pool {
+public:
+  static size_t const SmallestClass = 16;
+  static size_t const LargestClass = 64 * 1024;
+  static int const NumClasses = 13;
+  static int const NumCategories = 16;
+
+  Pool() = default;
+  ~Pool();
+  Pool(Pool const &) = delete;
+  Pool &operator=(Pool const &) = delete;
+
+  // Behaves like malloc/realloc/free. `Reallocate` is free when the new size
+  // still fits in the block's class; a block it moves goes to `category`.
+  void *Allocate(size_t size, int category = 0);
+  void *Reallocate(void *p, size_t size, int category = 0);
+  void Deallocate(void *p);
+
+  // Adds an owner to `p`, which is then freed by its last `Deallocate`.
+  void Share(void *p);
+  // `p` if the caller is its only owner, or else a copy of it that is, the
+  // caller giving up its share of `p`.
+  void *Unshare(void *p);
+
+  // Bytes usable through `p`, at least what was asked for.
+  size_t Capacity(void const *p) const;
+
+  // Bytes handed out to callers, and bytes obtained from the system.
+  size_t BytesInUse() const { return m_inUse.load(std::memory_order_relaxed); }
+  size_t BytesReserved() const {
+    return m_reserved.load(std::memory_order_relaxed);
+  }
+  // The most ever in use at once.
+  size_t PeakBytesInUse() const {
+    return m_peak.load(std::memory_order_relaxed);
+  }
+
+  // The same for the blocks of one category.
+  size_t BytesInUse(int category) const {
+    return m_categories[category].inUse.load(std::memory_order_relaxed);
+  }
+  size_t PeakBytesInUse(int category) const {
+    return m_categories[category].peak.load(std::memory_order_relaxed);
+  }
+
+private:
+  struct FreeBlock {
+    FreeBlock *next;
+  };
+
+  struct SizeClass {
+    std::mutex lock;
+    FreeBlock *free = nullptr;
+  };
+
+  struct Category {
+    std::atomic<size_t> inUse{0};
+    std::atomic<size_t> peak{0};
+  };
+
+  SizeClass m_classes[NumClasses];
+  std::mutex m_slabLock;
+  std::vector<void *> m_slabs;
+  std::atomic<size_t> m_inUse{0};
+  std::atomic<size_t> m_peak{0};
+  std::atomic<size_t> m_reserved{0};
+  Category m_categories[NumCategories];
+
+  void Refill(int sizeClass);
+  void Count(int category, size_t bytes);
+  void Uncount(int category, size_t bytes);
+};
@@ -0,0 +1,99 @@
+#pragma once
+
+#include <atomic>
+#include <cstdint>
+#include <cstdio>
+#include <memory>
+#include <mutex>
+#include <vector>
+
+// Records how long the editor spends in its hot paths, for Chrome's trace
+// viewer or Perfetto. Each thread appends to a ring of its own, so recording
+// an event is a couple of clock reads and stores without any locking; once a
+// ring wraps, its oldest events are overwritten. `Flush` writes whatever the
+// rings hold as Chrome trace JSON, skipping any event caught mid-write by a
+// thread that was still recording. A thread that exits hands its ring on to
+// the next new thread, so short-lived workers don't each leave one behind.
+//
+// Probes are placed with TRACE_SCOPE and cost a branch on `Enabled` when no
+// trace was asked for. Configuring with KILO_TRACE off removes them outright.
+class Tracer {
+public:
+  static constexpr size_t RingSize = 1 << 16;
+
+  Tracer();
+  ~Tracer();
+  Tracer(Tracer const &) = delete;
+  Tracer &operator=(Tracer const &) = delete;
+
+  // Starts recording into a trace that `Flush` writes to `path`. Returns
+  // false, with errno set, if the file can't be created.
+  bool Start(char const *path);
+  bool Enabled() const { return m_enabled.load(std::memory_order_relaxed); }
+
+  // Adds a complete event on the calling thread. `name` must outlive the
+  // tracer; probes pass string literals.
+  void Record(char const *name, uint64_t begin, uint64_t end);
+
+  // Writes every recorded event out and stops recording.
+  bool Flush();
+
+  // Rings allocated so far, for tests.
+  size_t Rings();
+
+  // Nanoseconds on the monotonic clock.
+  static uint64_t Now();
+
+private:
+  // The fields are written while `Flush` may be reading them. `seq` is one
+  // past the event's index in its ring once it is complete, and 0 while it
+  // is being written.
+  struct Event {
+    std::atomic<uint64_t> seq{0};
+    std::atomic<char const *> name{nullptr};
+    std::atomic<uint64_t> begin{0};
+    std::atomic<uint64_t> end{0};
+    std::atomic<int> tid{0};
+  };
+
+  struct Ring {
+    Event events[RingSize];
+    std::atomic<uint64_t> head{0};
+    // Whether a live thread records into the ring.
+    std::atomic<bool> owned{true};
+  };
+
+  Ring *ThreadRing();
+  friend struct ThreadSlot;
+
+  uint64_t m_id;
+  std::atomic<bool> m_enabled{false};
+  FILE *m_file = nullptr;
+  uint64_t m_start = 0;
+  std::mutex m_ringLock;
+  std::vector<std::shared_ptr<Ring>> m_rings;
+};
+
+extern Tracer Trace;
+
+// Records the lifetime of the enclosing scope as one event.
+class TraceScope {
+  char const *m_name;
+  uint64_t m_begin;
+
+public:
+  explicit TraceScope(char const *name)
+      : m_name(name), m_begin(Trace.Enabled() ? Tracer::Now() : 0) {}
+  ~TraceScope() {
+    if (m_begin)
+      Trace.Record(m_name, m_begin, Tracer::Now());
+  }
+};
+
+#ifdef KILO_TRACE
+#define TRACE_CONCAT_IMPL(a, b) a##b
+#define TRACE_CONCAT(a, b) TRACE_CONCAT_IMPL(a, b)
+#define TRACE_SCOPE(name) TraceScope TRACE_CONCAT(traceScope, __LINE__)(name)
+#else
+#define TRACE_SCOPE(name) ((void)0)
+#endif
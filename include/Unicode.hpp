@@ -0,0 +1,31 @@
+#pragma once
+
+#include <cstddef>
+#include <cstdint>
+
+uint32_t const ReplacementCharacter = 0xfffd;
+
+// Returns true if none of the first `len` bytes of `s` has its high bit set.
+// Checks whole vector registers at a time so that pure-ASCII text, which is
+// the common case, is rejected from the decoding path almost for free.
+bool utf8IsAscii(char const *s, size_t len);
+
+// Decodes the code point starting at `s` and returns the number of bytes it
+// occupies. Malformed, overlong, truncated and surrogate sequences decode to
+// `ReplacementCharacter` with a length of 1 so the caller always advances.
+int utf8Decode(char const *s, size_t len, uint32_t *codepoint);
+
+// Number of terminal columns `codepoint` occupies: 0 for combining marks and
+// other zero-width characters, 2 for East Asian wide characters and emoji,
+// otherwise 1.
+int codepointWidth(uint32_t codepoint);
+
+inline bool utf8IsContinuation(char c) {
+  return (static_cast<unsigned char>(c) & 0xc0) == 0x80;
+}
+
+// Index of the start of the character after the one at `at`.
+int utf8NextBoundary(char const *s, int len, int at);
+
+// Index of the start of the character before `at`.
+int utf8PrevBoundary(char const *s, int at);
@@ -0,0 +1,294 @@
+#include <Editor.hpp>
+
+#include <errno.h>
+#include <fcntl.h>
+#include <limits.h>
+#include <stdio.h>
+#include <string.h>
+#include <sys/stat.h>
+#include <unistd.h>
+#include <zlib.h>
+
+#include <algorithm>
+
+#include <Trace.hpp>
+
+char *editorRowsToString(size_t *buflen) {
+  size_t totlen = E.buf->lineIndex.TotalBytes();
+  *buflen = totlen;
+
+  char *buf = static_cast<char *>(malloc(totlen));
+  char *p = buf;
+  for (int j = 0; j < E.buf->numRows; ++j) {
+    memcpy(p, editorRowText(&E.buf->row[j]), E.buf->row[j].size);
+    p += E.buf->row[j].size;
+    *p = '\n';
+    ++p;
+  }
+
+  return buf;
+}
+
+// Compressed files are written through zlib this much at a time.
+size_t const GzipChunk = 256 * 1024;
+
+bool editorHasGzipExtension(char const *filename) {
+  size_t len = filename ? strlen(filename) : 0;
+  return len > 3 && strcmp(filename + len - 3, ".gz") == 0;
+}
+
+Buffer *editorNewBuffer(char const *filename) {
+  Buffer *buf = new Buffer{};
+  buf->filename = filename ? strdup(filename) : nullptr;
+  buf->gzip = editorHasGzipExtension(filename);
+  buf->highlightFrom = -1;
+  buf->cold = ColdSweep{INT_MAX, -1, -1, INT_MAX, -1};
+  buf->lineIndex.Clear();
+  E.buffers.push_back(buf);
+  return buf;
+}
+
+void editorSwitchBuffer(Buffer *buf) {
+  if (E.buf == buf)
+    return;
+  if (E.buf)
+    E.buf->savedView = E.view;
+  E.buf = buf;
+  E.view = buf->savedView;
+}
+
+// Drops `buf` and its rows. If it was showing, shows its neighbour instead,
+// or a fresh empty buffer if it was the last one.
+void editorCloseBuffer(Buffer *buf) {
+  auto it = std::find(E.buffers.begin(), E.buffers.end(), buf);
+  size_t index = it - E.buffers.begin();
+  E.buffers.erase(it);
+  editorCancelLoad(buf);
+  editorSaveSession(buf);
+
+  if (E.buf == buf) {
+    E.buf = nullptr;
+    if (E.buffers.empty())
+      editorNewBuffer(nullptr);
+    editorSwitchBuffer(E.buffers[index < E.buffers.size() ? index : 0]);
+  }
+  if (E.server)
+    editorServerForgetBuffer(buf);
+
+  for (int j = 0; j < buf->numRows; ++j)
+    editorFreeRow(&buf->row[j]);
+  RowPool.Deallocate(buf->row);
+  editorFreeUndo(buf);
+  free(buf->filename);
+  delete buf;
+}
+
+static void editorRememberFileIdentity(Buffer *buf) {
+  struct stat st;
+  if (buf->filename && stat(buf->filename, &st) == 0) {
+    buf->device = st.st_dev;
+    buf->inode = st.st_ino;
+  }
+}
+
+// Shows `filename`, switching to the buffer that already has it open or
+// loading it into a new one. Only the first screenful is read before this
+// returns; the rest loads in the background, see Load.cpp. Gzip files are
+// inflated as they load, and other files are followed as they grow under
+// --follow. With --session-dir, a plain file opened before and unchanged since
+// is cut into lines and highlighted from its session; see Session.cpp.
+// Returns nullptr with errno set if the file can't be opened.
+Buffer *editorOpen(char const *filename) {
+  TRACE_SCOPE("editorOpen");
+  struct stat st;
+  bool found = stat(filename, &st) == 0;
+  if (found) {
+    for (Buffer *buf : E.buffers) {
+      if (buf->filename && buf->device == st.st_dev &&
+          buf->inode == st.st_ino) {
+        editorSwitchBuffer(buf);
+        return buf;
+      }
+    }
+  }
+
+  int fd = open(filename, O_RDONLY);
+  if (fd == -1)
+    return nullptr;
+  unsigned char magic[2];
+  bool gzip = pread(fd, magic, 2, 0) == 2 && magic[0] == 0x1f &&
+              magic[1] == 0x8b;
+
+  // An untouched scratch buffer is replaced rather than kept around.
+  Buffer *scratch = E.buf;
+  if (scratch && (scratch->filename || scratch->numRows || scratch->dirty))
+    scratch = nullptr;
+
+  editorSwitchBuffer(editorNewBuffer(filename));
+  editorRememberFileIdentity(E.buf);
+  editorSelectSyntaxHighlight();
+  E.buf->gzip = gzip;
+  if (found && !gzip && !E.follow)
+    E.buf->session = editorOpenSession(filename, st, E.buf->syntax);
+
+  // The first frame only needs a screenful; the idle worker takes the rest.
+  // A session's view may be far down the file, so it isn't waited for: it
+  // is restored once the idle worker has read the rows it shows.
+  editorStartLoad(E.buf, fd, gzip, E.follow);
+  while (E.buf->loader && E.buf->numRows < E.screenRows &&
+         !editorLoadCaughtUp(E.buf))
+    editorLoadSome(E.buf, true);
+
+  if (scratch)
+    editorCloseBuffer(scratch);
+  return E.buf;
+}
+
+// Deflates the shown buffer into `fd` a row at a time, and closes `fd`.
+// Returns the uncompressed size, or -1 with errno set.
+static ssize_t editorWriteGzip(int fd) {
+  TRACE_SCOPE("editorWriteGzip");
+  char mode[] = "wb?";
+  if (E.gzipLevel >= 0 && E.gzipLevel <= 9)
+    mode[2] = '0' + E.gzipLevel;
+  else
+    mode[2] = '\0';
+  gzFile gz = gzdopen(fd, mode);
+  if (gz == nullptr) {
+    close(fd);
+    return -1;
+  }
+  gzbuffer(gz, GzipChunk);
+
+  errno = 0;
+  bool ok = true;
+  for (int j = 0; ok && j < E.buf->numRows; ++j) {
+    Row *row = &E.buf->row[j];
+    ok = (row->size == 0 || gzwrite(gz, editorRowText(row), row->size) > 0) &&
+         gzputc(gz, '\n') != -1;
+  }
+  if (gzclose(gz) != Z_OK || !ok) {
+    if (errno == 0)
+      errno = EIO;
+    return -1;
+  }
+  return E.buf->lineIndex.TotalBytes();
+}
+
+// Notes that the shown buffer matches its file again, just written to `fd`
+// from `text`, for the session cache.
+static void editorStampSaved(int fd, char const *text, size_t len) {
+  struct stat st;
+  if (E.sessionDir.empty() || fstat(fd, &st) != 0)
+    return;
+  uLong hash = crc32(0, nullptr, 0);
+  // crc32() takes at most 4 GiB at a time.
+  for (size_t done = 0; done < len;) {
+    uInt n = std::min<size_t>(len - done, UINT_MAX);
+    hash = crc32(hash, reinterpret_cast<Bytef const *>(text + done), n);
+    done += n;
+  }
+  E.buf->stamp = FileStamp{true, static_cast<uint64_t>(st.st_size),
+                           editorMtimeNs(st), static_cast<uint32_t>(hash),
+                           E.buf->version};
+}
+
+void editorSave() {
+  TRACE_SCOPE("editorSave");
+  if (editorFollowing(E.buf)) {
+    editorSetStatusMessage("Can't save a file being followed");
+    return;
+  }
+  if (E.buf->loader) {
+    editorSetStatusMessage("Can't save until the file has loaded");
+    return;
+  }
+  if (E.buf->filename == nullptr) {
+    char *filename = editorPrompt(const_cast<char *>("Save as: %s"));
+    if (filename == nullptr) {
+      editorSetStatusMessage("Save aborted");
+      return;
+    }
+    // Under --server another client may have named the buffer during the
+    // prompt, or closed it and left this one on another.
+    if (E.buf->loader) {
+      editorSetStatusMessage("Can't save until the file has loaded");
+      free(filename);
+      return;
+    }
+    free(E.buf->filename);
+    E.buf->filename = filename;
+
+    E.buf->gzip = editorHasGzipExtension(E.buf->filename);
+    editorSelectSyntaxHighlight();
+  }
+
+  if (E.buf->gzip) {
+    ssize_t len = -1;
+    int fd = open(E.buf->filename, O_RDWR | O_CREAT, 0644);
+    if (fd != -1) {
+      if (ftruncate(fd, 0) != -1)
+        len = editorWriteGzip(fd);
+      else
+        close(fd);
+    }
+    if (len == -1) {
+      editorSetStatusMessage("Can't save! I/O error: %s", strerror(errno));
+      return;
+    }
+    struct stat st;
+    stat(E.buf->filename, &st);
+    E.buf->dirty = 0;
+    editorRememberFileIdentity(E.buf);
+    editorSetStatusMessage("%zd bytes written to disk, %lld compressed", len,
+                           static_cast<long long>(st.st_size));
+    return;
+  }
+
+  size_t len;
+  char *buf = editorRowsToString(&len);
+
+  int fd = open(E.buf->filename, O_RDWR | O_CREAT, 0644);
+  if (fd != -1) {
+    if (ftruncate(fd, len) != -1) {
+      // A single write() stops short of the whole buffer past 2 GiB.
+      size_t written = 0;
+      ssize_t n = 0;
+      while (written < len &&
+             (n = write(fd, buf + written, len - written)) > 0)
+        written += n;
+      if (written == len) {
+        editorStampSaved(fd, buf, len);
+        close(fd);
+        free(buf);
+        E.buf->dirty = 0;
+        editorRememberFileIdentity(E.buf);
+        editorSetStatusMessage("%zu bytes written to disk", len);
+        return;
+      }
+    }
+    close(fd);
+  }
+  free(buf);
+  editorSetStatusMessage("Can't save! I/O error: %s", strerror(errno));
+}
+
+int editorBufferIndex(Buffer *buf) {
+  return std::find(E.buffers.begin(), E.buffers.end(), buf) -
+         E.buffers.begin();
+}
+
+bool editorAnyBufferDirty() {
+  for (Buffer *buf : E.buffers)
+    if (buf->dirty)
+      return true;
+  return false;
+}
+
+// Followed files waiting for more to be written don't count.
+bool editorAnyBufferLoading() {
+  for (Buffer *buf : E.buffers)
+    if (buf->loader && !editorLoadCaughtUp(buf))
+      return true;
+  return false;
+}
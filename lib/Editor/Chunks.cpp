@@ -0,0 +1,538 @@
+#include <Editor.hpp>
+
+#include <stdlib.h>
+#include <string.h>
+
+#include <algorithm>
+#include <atomic>
+#include <vector>
+
+#include <Lexer.hpp>
+#include <Trace.hpp>
+#include <Unicode.hpp>
+
+// A long row is split into chunks of about this many bytes, which is all an
+// edit renders and highlights again. A chunk that grows to twice this is
+// split in turn.
+int const ChunkBytes = 4 * 1024;
+
+// Rendering a chunk lets go of the renderings of the row's chunks further
+// than this from it, so a row keeps only those near where it was last shown.
+int const RenderedChunks = 2;
+
+// Besides the comment states highlighters carry between rows, a chunk can
+// start inside a line comment, which runs on to the end of the row, or inside
+// a string, in one of the highlighter's string states.
+int const InLineComment = 2;
+
+// A piece of a long row: its own text, where it falls in the row, and while
+// it is near the view, its rendering and highlighting. Characters never
+// straddle two chunks.
+struct RowChunk {
+  char *chars;
+  int size;
+  // Where the chunk starts on every axis a ColumnStop has: `cx` and `cxEnd`
+  // are its first byte, `rxEnd` its first screen column and `renderEnd` the
+  // first byte of its rendering.
+  ColumnStop start;
+  // The screen columns and bytes of rendering it takes.
+  int width;
+  int rsize;
+  // Its first column's distance past a tab stop when it was measured, or -1
+  // if it hasn't been; only chunks with tabs need measuring again when that
+  // changes.
+  int phase;
+  bool tabs;
+  // The comment or string state it starts in, as highlighters carry it from
+  // one row or chunk to the next.
+  int openComment;
+  char *render;
+  unsigned char *hl;
+  ColumnStop *stops;
+  int numStops;
+};
+
+// The chunks of a long row, followed by room for `capacity` of them.
+struct RowChunks {
+  int numChunks;
+  int capacity;
+  // Set once the state of every chunk is known.
+  bool highlighted;
+  // Changes with every edit, so joined copies of the text know they're old.
+  uint64_t version;
+
+  RowChunk *Chunks() { return reinterpret_cast<RowChunk *>(this + 1); }
+  RowChunk const *Chunks() const {
+    return reinterpret_cast<RowChunk const *>(this + 1);
+  }
+};
+
+static std::atomic<uint64_t> NextVersion{1};
+
+static RowChunks *editorAllocChunks(int capacity) {
+  auto *chunks = static_cast<RowChunks *>(RowPool.Allocate(
+      sizeof(RowChunks) + sizeof(RowChunk) * capacity, RowArrayMemory));
+  chunks->numChunks = 0;
+  chunks->capacity = capacity;
+  chunks->highlighted = false;
+  chunks->version = NextVersion++;
+  return chunks;
+}
+
+// Makes room for `count` chunks at `at` in `row` and returns the first.
+static RowChunk *editorOpenChunks(Row *row, int at, int count) {
+  RowChunks *rc = row->chunks;
+  if (rc->numChunks + count > rc->capacity) {
+    int capacity = std::max(rc->capacity * 2, rc->numChunks + count);
+    rc = static_cast<RowChunks *>(RowPool.Reallocate(
+        rc, sizeof(RowChunks) + sizeof(RowChunk) * capacity, RowArrayMemory));
+    rc->capacity = capacity;
+    row->chunks = rc;
+  }
+  RowChunk *chunks = rc->Chunks();
+  memmove(&chunks[at + count], &chunks[at],
+          sizeof(RowChunk) * (rc->numChunks - at));
+  rc->numChunks += count;
+  return &chunks[at];
+}
+
+// Fills in `chunk` with a copy of the `len` bytes at `s`, to be measured.
+static void editorFillChunk(RowChunk *chunk, char const *s, int len) {
+  *chunk = RowChunk{};
+  chunk->chars = static_cast<char *>(RowPool.Allocate(len + 1, TextMemory));
+  memcpy(chunk->chars, s, len);
+  chunk->chars[len] = '\0';
+  chunk->size = len;
+  chunk->phase = -1;
+  chunk->openComment = -1;
+}
+
+// How much of the `len` bytes at `s` to put in the next chunk: an even share
+// of however many chunks of ChunkBytes they need, stretched to the end of a
+// character.
+static int editorChunkLength(char const *s, int len) {
+  int chunks = (len + ChunkBytes - 1) / ChunkBytes;
+  int cut = len / chunks;
+  while (cut < len && utf8IsContinuation(s[cut]))
+    ++cut;
+  return cut;
+}
+
+static void editorForgetChunk(RowChunk &chunk) {
+  RowPool.Deallocate(chunk.render);
+  RowPool.Deallocate(chunk.hl);
+  RowPool.Deallocate(chunk.stops);
+  chunk.render = nullptr;
+  chunk.hl = nullptr;
+  chunk.stops = nullptr;
+  chunk.numStops = 0;
+}
+
+// `chunk` as a row of its own, as the highlighters and the column mapping of
+// Row.cpp take it.
+static Row editorChunkAsRow(Row const *row, RowChunk const &chunk) {
+  Row piece{};
+  piece.idx = row->idx;
+  piece.size = chunk.size;
+  piece.chars = chunk.chars;
+  piece.render = chunk.render;
+  piece.rsize = chunk.rsize;
+  piece.hl = chunk.hl;
+  piece.stops = chunk.stops;
+  piece.numStops = chunk.numStops;
+  return piece;
+}
+
+// Renders `chunk` as it is rendered at its place in the row, measuring it.
+static void editorRenderChunk(Row const *row, RowChunk &chunk) {
+  Row piece = editorChunkAsRow(row, chunk);
+  editorRenderRow(&piece, chunk.start.rxEnd);
+  RowPool.Deallocate(chunk.hl);
+  chunk.hl = nullptr;
+  chunk.render = piece.render;
+  chunk.rsize = piece.rsize;
+  chunk.stops = piece.stops;
+  chunk.numStops = piece.numStops;
+  chunk.width = editorRowCxToRx(&piece, chunk.size);
+  chunk.phase = chunk.start.rxEnd % TabSize;
+}
+
+// Measures `chunk` where it now starts, rendering it if it has to and
+// keeping the rendering only if it already had one.
+static void editorMeasureChunk(Row const *row, RowChunk &chunk) {
+  chunk.tabs = memchr(chunk.chars, '\t', chunk.size) != nullptr;
+  if (!chunk.tabs && chunk.render == nullptr &&
+      utf8IsAscii(chunk.chars, chunk.size)) {
+    chunk.width = chunk.size;
+    chunk.rsize = chunk.size;
+    chunk.phase = chunk.start.rxEnd % TabSize;
+    return;
+  }
+  bool keep = chunk.render != nullptr;
+  editorRenderChunk(row, chunk);
+  if (!keep)
+    editorForgetChunk(chunk);
+}
+
+// Works out where each chunk from `first` on starts, measuring those that
+// haven't been and those with tabs that moved off their phase, and the size
+// of the whole row.
+static void editorPlaceChunks(Row *row, int first) {
+  RowChunks *rc = row->chunks;
+  RowChunk *chunks = rc->Chunks();
+  for (int k = first; k < rc->numChunks; ++k) {
+    RowChunk &chunk = chunks[k];
+    if (k == 0) {
+      chunk.start = ColumnStop{0, 0, 0, 0};
+    } else {
+      RowChunk const &prev = chunks[k - 1];
+      int cx = prev.start.cxEnd + prev.size;
+      chunk.start = ColumnStop{cx, cx, prev.start.rxEnd + prev.width,
+                               prev.start.renderEnd + prev.rsize};
+    }
+    if (chunk.phase == -1 ||
+        (chunk.tabs &&
+         chunk.phase != static_cast<int>(chunk.start.rxEnd % TabSize)))
+      editorMeasureChunk(row, chunk);
+  }
+  RowChunk const &last = chunks[rc->numChunks - 1];
+  row->size = last.start.cxEnd + last.size;
+  row->rsize = last.start.renderEnd + last.rsize;
+}
+
+// Puts the `len` bytes at `s` into `row`, which has no text, as chunks.
+static void editorSplitIntoChunks(Row *row, char const *s, int len) {
+  TRACE_SCOPE("editorSplitIntoChunks");
+  row->chunks = editorAllocChunks(len / ChunkBytes + 1);
+  for (int done = 0; done < len;) {
+    int n = editorChunkLength(s + done, len - done);
+    editorFillChunk(editorOpenChunks(row, row->chunks->numChunks, 1),
+                    s + done, n);
+    done += n;
+  }
+  editorPlaceChunks(row, 0);
+}
+
+bool editorChunkText(Row *row, char const *s, int len) {
+  if (len < LongRowBytes)
+    return false;
+  editorSplitIntoChunks(row, s, len);
+  return true;
+}
+
+bool editorChunkRow(Row *row) {
+  if (row->chunks || row->cold || row->size < LongRowBytes)
+    return false;
+  editorSplitIntoChunks(row, row->chars, row->size);
+  RowPool.Deallocate(row->chars);
+  RowPool.Deallocate(row->render);
+  RowPool.Deallocate(row->hl);
+  RowPool.Deallocate(row->stops);
+  row->chars = nullptr;
+  row->render = nullptr;
+  row->hl = nullptr;
+  row->stops = nullptr;
+  row->numStops = 0;
+  return true;
+}
+
+// Edits that rebuild a row whole, like replacing or pasting, leave it in one
+// piece; it goes back into chunks when it is next shown.
+void editorChunkRows(Buffer *buf, int first, int last) {
+  for (int y = std::max(first, 0); y < last && y < buf->numRows; ++y) {
+    Row *row = &buf->row[y];
+    if (editorChunkRow(row))
+      editorUpdateSyntax(buf, row);
+  }
+}
+
+void editorDropChunks(Row *row) {
+  RowChunks *rc = row->chunks;
+  if (rc == nullptr)
+    return;
+  for (int k = 0; k < rc->numChunks; ++k) {
+    RowPool.Deallocate(rc->Chunks()[k].chars);
+    editorForgetChunk(rc->Chunks()[k]);
+  }
+  RowPool.Deallocate(rc);
+  row->chunks = nullptr;
+}
+
+// Lets go of the renderings of every chunk of `row`, to be made again from
+// their text and comment states when next shown.
+void editorForgetChunks(Row *row) {
+  RowChunks *rc = row->chunks;
+  for (int k = 0; rc && k < rc->numChunks; ++k)
+    editorForgetChunk(rc->Chunks()[k]);
+}
+
+// A row with the chunks of `row`, sharing their text. Where it ends up its
+// comment states may differ, so it is highlighted from scratch.
+Row editorShareChunks(Row const *row) {
+  RowChunks const *rc = row->chunks;
+  Row copy{};
+  copy.size = row->size;
+  copy.rsize = row->rsize;
+  copy.hl_open_comment = row->hl_open_comment;
+  copy.chunks = editorAllocChunks(rc->numChunks);
+  copy.chunks->numChunks = rc->numChunks;
+  for (int k = 0; k < rc->numChunks; ++k) {
+    RowChunk &chunk = copy.chunks->Chunks()[k];
+    chunk = rc->Chunks()[k];
+    RowPool.Share(chunk.chars);
+    chunk.render = nullptr;
+    chunk.hl = nullptr;
+    chunk.stops = nullptr;
+    chunk.numStops = 0;
+  }
+  return copy;
+}
+
+void editorCopyChunks(Row const *row, char *out) {
+  RowChunks const *rc = row->chunks;
+  for (int k = 0; k < rc->numChunks; ++k) {
+    RowChunk const &chunk = rc->Chunks()[k];
+    memcpy(out + chunk.start.cxEnd, chunk.chars, chunk.size);
+  }
+}
+
+char const *editorChunksText(Row const *row, ColdCache &cache) {
+  if (cache.joined != row->chunks ||
+      cache.joinedVersion != row->chunks->version) {
+    TRACE_SCOPE("editorJoinChunks");
+    cache.joinedText.resize(row->size);
+    editorCopyChunks(row, cache.joinedText.data());
+    cache.joined = row->chunks;
+    cache.joinedVersion = row->chunks->version;
+  }
+  return cache.joinedText.data();
+}
+
+int editorChunkCount(Row const *row) {
+  return row->chunks ? row->chunks->numChunks : 0;
+}
+
+// The last chunk of `row` that starts at or before `value` on `axis`.
+int editorChunkAt(Row const *row, int ColumnStop::*axis, int value) {
+  RowChunk const *chunks = row->chunks->Chunks();
+  int lo = 1;
+  int hi = row->chunks->numChunks;
+  while (lo < hi) {
+    int mid = lo + (hi - lo) / 2;
+    if (chunks[mid].start.*axis <= value)
+      lo = mid + 1;
+    else
+      hi = mid;
+  }
+  return lo - 1;
+}
+
+// Highlights rendered `chunk` of `row` from the state it starts in, returning
+// the state it ends in.
+static int editorHighlightChunk(Buffer *buf, Row const *row,
+                                RowChunk &chunk) {
+  chunk.hl = static_cast<unsigned char *>(
+      RowPool.Reallocate(chunk.hl, chunk.rsize, HighlightMemory));
+  if (buf->syntax == nullptr ||
+      (buf->highlightFrom != -1 && row->idx >= buf->highlightFrom)) {
+    memset(chunk.hl, Highlight::Normal, chunk.rsize);
+    return 0;
+  }
+  if (chunk.openComment == InLineComment) {
+    memset(chunk.hl, Highlight::Comment, chunk.rsize);
+    return InLineComment;
+  }
+  Row piece = editorChunkAsRow(row, chunk);
+  int state = buf->syntax->highlight(buf->syntax, &piece,
+                                     std::max(chunk.openComment, 0));
+  if (chunk.rsize > 0 && chunk.hl[chunk.rsize - 1] == Highlight::Comment)
+    return InLineComment;
+  return chunk.rsize > 0 ? state : std::max(chunk.openComment, 0);
+}
+
+// Renders chunk `k` of `row` if it isn't, letting go of the renderings of
+// the chunks far from it.
+static void editorShowChunk(Row *row, int k) {
+  RowChunks *rc = row->chunks;
+  if (rc->Chunks()[k].render)
+    return;
+  for (int j = 0; j < rc->numChunks; ++j)
+    if (abs(j - k) > RenderedChunks && rc->Chunks()[j].render)
+      editorForgetChunk(rc->Chunks()[j]);
+  editorRenderChunk(row, rc->Chunks()[k]);
+}
+
+ColumnStop editorChunkPiece(Buffer *buf, Row *row, int k, Row *piece) {
+  RowChunk &chunk = row->chunks->Chunks()[k];
+  editorShowChunk(row, k);
+  if (chunk.hl == nullptr)
+    editorHighlightChunk(buf, row, chunk);
+  *piece = editorChunkAsRow(row, chunk);
+  return chunk.start;
+}
+
+// Highlights the chunks of `row` from `first` on for as long as the comment
+// or string state they start in keeps changing, like rows do, or all of them if their
+// states aren't known yet. Chunks that aren't rendered are rendered just for
+// this. Returns whether the state the row ends in changed.
+bool editorHighlightChunks(Buffer *buf, Row *row, int first) {
+  TRACE_SCOPE("editorHighlightChunks");
+  RowChunks *rc = row->chunks;
+  RowChunk *chunks = rc->Chunks();
+  if (buf->syntax == nullptr ||
+      (buf->highlightFrom != -1 && row->idx >= buf->highlightFrom)) {
+    for (int k = 0; k < rc->numChunks; ++k)
+      if (chunks[k].hl)
+        memset(chunks[k].hl, Highlight::Normal, chunks[k].rsize);
+    return false;
+  }
+
+  if (!rc->highlighted || first == 0) {
+    first = 0;
+    chunks[0].openComment =
+        row->idx > 0 && buf->row[row->idx - 1].hl_open_comment;
+  }
+  int state = chunks[first].openComment;
+  for (int k = first; k < rc->numChunks; ++k) {
+    RowChunk &chunk = chunks[k];
+    if (k > first) {
+      if (rc->highlighted && chunk.openComment == state)
+        return false;
+      chunk.openComment = state;
+    }
+    bool rendered = chunk.render != nullptr;
+    if (!rendered)
+      editorRenderChunk(row, chunk);
+    state = editorHighlightChunk(buf, row, chunk);
+    if (!rendered)
+      editorForgetChunk(chunk);
+  }
+  rc->highlighted = true;
+  // Line comments and strings end with the row.
+  state = state == Lexer::InBlockComment;
+  bool changed = row->hl_open_comment != state;
+  row->hl_open_comment = state;
+  return changed;
+}
+
+// Finishes an edit of the text of chunks `first` through `last` of `row`:
+// they are measured and rendered again, the chunks after them move along,
+// and highlighting picks up from `first`, all as editorUpdateRow would for a
+// row in one piece.
+static void editorChunksEdited(Buffer *buf, Row *row, int first, int last) {
+  RowChunk *chunks = row->chunks->Chunks();
+  for (int k = first; k <= last; ++k) {
+    editorForgetChunk(chunks[k]);
+    chunks[k].phase = -1;
+  }
+  editorPlaceChunks(row, first);
+  row->chunks->version = NextVersion++;
+  // The chunk edited is the one in view.
+  editorShowChunk(row, first);
+  if (editorHighlightChunks(buf, row, first))
+    editorCascadeSyntax(buf, row->idx);
+  buf->lineIndex.Set(row->idx, row->size + 1);
+}
+
+// Splits chunk `k` of `row`, which grew too long, into pieces of about
+// ChunkBytes. Returns the index of the last.
+static int editorSplitChunk(Row *row, int k) {
+  RowChunk old = row->chunks->Chunks()[k];
+  std::vector<int> lengths;
+  for (int done = 0; done < old.size; done += lengths.back())
+    lengths.push_back(editorChunkLength(old.chars + done, old.size - done));
+
+  RowChunk *pieces = editorOpenChunks(row, k + 1, lengths.size() - 1) - 1;
+  int done = 0;
+  for (size_t j = 0; j < lengths.size(); ++j) {
+    editorFillChunk(&pieces[j], old.chars + done, lengths[j]);
+    done += lengths[j];
+  }
+  pieces[0].openComment = old.openComment;
+  RowPool.Deallocate(old.chars);
+  editorForgetChunk(old);
+  return k + lengths.size() - 1;
+}
+
+void editorChunkInsert(Buffer *buf, Row *row, int at, char const *s,
+                       int len) {
+  TRACE_SCOPE("editorChunkInsert");
+  int k = editorChunkAt(row, &ColumnStop::cxEnd, at);
+  RowChunk &chunk = row->chunks->Chunks()[k];
+  int offset = at - chunk.start.cxEnd;
+  chunk.chars = static_cast<char *>(
+      RowPool.Reallocate(chunk.chars, chunk.size + len + 1, TextMemory));
+  memmove(&chunk.chars[offset + len], &chunk.chars[offset],
+          chunk.size - offset + 1);
+  memcpy(&chunk.chars[offset], s, len);
+  chunk.size += len;
+
+  int last = chunk.size >= 2 * ChunkBytes ? editorSplitChunk(row, k) : k;
+  editorChunksEdited(buf, row, k, last);
+}
+
+// The bytes deleted must all be in one chunk, as those of a character are.
+void editorChunkDelete(Buffer *buf, Row *row, int at, int len) {
+  TRACE_SCOPE("editorChunkDelete");
+  RowChunks *rc = row->chunks;
+  int k = editorChunkAt(row, &ColumnStop::cxEnd, at);
+  RowChunk &chunk = rc->Chunks()[k];
+  int offset = at - chunk.start.cxEnd;
+  chunk.chars = static_cast<char *>(RowPool.Unshare(chunk.chars));
+  memmove(&chunk.chars[offset], &chunk.chars[offset + len],
+          chunk.size - offset - len + 1);
+  chunk.size -= len;
+
+  if (chunk.size == 0 && rc->numChunks > 1) {
+    // The chunk after takes over the comment state it started in.
+    int openComment = chunk.openComment;
+    RowPool.Deallocate(chunk.chars);
+    editorForgetChunk(chunk);
+    memmove(&rc->Chunks()[k], &rc->Chunks()[k + 1],
+            sizeof(RowChunk) * (rc->numChunks - k - 1));
+    --rc->numChunks;
+    k = std::min(k, rc->numChunks - 1);
+    if (k > 0 || openComment != -1)
+      rc->Chunks()[k].openComment = openComment;
+  }
+  editorChunksEdited(buf, row, k, k);
+}
+
+int editorRowNextBoundary(Row const *row, int at) {
+  if (row->chunks == nullptr)
+    return utf8NextBoundary(row->chars, row->size, at);
+  if (at >= row->size)
+    return row->size;
+  RowChunk const &chunk =
+      row->chunks->Chunks()[editorChunkAt(row, &ColumnStop::cxEnd, at)];
+  return chunk.start.cxEnd +
+         utf8NextBoundary(chunk.chars, chunk.size, at - chunk.start.cxEnd);
+}
+
+int editorRowPrevBoundary(Row const *row, int at) {
+  if (row->chunks == nullptr)
+    return utf8PrevBoundary(row->chars, at);
+  if (at <= 0)
+    return 0;
+  RowChunk const &chunk =
+      row->chunks->Chunks()[editorChunkAt(row, &ColumnStop::cxEnd, at - 1)];
+  return chunk.start.cxEnd +
+         utf8PrevBoundary(chunk.chars, at - chunk.start.cxEnd);
+}
+
+// `at` moved back to the start of the character it falls in.
+int editorRowCharStart(Row const *row, int at) {
+  char const *chars = row->chars;
+  int base = 0;
+  if (row->chunks) {
+    if (at >= row->size)
+      return row->size;
+    RowChunk const &chunk =
+        row->chunks->Chunks()[editorChunkAt(row, &ColumnStop::cxEnd, at)];
+    chars = chunk.chars;
+    base = chunk.start.cxEnd;
+  }
+  while (at > base && utf8IsContinuation(chars[at - base]))
+    --at;
+  return at;
+}
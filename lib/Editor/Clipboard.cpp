@@ -0,0 +1,316 @@
+#include <Editor.hpp>
+
+#include <errno.h>
+#include <signal.h>
+#include <stdio.h>
+#include <string.h>
+#include <sys/wait.h>
+
+#include <algorithm>
+#include <string>
+#include <vector>
+
+#include <Trace.hpp>
+
+// Pastes of up to this many lines are highlighted straight away. Longer ones
+// are left to the highlighting worker, like a file that was just opened.
+size_t const PasteHighlightRows = 1024;
+
+// Selections are written out through a stdio buffer of this size.
+size_t const WriteChunk = 256 * 1024;
+
+// A clipboard line holding its own copy of `len` bytes at `s`.
+static Row editorClipLine(char const *s, int len) {
+  Row row{};
+  row.size = len;
+  row.chars = static_cast<char *>(RowPool.Allocate(len + 1, TextMemory));
+  memcpy(row.chars, s, len);
+  row.chars[len] = '\0';
+  editorRenderRow(&row);
+  return row;
+}
+
+static void editorClearClipboard() {
+  for (Row &row : E.clipboard)
+    editorFreeRow(&row);
+  E.clipboard.clear();
+}
+
+// Lines of text in the clipboard, not counting the empty one after a final
+// newline.
+static size_t editorClipboardLines() {
+  auto &clip = E.clipboard;
+  return clip.size() > 1 && clip.back().size == 0 ? clip.size() - 1
+                                                  : clip.size();
+}
+
+void editorToggleSelection() {
+  E.view.selecting = !E.view.selecting;
+  E.view.anchor = {E.view.cursorX, E.view.cursorY};
+  if (E.view.selecting)
+    editorSetStatusMessage("Selecting: Ctrl-C copies, Ctrl-X cuts, Ctrl-S "
+                           "writes it out");
+  else
+    editorSetStatusMessage("Selection cancelled");
+}
+
+bool editorSelection(Cursor *from, Cursor *to) {
+  if (!E.view.selecting)
+    return false;
+  // Edits since the selection started may have cut the anchor's row short.
+  Cursor anchor = E.view.anchor;
+  anchor.y = std::min(anchor.y, E.buf->numRows);
+  anchor.x = anchor.y < E.buf->numRows
+                 ? std::min(anchor.x, E.buf->row[anchor.y].size)
+                 : 0;
+  Cursor cursor{E.view.cursorX, E.view.cursorY};
+  *from = std::min(anchor, cursor);
+  *to = std::max(anchor, cursor);
+  return true;
+}
+
+// Fills the clipboard with the text from `from` up to `to`. The lines wholly
+// inside share their rows' storage, so however many there are no text is
+// copied; only the partial lines at either end are.
+static void editorCopyRange(Cursor from, Cursor to) {
+  TRACE_SCOPE("editorCopyRange");
+  editorClearClipboard();
+  Buffer *buf = E.buf;
+  auto &clip = E.clipboard;
+  if (from.y == buf->numRows) {
+    clip.push_back(editorClipLine("", 0));
+    return;
+  }
+
+  Row const *first = &buf->row[from.y];
+  if (from.y == to.y) {
+    clip.push_back(
+        editorClipLine(editorRowText(first) + from.x, to.x - from.x));
+    return;
+  }
+  clip.reserve(to.y - from.y + 1);
+  if (from.x == 0)
+    clip.push_back(editorShareRow(first));
+  else
+    clip.push_back(editorClipLine(editorRowText(first) + from.x,
+                                  first->size - from.x));
+  for (int y = from.y + 1; y < to.y; ++y)
+    clip.push_back(editorShareRow(&buf->row[y]));
+  if (to.y < buf->numRows)
+    clip.push_back(editorClipLine(editorRowText(&buf->row[to.y]), to.x));
+  else
+    clip.push_back(editorClipLine("", 0));
+}
+
+// Deletes the text from `from` up to `to`: what is left of the rows at
+// either end is joined, and the rows between go in one shift.
+static void editorDeleteRange(Cursor from, Cursor to) {
+  TRACE_SCOPE("editorDeleteRange");
+  Buffer *buf = E.buf;
+  if (from == to || from.y == buf->numRows)
+    return;
+  // Nothing is left of whole rows up to the end of the buffer.
+  if (from.x == 0 && to.y == buf->numRows) {
+    editorDelRows(from.y, to.y - from.y);
+    return;
+  }
+
+  Row *row = &buf->row[from.y];
+  editorWarmRow(buf, row);
+  char const *tail = "";
+  int tailSize = 0;
+  if (to.y < buf->numRows) {
+    Row *last = &buf->row[to.y];
+    editorWarmRow(buf, last);
+    tail = &last->chars[to.x];
+    tailSize = last->size - to.x;
+  }
+
+  int size = from.x + tailSize;
+  char *chars = static_cast<char *>(RowPool.Allocate(size + 1, TextMemory));
+  memcpy(chars, row->chars, from.x);
+  memcpy(&chars[from.x], tail, tailSize);
+  chars[size] = '\0';
+  RowPool.Deallocate(row->chars);
+  row->chars = chars;
+  row->size = size;
+
+  editorDelRows(from.y + 1, std::min(to.y, buf->numRows - 1) - from.y);
+  editorUpdateRow(row);
+  editorMarkChanged(buf);
+}
+
+void editorCopy() {
+  Cursor from, to;
+  if (!editorSelection(&from, &to)) {
+    editorSetStatusMessage("Nothing selected; Ctrl-^ starts a selection");
+    return;
+  }
+  editorCopyRange(from, to);
+  E.view.selecting = false;
+  editorSetStatusMessage("Copied %zu lines", editorClipboardLines());
+}
+
+void editorCut() {
+  Cursor from, to;
+  if (!editorSelection(&from, &to)) {
+    editorSetStatusMessage("Nothing selected; Ctrl-^ starts a selection");
+    return;
+  }
+  E.view.selecting = false;
+
+  // The rows wholly inside go to the clipboard as they are, leaving just the
+  // partial rows at either end to copy.
+  int middle = std::max(0, std::min(to.y, E.buf->numRows) - from.y - 1);
+  std::vector<Row> taken(middle);
+  editorDelRows(from.y + 1, middle, taken.data());
+  to.y -= middle;
+  editorCopyRange(from, to);
+  E.clipboard.insert(E.clipboard.begin() + 1, taken.begin(), taken.end());
+  editorDeleteRange(from, to);
+  E.view.cursorX = from.x;
+  E.view.cursorY = from.y;
+  editorSetStatusMessage("Cut %zu lines", editorClipboardLines());
+}
+
+// Pastes the clipboard at the cursor. The cursor's row is split around it,
+// and the lines in between go into the row array in one splice, sharing
+// their storage with the clipboard until either is edited.
+void editorPaste() {
+  TRACE_SCOPE("editorPaste");
+  auto &clip = E.clipboard;
+  if (clip.empty()) {
+    editorSetStatusMessage("Nothing to paste");
+    return;
+  }
+
+  Buffer *buf = E.buf;
+  if (E.view.cursorY == buf->numRows)
+    editorInsertRow(buf->numRows, const_cast<char *>(""), 0);
+  int y = E.view.cursorY;
+  int x = E.view.cursorX;
+  Row *row = &buf->row[y];
+  editorWarmRow(buf, row);
+  if (clip.size() == 1) {
+    editorRowInsertString(row, x, editorRowText(&clip[0]), clip[0].size);
+    E.view.cursorX += clip[0].size;
+    return;
+  }
+
+  std::vector<Row> rows;
+  rows.reserve(clip.size() - 1);
+  for (size_t j = 1; j + 1 < clip.size(); ++j)
+    rows.push_back(editorShareRow(&clip[j]));
+
+  // The last line takes the text after the cursor along with it. Until it
+  // is highlighted below, or by the worker, it is drawn plain.
+  Row const &end = clip.back();
+  Row last{};
+  last.size = end.size + row->size - x;
+  last.chars = static_cast<char *>(RowPool.Allocate(last.size + 1, TextMemory));
+  memcpy(last.chars, editorRowText(&end), end.size);
+  memcpy(&last.chars[end.size], &row->chars[x], row->size - x + 1);
+  editorRenderRow(&last);
+  last.hl = static_cast<unsigned char *>(
+      RowPool.Allocate(last.rsize, HighlightMemory));
+  memset(last.hl, Highlight::Normal, last.rsize);
+  rows.push_back(last);
+
+  int size = x + clip[0].size;
+  char *chars = static_cast<char *>(RowPool.Allocate(size + 1, TextMemory));
+  memcpy(chars, row->chars, x);
+  memcpy(&chars[x], editorRowText(&clip[0]), clip[0].size);
+  chars[size] = '\0';
+  RowPool.Deallocate(row->chars);
+  row->chars = chars;
+  row->size = size;
+  editorRenderRow(row);
+  buf->lineIndex.Set(y, size + 1);
+
+  editorInsertRows(y + 1, rows.data(), rows.size());
+  int lastY = y + rows.size();
+  if (buf->syntax && rows.size() >= PasteHighlightRows &&
+      (buf->highlightFrom == -1 || buf->highlightFrom > y))
+    buf->highlightFrom = y;
+  bool worker = buf->highlightFrom != -1 && buf->highlightFrom <= y;
+  editorUpdateSyntaxRange(buf, y, worker ? y : lastY);
+
+  E.view.cursorY = lastY;
+  E.view.cursorX = end.size;
+}
+
+// Writes the text from `from` up to `to` to a file, or to a shell command if
+// `target` starts with `|`, a row at a time so it is never gathered into one
+// piece. Returns the command's exit status, 0 for a file, or -1 with errno
+// set if the writing failed.
+static int editorWriteRange(Cursor from, Cursor to, char const *target,
+                             uint64_t *written) {
+  TRACE_SCOPE("editorWriteRange");
+  bool pipe = target[0] == '|';
+  FILE *out;
+  if (pipe) {
+    // Anything the command prints would land on top of the editor.
+    std::string command = "exec >/dev/null 2>&1; ";
+    command += target + 1;
+    out = popen(command.c_str(), "w");
+  } else {
+    out = fopen(target, "w");
+  }
+  if (out == nullptr)
+    return -1;
+
+  // A command that exits early must not take the editor with it.
+  struct sigaction ignore{}, saved;
+  ignore.sa_handler = SIG_IGN;
+  sigaction(SIGPIPE, &ignore, &saved);
+
+  std::vector<char> buffer(WriteChunk);
+  setvbuf(out, buffer.data(), _IOFBF, buffer.size());
+  *written = 0;
+  for (int y = from.y; y <= to.y && y < E.buf->numRows && !ferror(out); ++y) {
+    Row const *row = &E.buf->row[y];
+    int start = y == from.y ? from.x : 0;
+    int end = y == to.y ? to.x : row->size;
+    fwrite(editorRowText(row) + start, 1, end - start, out);
+    *written += end - start;
+    if (y < to.y) {
+      fputc('\n', out);
+      ++*written;
+    }
+  }
+
+  int error = ferror(out) ? errno : 0;
+  int status = pipe ? pclose(out) : fclose(out);
+  sigaction(SIGPIPE, &saved, nullptr);
+  if (error == 0 && status == -1)
+    error = errno;
+  if (error != 0) {
+    errno = error;
+    return -1;
+  }
+  return pipe ? WEXITSTATUS(status) : 0;
+}
+
+void editorWriteSelection() {
+  char *target = editorPrompt(
+      const_cast<char *>("Write selection to (file or |command): %s"));
+  if (target == nullptr) {
+    editorSetStatusMessage("Write aborted");
+    return;
+  }
+  Cursor from, to;
+  uint64_t written;
+  int status;
+  if (!editorSelection(&from, &to)) {
+    editorSetStatusMessage("Nothing selected");
+  } else if ((status = editorWriteRange(from, to, target, &written)) == -1) {
+    editorSetStatusMessage("Can't write %s: %s", target, strerror(errno));
+  } else if (status != 0) {
+    editorSetStatusMessage("%s exited with status %d", target + 1, status);
+  } else {
+    E.view.selecting = false;
+    editorSetStatusMessage("%llu bytes written to %s",
+                           static_cast<unsigned long long>(written), target);
+  }
+  free(target);
+}
@@ -0,0 +1,260 @@
+#include <Editor.hpp>
+
+#include <limits.h>
+#include <string.h>
+#include <zlib.h>
+
+#include <algorithm>
+
+#include <Trace.hpp>
+
+// Rows are packed in runs of up to this many, or until the run holds this
+// much text, so unpacking one for a screenful of rows stays cheap.
+int const ColdChunkRows = 1024;
+size_t const ColdChunkBytes = 256 * 1024;
+
+// Rows within this many screens of a buffer's view are left warm, so
+// scrolling nearby never has to unpack anything.
+int const WarmScreens = 2;
+
+// The deflated text of a run of rows, followed by `packedSize` bytes.
+struct ColdChunk {
+  // Rows still pointing into the chunk; it is freed when the last goes.
+  int refs;
+  uLong rawSize;
+  uLong packedSize;
+
+  Bytef *Packed() { return reinterpret_cast<Bytef *>(this + 1); }
+  Bytef const *Packed() const {
+    return reinterpret_cast<Bytef const *>(this + 1);
+  }
+};
+
+// For reads of cold rows from the main thread.
+static ColdCache MainCache;
+
+bool editorOverBudget() {
+  return E.memoryBudget && RowPool.BytesInUse() > E.memoryBudget;
+}
+
+char const *editorRowText(Row const *row, ColdCache &cache) {
+  if (row->chunks)
+    return editorChunksText(row, cache);
+  if (row->cold == nullptr)
+    return row->chars;
+  if (cache.chunk != row->cold) {
+    TRACE_SCOPE("editorUnpackRows");
+    ColdChunk const *chunk = row->cold;
+    cache.text.resize(chunk->rawSize);
+    uLongf size = chunk->rawSize;
+    if (uncompress(reinterpret_cast<Bytef *>(cache.text.data()), &size,
+                   chunk->Packed(), chunk->packedSize) != Z_OK)
+      die("uncompress");
+    cache.chunk = chunk;
+  }
+  return cache.text.data() + row->coldOffset;
+}
+
+char const *editorRowText(Row const *row) {
+  return editorRowText(row, MainCache);
+}
+
+void editorDropCold(Row *row) {
+  ColdChunk *chunk = row->cold;
+  if (chunk == nullptr)
+    return;
+  row->cold = nullptr;
+  if (--chunk->refs > 0)
+    return;
+  if (MainCache.chunk == chunk)
+    MainCache.chunk = nullptr;
+  RowPool.Deallocate(chunk);
+}
+
+char *editorTakeRowText(Row *row) {
+  char *chars = row->chars;
+  if (row->chunks) {
+    chars = static_cast<char *>(RowPool.Allocate(row->size + 1, TextMemory));
+    editorCopyChunks(row, chars);
+    chars[row->size] = '\0';
+    editorDropChunks(row);
+  } else if (row->cold) {
+    chars = static_cast<char *>(RowPool.Allocate(row->size + 1, TextMemory));
+    memcpy(chars, editorRowText(row), row->size);
+    chars[row->size] = '\0';
+    editorDropCold(row);
+  }
+  row->chars = nullptr;
+  return chars;
+}
+
+// A row with the text of `row` that shares its storage instead of copying
+// it: the pool blocks of a warm row, the chunk of a cold one, or the pieces
+// of a long one.
+Row editorShareRow(Row const *row) {
+  if (row->chunks)
+    return editorShareChunks(row);
+  Row copy{};
+  copy.size = row->size;
+  copy.hl_open_comment = row->hl_open_comment;
+  if (row->cold) {
+    ++row->cold->refs;
+    copy.cold = row->cold;
+    copy.coldOffset = row->coldOffset;
+    return copy;
+  }
+  RowPool.Share(row->chars);
+  RowPool.Share(row->render);
+  RowPool.Share(row->stops);
+  RowPool.Share(row->hl);
+  copy.chars = row->chars;
+  copy.render = row->render;
+  copy.rsize = row->rsize;
+  copy.hl = row->hl;
+  copy.stops = row->stops;
+  copy.numStops = row->numStops;
+  return copy;
+}
+
+void editorNoteWarm(Buffer *buf, int y) {
+  ColdSweep &sweep = buf->cold;
+  sweep.warmFrom = std::min(sweep.warmFrom, y);
+  sweep.warmTo = std::max(sweep.warmTo, y);
+  if (sweep.next != -1 && y < sweep.next)
+    sweep.next = y;
+}
+
+// Follows a row being inserted (`delta` 1) or deleted (-1) at `at`.
+void editorShiftCold(Buffer *buf, int at, int delta) {
+  ColdSweep &sweep = buf->cold;
+  if (sweep.warmFrom > sweep.warmTo)
+    return;
+  if (at < sweep.warmFrom)
+    sweep.warmFrom += delta;
+  if (at <= sweep.warmTo)
+    sweep.warmTo += delta;
+}
+
+// Gives `row` its text in one piece again, whether packed or in chunks.
+void editorWarmRow(Buffer *buf, Row *row) {
+  if (row->cold == nullptr && row->chunks == nullptr)
+    return;
+  row->chars = editorTakeRowText(row);
+  editorRenderRow(row);
+  editorUpdateSyntax(buf, row);
+  editorNoteWarm(buf, row->idx);
+}
+
+// Unpacks the cold rows from `first` up to `last`. Rows in chunks are left
+// in them, since they are edited and drawn that way.
+void editorWarmRows(Buffer *buf, int first, int last) {
+  for (int y = std::max(first, 0); y < last && y < buf->numRows; ++y)
+    if (buf->row[y].cold)
+      editorWarmRow(buf, &buf->row[y]);
+}
+
+// Packs rows `first` up to `last`, which are all warm, into one chunk.
+static void editorPackRun(Buffer *buf, int first, int last) {
+  TRACE_SCOPE("editorPackRun");
+  static std::string text;
+  static std::vector<Bytef> packed;
+  text.clear();
+  for (int y = first; y < last; ++y)
+    text.append(buf->row[y].chars, buf->row[y].size);
+
+  uLongf packedSize = compressBound(text.size());
+  packed.resize(packedSize);
+  if (compress2(packed.data(), &packedSize,
+                reinterpret_cast<Bytef const *>(text.data()), text.size(),
+                Z_BEST_SPEED) != Z_OK)
+    return;
+
+  auto *chunk = static_cast<ColdChunk *>(
+      RowPool.Allocate(sizeof(ColdChunk) + packedSize, ColdMemory));
+  chunk->refs = last - first;
+  chunk->rawSize = text.size();
+  chunk->packedSize = packedSize;
+  memcpy(chunk->Packed(), packed.data(), packedSize);
+
+  int offset = 0;
+  for (int y = first; y < last; ++y) {
+    Row *row = &buf->row[y];
+    RowPool.Deallocate(row->chars);
+    RowPool.Deallocate(row->render);
+    RowPool.Deallocate(row->hl);
+    RowPool.Deallocate(row->stops);
+    row->chars = nullptr;
+    row->render = nullptr;
+    row->hl = nullptr;
+    row->stops = nullptr;
+    row->rsize = 0;
+    row->numStops = 0;
+    row->cold = chunk;
+    row->coldOffset = offset;
+    offset += row->size;
+  }
+}
+
+// Packs the warm rows from `first` up to `last` that are far enough from the
+// buffer's view, noting the ones it leaves warm in the sweep.
+static void editorPackRows(Buffer *buf, int first, int last) {
+  View const &view = buf == E.buf ? E.view : buf->savedView;
+  int keepFrom = std::min(view.rowOffset - WarmScreens * E.screenRows,
+                          view.cursorY - 1);
+  int keepTo = std::max(view.rowOffset + (WarmScreens + 1) * E.screenRows,
+                        view.cursorY + 1);
+
+  ColdSweep &sweep = buf->cold;
+  int runStart = -1;
+  size_t runBytes = 0;
+  for (int y = first; y <= last; ++y) {
+    Row *row = y < last ? &buf->row[y] : nullptr;
+    bool warm = row && row->cold == nullptr && row->chunks == nullptr;
+    bool packable = warm && (y < keepFrom || y > keepTo);
+    if (warm && !packable) {
+      sweep.keptFrom = std::min(sweep.keptFrom, y);
+      sweep.keptTo = std::max(sweep.keptTo, y);
+    }
+
+    if (runStart != -1 && (!packable || y - runStart == ColdChunkRows ||
+                           runBytes >= ColdChunkBytes)) {
+      editorPackRun(buf, runStart, y);
+      runStart = -1;
+    }
+    if (packable) {
+      if (runStart == -1) {
+        runStart = y;
+        runBytes = 0;
+      }
+      runBytes += row->size;
+    }
+  }
+}
+
+void editorCompactLoaded(Buffer *buf, int first) {
+  if (editorOverBudget())
+    editorPackRows(buf, first, buf->numRows);
+}
+
+bool editorCompactSome(Buffer *buf, int count) {
+  ColdSweep &sweep = buf->cold;
+  if (!editorOverBudget() || sweep.warmFrom > sweep.warmTo)
+    return false;
+
+  if (sweep.next == -1) {
+    sweep.next = sweep.warmFrom;
+    sweep.keptFrom = INT_MAX;
+    sweep.keptTo = -1;
+  }
+  int end = std::min({sweep.next + count, sweep.warmTo + 1, buf->numRows});
+  editorPackRows(buf, sweep.next, end);
+  sweep.next = end;
+
+  if (sweep.next <= sweep.warmTo && sweep.next < buf->numRows)
+    return true;
+  // Everything the sweep passed but kept is all that is left warm.
+  sweep.warmFrom = sweep.keptFrom;
+  sweep.warmTo = sweep.keptTo;
+  sweep.next = -1;
+  return false;
+}
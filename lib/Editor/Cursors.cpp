@@ -0,0 +1,233 @@
+#include <Editor.hpp>
+
+#include <ctype.h>
+#include <string.h>
+
+#include <algorithm>
+#include <vector>
+
+#include <Trace.hpp>
+#include <Unicode.hpp>
+
+// Every cursor, the main one included, in order. The main one ends up at
+// index `*main`.
+static std::vector<Cursor> editorAllCursors(size_t *main) {
+  std::vector<Cursor> all = E.view.cursors;
+  Cursor cursor{E.view.cursorX, E.view.cursorY};
+  auto at = std::lower_bound(all.begin(), all.end(), cursor);
+  *main = at - all.begin();
+  all.insert(at, cursor);
+  return all;
+}
+
+// Takes back the cursors from editorAllCursors after they were moved,
+// merging any that ended up in the same place.
+static void editorKeepCursors(std::vector<Cursor> &all, size_t main) {
+  Cursor cursor = all[main];
+  E.view.cursorX = cursor.x;
+  E.view.cursorY = cursor.y;
+  std::sort(all.begin(), all.end());
+  all.erase(std::unique(all.begin(), all.end()), all.end());
+  all.erase(std::lower_bound(all.begin(), all.end(), cursor));
+  E.view.cursors = std::move(all);
+}
+
+void editorSetCursors(std::vector<Cursor> &&cursors) {
+  std::sort(cursors.begin(), cursors.end());
+  cursors.erase(std::unique(cursors.begin(), cursors.end()), cursors.end());
+  Cursor main{E.view.cursorX, E.view.cursorY};
+  auto at = std::lower_bound(cursors.begin(), cursors.end(), main);
+  if (at != cursors.end() && *at == main)
+    cursors.erase(at);
+  E.view.cursors = std::move(cursors);
+}
+
+void editorClearCursors() { E.view.cursors.clear(); }
+
+// Finishes an edit of the rows in `changed`, given in order: each is
+// rendered once, and each run of adjacent rows is highlighted in one pass.
+static void editorCursorRowsChanged(std::vector<int> const &changed) {
+  if (changed.empty())
+    return;
+  for (int y : changed) {
+    Row *row = &E.buf->row[y];
+    editorRenderRow(row);
+    E.buf->lineIndex.Set(y, row->size + 1);
+    editorNoteWarm(E.buf, y);
+  }
+  size_t first = 0;
+  for (size_t j = 1; j <= changed.size(); ++j) {
+    if (j < changed.size() && changed[j] == changed[j - 1] + 1)
+      continue;
+    editorUpdateSyntaxRange(E.buf, changed[first], changed[j - 1]);
+    first = j;
+  }
+  editorMarkChanged(E.buf);
+}
+
+// The cursors from `all[first]` on that are on the same row.
+static size_t editorRowCursorsEnd(std::vector<Cursor> const &all,
+                                  size_t first) {
+  size_t end = first;
+  while (end < all.size() && all[end].y == all[first].y)
+    ++end;
+  return end;
+}
+
+// Inserts `len` bytes, none of them a newline, at every cursor. Each row is
+// rebuilt in one pass however many cursors it has, so inserting at one
+// cursor never has to shift the others along by hand.
+static void editorInsertAtCursors(char const *s, size_t len) {
+  TRACE_SCOPE("editorInsertAtCursors");
+  size_t main;
+  std::vector<Cursor> all = editorAllCursors(&main);
+  std::vector<int> changed;
+  for (size_t first = 0, end; first < all.size(); first = end) {
+    end = editorRowCursorsEnd(all, first);
+    int y = all[first].y;
+    if (y >= E.buf->numRows)
+      continue;
+
+    Row *row = &E.buf->row[y];
+    editorWarmRow(E.buf, row);
+    int size = row->size + (end - first) * len;
+    char *chars = static_cast<char *>(RowPool.Allocate(size + 1, TextMemory));
+    char *to = chars;
+    int from = 0;
+    for (size_t j = first; j < end; ++j) {
+      int at = std::min(all[j].x, row->size);
+      memcpy(to, &row->chars[from], at - from);
+      to += at - from;
+      memcpy(to, s, len);
+      to += len;
+      from = at;
+      all[j].x = to - chars;
+    }
+    memcpy(to, &row->chars[from], row->size - from + 1);
+    RowPool.Deallocate(row->chars);
+    row->chars = chars;
+    row->size = size;
+    changed.push_back(y);
+  }
+  editorCursorRowsChanged(changed);
+  editorKeepCursors(all, main);
+}
+
+// Deletes the character before every cursor, or after it if `forward`,
+// closing the gaps in each row in one pass. Cursors at the edge of their row
+// delete nothing, since joining rows would move every cursor below.
+static void editorDeleteAtCursors(bool forward) {
+  TRACE_SCOPE("editorDeleteAtCursors");
+  size_t main;
+  std::vector<Cursor> all = editorAllCursors(&main);
+  std::vector<int> changed;
+  for (size_t first = 0, end; first < all.size(); first = end) {
+    end = editorRowCursorsEnd(all, first);
+    int y = all[first].y;
+    if (y >= E.buf->numRows)
+      continue;
+
+    Row *row = &E.buf->row[y];
+    editorWarmRow(E.buf, row);
+    row->chars = static_cast<char *>(RowPool.Unshare(row->chars));
+    char *chars = row->chars;
+    int to = 0;
+    int from = 0;
+    for (size_t j = first; j < end; ++j) {
+      int at = std::min(all[j].x, row->size);
+      int start = at;
+      int stop = at;
+      if (forward && at < row->size)
+        stop = utf8NextBoundary(chars, row->size, at);
+      else if (!forward && at > 0)
+        start = utf8PrevBoundary(chars, at);
+      memmove(&chars[to], &chars[from], start - from);
+      to += start - from;
+      from = stop;
+      all[j].x = to;
+    }
+    if (from == to)
+      continue;
+    memmove(&chars[to], &chars[from], row->size - from + 1);
+    row->size -= from - to;
+    changed.push_back(y);
+  }
+  editorCursorRowsChanged(changed);
+  editorKeepCursors(all, main);
+}
+
+// Moves every cursor as editorMoveCursor would move the main one. A cursor
+// besides the main one stays put rather than leave the last row.
+static void editorMoveCursors(int key) {
+  size_t main;
+  std::vector<Cursor> all = editorAllCursors(&main);
+  for (size_t j = 0; j < all.size(); ++j) {
+    E.view.cursorX = all[j].x;
+    E.view.cursorY = all[j].y;
+    editorMoveCursor(key);
+    if (j == main || E.view.cursorY < E.buf->numRows)
+      all[j] = {E.view.cursorX, E.view.cursorY};
+  }
+  editorKeepCursors(all, main);
+}
+
+// Handles key `c` while there are several cursors. Returns false if it is
+// for the usual handling instead; keys that move rows around, or only the
+// main cursor, first go back to the main cursor alone.
+bool editorMultiCursorKey(int c) {
+  switch (c) {
+  case '\x1b':
+    editorClearCursors();
+    return true;
+  case Key::BackSpace:
+  case addCtrl('h'):
+    editorDeleteAtCursors(false);
+    return true;
+  case Key::Delete:
+    editorDeleteAtCursors(true);
+    return true;
+  case addCtrl('p'):
+  case Key::ArrowUp:
+    editorMoveCursors(Key::ArrowUp);
+    return true;
+  case addCtrl('n'):
+  case Key::ArrowDown:
+    editorMoveCursors(Key::ArrowDown);
+    return true;
+  case addCtrl('b'):
+  case Key::ArrowLeft:
+    editorMoveCursors(Key::ArrowLeft);
+    return true;
+  case addCtrl('f'):
+  case Key::ArrowRight:
+    editorMoveCursors(Key::ArrowRight);
+    return true;
+  case addCtrl('a'):
+  case Key::Home:
+    editorMoveCursors(Key::Home);
+    return true;
+  case addCtrl('e'):
+  case Key::End:
+    editorMoveCursors(Key::End);
+    return true;
+  case '\r':
+  case addCtrl(31):
+  case addCtrl('g'):
+  case addCtrl('r'):
+  case addCtrl('z'):
+  case addCtrl('x'):
+  case addCtrl('v'):
+  case addCtrl('\\'):
+  case Key::PageUp:
+  case Key::PageDown:
+    editorClearCursors();
+    return false;
+  }
+
+  if (c == '\t' || (c >= 128 ? c < 256 : !iscntrl(c))) {
+    char byte = c;
+    editorInsertAtCursors(&byte, 1);
+    return true;
+  }
+  return false;
+}
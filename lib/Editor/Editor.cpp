@@ -0,0 +1,465 @@
+#include <Editor.hpp>
+
+#include <ctype.h>
+#include <errno.h>
+#include <stdlib.h>
+#include <string.h>
+#include <unistd.h>
+
+#include <Trace.hpp>
+
+EditorConfig E;
+Pool RowPool;
+
+// Asks for a line of input on the status bar. Given a `history`, oldest
+// first, Ctrl-P and Ctrl-N step back and forth through it.
+char *editorPrompt(char *prompt, void (*callback)(char *, int),
+                   bool allowEmpty, std::vector<std::string> const *history) {
+  size_t bufsize = 128;
+  char *buf = static_cast<char *>(malloc(bufsize));
+
+  size_t buflen = 0;
+  buf[0] = '\0';
+  size_t recalled = history ? history->size() : 0;
+
+  while (true) {
+    editorSetStatusMessage(prompt, buf);
+    editorRefreshScreen();
+
+    int c = editorReadKey();
+    if (c == Key::Idle)
+      continue;
+    if (c == Key::Delete || c == addCtrl('h') || c == Key::BackSpace) {
+      if (buflen != 0)
+        buf[--buflen] = '\0';
+    } else if (c == '\x1b') {
+      editorSetStatusMessage("");
+      if (callback)
+        callback(buf, c);
+      free(buf);
+      return nullptr;
+    } else if (c == '\r') {
+      if (buflen != 0 || allowEmpty) {
+        editorSetStatusMessage("");
+        if (callback)
+          callback(buf, c);
+        return buf;
+      }
+    } else if (history && (c == addCtrl('p') || c == addCtrl('n'))) {
+      if (c == addCtrl('p') && recalled > 0)
+        --recalled;
+      else if (c == addCtrl('n') && recalled < history->size())
+        ++recalled;
+      std::string const &text =
+          recalled < history->size() ? (*history)[recalled] : "";
+      if (text.size() >= bufsize) {
+        bufsize = text.size() + 1;
+        buf = static_cast<char *>(realloc(buf, bufsize));
+      }
+      memcpy(buf, text.c_str(), text.size() + 1);
+      buflen = text.size();
+    } else if (c >= 128 ? c < 256 : !iscntrl(c)) {
+      if (buflen == bufsize - 1) {
+        bufsize *= 2;
+        buf = static_cast<char *>(realloc(buf, bufsize));
+      }
+      buf[buflen++] = c;
+      buf[buflen] = '\0';
+    }
+    if (callback)
+      callback(buf, c);
+  }
+}
+
+void initEditor() {
+  E.buf = nullptr;
+  E.view = View{};
+  E.screenRows = 24 - 2;
+  E.screenCols = 80;
+  E.statusmsg[0] = '\0';
+  E.statusmsg_time = 0;
+  E.search = SearchState{};
+  E.hud = PerfHud{};
+  E.screen = Screen{};
+  E.memoryBudget = 0;
+  E.gzipLevel = -1;
+  E.follow = false;
+  E.pager = nullptr;
+  E.inputFd = STDIN_FILENO;
+  E.outputFd = STDOUT_FILENO;
+  E.server = nullptr;
+  editorSwitchBuffer(editorNewBuffer(nullptr));
+}
+
+void editorMoveCursor(int key) {
+  Row *row = (E.view.cursorY >= E.buf->numRows) ? nullptr
+                                                 : &E.buf->row[E.view.cursorY];
+  if (row)
+    editorWarmRows(E.buf, E.view.cursorY, E.view.cursorY + 1);
+
+  switch (key) {
+  case Key::End:
+    E.view.cursorX = E.buf->row[E.view.cursorY].size;
+    break;
+  case Key::Home:
+    E.view.cursorX = 0;
+    break;
+  case Key::ArrowLeft:
+    if (E.view.cursorX != 0)
+      E.view.cursorX = editorRowPrevBoundary(row, E.view.cursorX);
+    else if (E.view.cursorY > 0) {
+      --E.view.cursorY;
+      E.view.cursorX = E.buf->row[E.view.cursorY].size;
+    }
+    break;
+  case Key::ArrowRight:
+    if (row && E.view.cursorX < row->size)
+      E.view.cursorX = editorRowNextBoundary(row, E.view.cursorX);
+    else if (row && E.view.cursorX == row->size) {
+      ++E.view.cursorY;
+      E.view.cursorX = 0;
+    }
+    break;
+  case Key::ArrowUp:
+    if (E.view.cursorY != 0)
+      --E.view.cursorY;
+    break;
+  case Key::ArrowDown:
+    if (E.view.cursorY < E.buf->numRows)
+      ++E.view.cursorY;
+    break;
+  }
+
+  editorClampCursor();
+}
+
+// Pulls the cursor back onto its row, and onto a character boundary, after
+// the row it is on changed or it moved to a shorter one.
+void editorClampCursor() {
+  Row *row = (E.view.cursorY >= E.buf->numRows) ? nullptr
+                                                : &E.buf->row[E.view.cursorY];
+  if (row)
+    editorWarmRows(E.buf, E.view.cursorY, E.view.cursorY + 1);
+  int rowLen = row ? row->size : 0;
+  if (E.view.cursorX > rowLen)
+    E.view.cursorX = rowLen;
+  if (row)
+    E.view.cursorX = editorRowCharStart(row, E.view.cursorX);
+}
+
+// Jumps to a target typed at the go-to prompt: a 1-based line number, a byte
+// offset prefixed with `@` (decimal or 0x hex), or a percentage of the file's
+// bytes suffixed with `%`. Offsets resolve through the line index, so every
+// form is O(log n) regardless of file size. Numbers start with a digit, as
+// strtoull and strtod would also skip spaces and take a sign.
+bool editorGoto(char const *target) {
+  char *end;
+  errno = 0;
+  if (target[0] == '@') {
+    if (!isdigit(static_cast<unsigned char>(target[1])))
+      return false;
+    unsigned long long offset = strtoull(&target[1], &end, 0);
+    if (*end != '\0' || errno)
+      return false;
+    if (E.buf->numRows == 0)
+      return true;
+
+    E.view.cursorY = E.buf->lineIndex.LineAt(offset);
+    uint64_t column = offset - E.buf->lineIndex.Offset(E.view.cursorY);
+    Row *row = &E.buf->row[E.view.cursorY];
+    editorWarmRows(E.buf, E.view.cursorY, E.view.cursorY + 1);
+    E.view.cursorX = editorRowCharStart(
+        row, column < static_cast<uint64_t>(row->size) ? column : row->size);
+  } else {
+    if (!isdigit(static_cast<unsigned char>(target[0])))
+      return false;
+    size_t len = strlen(target);
+    if (target[len - 1] == '%') {
+      double percent = strtod(target, &end);
+      if (end != &target[len - 1] || errno)
+        return false;
+      if (percent > 100)
+        percent = 100;
+      uint64_t offset = E.buf->lineIndex.TotalBytes() * percent / 100;
+      E.view.cursorY = E.buf->lineIndex.LineAt(offset);
+    } else {
+      unsigned long long line = strtoull(target, &end, 10);
+      if (*end != '\0' || errno || line == 0)
+        return false;
+      int last = E.buf->numRows > 0 ? E.buf->numRows - 1 : 0;
+      E.view.cursorY =
+          line < static_cast<unsigned long long>(E.buf->numRows)
+              ? static_cast<int>(line) - 1
+              : last;
+    }
+    E.view.cursorX = 0;
+  }
+
+  // Put the target in the middle of the screen rather than at an edge.
+  E.view.rowOffset = E.view.cursorY - E.screenRows / 2;
+  if (E.view.rowOffset < 0)
+    E.view.rowOffset = 0;
+  return true;
+}
+
+void editorGotoPrompt() {
+  char *target = editorPrompt(
+      const_cast<char *>("Go to: %s (line, @offset or N%%)"));
+  if (target == nullptr)
+    return;
+  if (!editorGoto(target))
+    editorSetStatusMessage("Not a line, @offset or percentage: %s", target);
+  free(target);
+}
+
+int const HighlightSlice = 4096;
+int const CompactSlice = 16384;
+// Rows from files still loading are taken for this long before a frame shows
+// how far along they are.
+long const LoadSliceMicros = 50000;
+
+// The shared highlighting worker. Runs between keystrokes, giving the shown
+// buffer priority and then the others, and yields as soon as a key arrives.
+// Rows that loaded files have ready are added first. Once everything is
+// highlighted, it packs rows away while the row pool is over budget, and
+// counts lines for the pager. Returns true if the shown buffer changed and
+// needs redrawing.
+bool editorRunIdleWork() {
+  bool redraw = false;
+  long until = editorMicros() + LoadSliceMicros;
+  while (editorAnyBufferLoading() && !editorInputPending() &&
+         editorMicros() < until)
+    for (Buffer *buf : E.buffers)
+      if (editorLoadSome(buf, false) && buf == E.buf)
+        redraw = true;
+  while (E.buf->highlightFrom != -1 && !editorInputPending()) {
+    editorHighlightSome(E.buf, HighlightSlice);
+    redraw = true;
+  }
+  for (Buffer *buf : E.buffers)
+    while (buf->highlightFrom != -1 && !editorInputPending())
+      editorHighlightSome(buf, HighlightSlice);
+  for (Buffer *buf : E.buffers)
+    while (!editorInputPending() && editorCompactSome(buf, CompactSlice))
+      ;
+  if (E.pager && editorPagerIdle())
+    redraw = true;
+  return redraw;
+}
+
+void editorOpenPrompt() {
+  char *filename = editorPrompt(const_cast<char *>("Open: %s"));
+  if (filename == nullptr)
+    return;
+
+  if (editorOpen(filename) == nullptr) {
+    if (errno == ENOENT) {
+      editorSwitchBuffer(editorNewBuffer(filename));
+      editorSelectSyntaxHighlight();
+      editorSetStatusMessage("New file: %s", filename);
+    } else {
+      editorSetStatusMessage("Can't open %s: %s", filename, strerror(errno));
+    }
+  }
+  free(filename);
+}
+
+void editorNextBuffer() {
+  size_t next = (editorBufferIndex(E.buf) + 1) % E.buffers.size();
+  editorSwitchBuffer(E.buffers[next]);
+  editorSetStatusMessage("Buffer %zu/%zu: %s (%zu KiB in row pool)", next + 1,
+                         E.buffers.size(),
+                         E.buf->filename ? E.buf->filename : "[No Name]",
+                         RowPool.BytesInUse() / 1024);
+}
+
+// Rows added past the end of a file still loading would end up in the middle
+// of it once the rest arrives.
+static bool editorPastLoadedEnd() {
+  if (E.buf->loader == nullptr || E.view.cursorY < E.buf->numRows)
+    return false;
+  if (editorFollowing(E.buf)) {
+    editorSetStatusMessage("Following; the end of the file is still growing");
+    return true;
+  }
+  editorSetStatusMessage("Still loading (%d%%); the end of the file isn't "
+                         "here yet",
+                         editorLoadPercent(E.buf));
+  return true;
+}
+
+void editorProcessKeypress() {
+  TRACE_SCOPE("editorProcessKeypress");
+  static int quitTimes = KiloQuitTimes;
+  static int closeTimes = 1;
+  int c = editorReadKey();
+
+  if (c == Key::Idle)
+    return;
+  if (E.pager) {
+    editorPagerKey(c);
+    return;
+  }
+  if (!E.view.cursors.empty() && editorMultiCursorKey(c)) {
+    quitTimes = KiloQuitTimes;
+    closeTimes = 1;
+    return;
+  }
+
+  switch (c) {
+  case '\r':
+    if (!editorPastLoadedEnd())
+      editorInsertNewLine();
+    break;
+  case addCtrl(31):
+    editorFind();
+    ;
+    break;
+  case Key::BackSpace:
+  case addCtrl('h'):
+  case Key::Delete:
+    if (c == Key::Delete)
+      editorMoveCursor(ArrowRight);
+    editorDelChar();
+    break;
+  case addCtrl('s'):
+    if (E.view.selecting)
+      editorWriteSelection();
+    else
+      editorSave();
+    break;
+  case addCtrl('^'):
+    editorToggleSelection();
+    break;
+  case addCtrl('c'):
+    editorCopy();
+    break;
+  case addCtrl('x'):
+    editorCut();
+    break;
+  case addCtrl('v'):
+    if (!editorPastLoadedEnd())
+      editorPaste();
+    break;
+  case addCtrl('r'):
+    if (E.buf->loader)
+      editorSetStatusMessage("Can't replace until the file has loaded");
+    else
+      editorReplace();
+    break;
+  case addCtrl('\\'):
+    editorFilter();
+    break;
+  case addCtrl('z'):
+    editorUndo();
+    break;
+  case addCtrl('d'):
+    editorAddCursorsAtMatches();
+    break;
+  case addCtrl('g'):
+    editorGotoPrompt();
+    break;
+  case addCtrl('o'):
+    editorOpenPrompt();
+    break;
+  case addCtrl('t'):
+    editorNextBuffer();
+    break;
+  case addCtrl('y'):
+    editorToggleHud();
+    editorSetStatusMessage("Performance HUD %s", E.hud.shown ? "on" : "off");
+    break;
+  case addCtrl('w'):
+    if (E.buf->dirty && closeTimes > 0) {
+      editorSetStatusMessage("WARNING!!! Buffer has unsaved changes. "
+                             "Press Ctrl-W %d more times to close it.",
+                             closeTimes);
+      --closeTimes;
+      return;
+    }
+    editorCloseBuffer(E.buf);
+    editorSetStatusMessage("Buffer closed");
+    break;
+  case addCtrl('e'):
+    editorMoveCursor(Key::End);
+    break;
+  case addCtrl('a'):
+    editorMoveCursor(Key::Home);
+    break;
+  case addCtrl('l'):
+    editorInvalidateScreen();
+    break;
+  case '\x1b':
+    E.view.selecting = false;
+    break;
+  case addCtrl('k'):
+    editorShowMemory();
+    break;
+  case addCtrl('q'):
+    // A client leaves its buffers to the server, saved or not.
+    if (E.server) {
+      editorDetachClient();
+      return;
+    }
+    if (editorAnyBufferDirty() && quitTimes > 0) {
+      editorSetStatusMessage("WARNING!!! File has unsaved changes. "
+                             "Press Ctrl-Q %d more times to quit.",
+                             quitTimes);
+      --quitTimes;
+      return;
+    }
+    for (Buffer *buf : E.buffers) {
+      editorCancelLoad(buf);
+      editorSaveSession(buf);
+    }
+    write(STDOUT_FILENO, ClearScreen, 4);
+    write(STDOUT_FILENO, MoveCursorHome, 3);
+    exit(0);
+    break;
+  case Key::Home:
+    E.view.cursorX = 0;
+    break;
+  case Key::End:
+    if (E.view.cursorY < E.buf->numRows)
+      E.view.cursorX = E.buf->row[E.view.cursorY].size;
+    break;
+  case addCtrl('p'):
+  case Key::ArrowUp:
+    editorMoveCursor(Key::ArrowUp);
+    break;
+  case addCtrl('n'):
+  case Key::ArrowDown:
+    editorMoveCursor(Key::ArrowDown);
+    break;
+  case addCtrl('b'):
+  case Key::ArrowLeft:
+    editorMoveCursor(Key::ArrowLeft);
+    break;
+  case addCtrl('f'):
+  case Key::ArrowRight:
+    editorMoveCursor(Key::ArrowRight);
+    break;
+  case Key::PageUp:
+  case Key::PageDown: {
+    if (c == PageUp)
+      E.view.cursorY = E.view.rowOffset;
+    else if (c == PageDown) {
+      E.view.cursorY = E.view.rowOffset + E.screenRows - 1;
+      if (E.view.cursorY > E.buf->numRows)
+        E.view.cursorY = E.buf->numRows;
+    }
+
+    int times = E.screenRows;
+    while (times--)
+      editorMoveCursor(Key::ArrowUp);
+    if (E.view.cursorY > E.buf->numRows)
+      E.view.cursorY = E.buf->numRows;
+  } break;
+  default:
+    if (!editorPastLoadedEnd())
+      editorInsertChar(c);
+    break;
+  }
+  quitTimes = KiloQuitTimes;
+  closeTimes = 1;
+}
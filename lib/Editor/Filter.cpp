@@ -0,0 +1,412 @@
+#include <Editor.hpp>
+
+#include <errno.h>
+#include <fcntl.h>
+#include <limits.h>
+#include <poll.h>
+#include <signal.h>
+#include <spawn.h>
+#include <string.h>
+#include <sys/uio.h>
+#include <sys/wait.h>
+#include <unistd.h>
+
+#include <algorithm>
+#include <string>
+#include <vector>
+
+#include <Trace.hpp>
+
+extern char **environ;
+
+// The pipes to and from the command are grown to this size where the system
+// allows, so it runs in long stretches rather than a page at a time.
+int const FilterPipeBytes = 1024 * 1024;
+
+// The command's output is read this much at a time.
+size_t const FilterReadBytes = 256 * 1024;
+
+// Rows at least this long are handed to the command with vmsplice, which
+// maps their text into the pipe rather than copying it. Each piece spliced
+// takes a slot of the pipe though, so shorter rows are cheaper copied.
+int const SpliceRowBytes = 16 * 1024;
+
+// How often the progress on the message bar is brought up to date.
+long const FilterTickMicros = 100 * 1000;
+
+// Outputs of up to this many lines are highlighted straight away; longer
+// ones are left to the highlighting worker, like a paste.
+size_t const FilterHighlightRows = 1024;
+
+// What is kept of the command's complaints, to show if it fails.
+size_t const FilterErrorBytes = 256;
+
+static std::vector<std::string> FilterHistory;
+size_t const FilterHistoryLength = 32;
+
+// A command running over rows [first, end) of the shown buffer.
+struct Filter {
+  pid_t pid = -1;
+  int in = -1;
+  int out = -1;
+  int err = -1;
+  // The next row to send, and how much of it, counting its newline, has
+  // been sent already.
+  int y;
+  int offset = 0;
+  int end;
+  // Where cold and chunked rows are unpacked to be copied to the command.
+  ColdCache cache;
+  std::vector<Row> rows;
+  // The start of an output line whose newline has not come yet.
+  std::string partial;
+  std::string errors;
+  uint64_t bytesIn = 0;
+  uint64_t bytesOut = 0;
+};
+
+// Rows whose text stays put until the buffer is next edited: those kept
+// whole in `chars`. Nothing is edited, compacted or put into chunks while a
+// command runs, so their text can be spliced into its pipe.
+static bool editorStableRow(Row const *row) {
+  return row->chars && !row->cold && !row->chunks;
+}
+
+static void editorCloseFd(int *fd) {
+  if (*fd != -1)
+    close(*fd);
+  *fd = -1;
+}
+
+// Starts `command` under the shell, in a process group of its own so the
+// whole pipeline can be stopped. Its end of each pipe is closed in the
+// editor; the editor's ends don't block.
+static bool editorSpawnFilter(Filter &f, char const *command) {
+  int fds[6];
+  for (int j = 0; j < 6; j += 2) {
+    if (pipe(&fds[j]) == -1) {
+      for (int k = 0; k < j; ++k)
+        close(fds[k]);
+      return false;
+    }
+    fcntl(fds[j], F_SETFD, FD_CLOEXEC);
+    fcntl(fds[j + 1], F_SETFD, FD_CLOEXEC);
+  }
+  int *in = &fds[0], *out = &fds[2], *err = &fds[4];
+#ifdef F_SETPIPE_SZ
+  fcntl(in[1], F_SETPIPE_SZ, FilterPipeBytes);
+  fcntl(out[0], F_SETPIPE_SZ, FilterPipeBytes);
+#endif
+
+  posix_spawn_file_actions_t actions;
+  posix_spawn_file_actions_init(&actions);
+  posix_spawn_file_actions_adddup2(&actions, in[0], STDIN_FILENO);
+  posix_spawn_file_actions_adddup2(&actions, out[1], STDOUT_FILENO);
+  posix_spawn_file_actions_adddup2(&actions, err[1], STDERR_FILENO);
+  posix_spawnattr_t attributes;
+  posix_spawnattr_init(&attributes);
+  posix_spawnattr_setpgroup(&attributes, 0);
+  posix_spawnattr_setflags(&attributes, POSIX_SPAWN_SETPGROUP);
+
+  char const *argv[] = {"sh", "-c", command, nullptr};
+  int error = posix_spawn(&f.pid, "/bin/sh", &actions, &attributes,
+                          const_cast<char **>(argv), environ);
+  posix_spawn_file_actions_destroy(&actions);
+  posix_spawnattr_destroy(&attributes);
+  close(in[0]);
+  close(out[1]);
+  close(err[1]);
+  f.in = in[1];
+  f.out = out[0];
+  f.err = err[0];
+  if (error != 0) {
+    editorCloseFd(&f.in);
+    editorCloseFd(&f.out);
+    editorCloseFd(&f.err);
+    errno = error;
+    return false;
+  }
+  for (int fd : {f.in, f.out, f.err})
+    fcntl(fd, F_SETFL, fcntl(fd, F_GETFL) | O_NONBLOCK);
+  return true;
+}
+
+// Sends the command as much of its rows as its pipe takes, each with a
+// newline. Runs of stable rows go in one gathered write and long ones are
+// spliced; others are unpacked and copied. Returns false once the command
+// stops reading.
+static bool editorFeedFilter(Filter &f) {
+  static char Newline = '\n';
+  Buffer *buf = E.buf;
+  while (f.y < f.end) {
+    struct iovec iov[IOV_MAX];
+    int count = 0;
+    bool splice = false;
+    int offset = f.offset;
+    for (int y = f.y; y < f.end && count + 2 <= IOV_MAX; ++y, offset = 0) {
+      Row const *row = &buf->row[y];
+      if (!editorStableRow(row)) {
+        if (count > 0)
+          break;
+        char const *text = editorRowText(row, f.cache);
+        if (offset < row->size)
+          iov[count++] = {const_cast<char *>(text) + offset,
+                          static_cast<size_t>(row->size - offset)};
+        iov[count++] = {&Newline, 1};
+        break;
+      }
+      if (row->size - offset >= SpliceRowBytes) {
+        if (count > 0)
+          break;
+        iov[count++] = {row->chars + offset,
+                        static_cast<size_t>(row->size - offset)};
+        splice = true;
+        break;
+      }
+      if (offset < row->size)
+        iov[count++] = {row->chars + offset,
+                        static_cast<size_t>(row->size - offset)};
+      iov[count++] = {&Newline, 1};
+    }
+
+    size_t wanted = 0;
+    for (int j = 0; j < count; ++j)
+      wanted += iov[j].iov_len;
+    ssize_t sent = -1;
+#ifdef SPLICE_F_NONBLOCK
+    if (splice)
+      sent = vmsplice(f.in, iov, count, SPLICE_F_NONBLOCK);
+    if (sent == -1 && (!splice || errno == EINVAL || errno == ENOSYS))
+#endif
+      sent = writev(f.in, iov, count);
+    if (sent == -1)
+      return errno == EAGAIN || errno == EINTR;
+
+    f.bytesIn += sent;
+    for (size_t left = sent; left > 0;) {
+      size_t rowLeft = buf->row[f.y].size + 1 - f.offset;
+      if (left < rowLeft) {
+        f.offset += left;
+        break;
+      }
+      left -= rowLeft;
+      ++f.y;
+      f.offset = 0;
+    }
+    if (static_cast<size_t>(sent) < wanted)
+      return true;
+  }
+  return true;
+}
+
+// Makes rows of the whole lines in `len` bytes of output at `s`, keeping
+// any line left unfinished for the next read.
+static void editorTakeFilterOutput(Filter &f, char const *s, size_t len) {
+  f.bytesOut += len;
+  char const *end = s + len;
+  while (char const *nl =
+             static_cast<char const *>(memchr(s, '\n', end - s))) {
+    if (f.partial.empty()) {
+      f.rows.push_back(editorBuildRow(s, nl - s));
+    } else {
+      f.partial.append(s, nl - s);
+      f.rows.push_back(editorBuildRow(f.partial.data(), f.partial.size()));
+      f.partial.clear();
+    }
+    s = nl + 1;
+  }
+  f.partial.append(s, end - s);
+}
+
+// Redraws just the status and message bars: the rows on screen are left
+// alone so that nothing the command is still reading gets put into chunks.
+static void editorDrawFilterProgress(Filter const &f, char const *command) {
+  editorSetStatusMessage(
+      "Filtering through %s: %llu KB in, %llu KB out (Ctrl-C cancels)",
+      command, static_cast<unsigned long long>(f.bytesIn >> 10),
+      static_cast<unsigned long long>(f.bytesOut >> 10));
+  if (E.server && editorClientBacklogged())
+    return;
+  AppendBuffer ab;
+  auto barsMove = setCursorPosition(E.screenRows + 1, 1);
+  ab.append(barsMove.c_str(), barsMove.size());
+  editorDrawStatusBar(ab);
+  editorDrawMessageBar(ab);
+  editorWriteOutput(ab.buffer, ab.length);
+}
+
+// Stops the command and its pipeline, if it is still going, and waits for
+// it. Returns its wait status.
+static int editorEndFilter(Filter &f, bool kill) {
+  editorCloseFd(&f.in);
+  editorCloseFd(&f.out);
+  editorCloseFd(&f.err);
+  if (kill)
+    ::kill(-f.pid, SIGTERM);
+  int status = 0;
+  while (waitpid(f.pid, &status, 0) == -1 && errno == EINTR)
+    ;
+  return status;
+}
+
+// Runs rows [first, end) through the command and, if it succeeds, puts its
+// output in their place.
+bool editorFilterRows(int first, int end, char const *command,
+                      std::string &error) {
+  TRACE_SCOPE("editorFilterRows");
+  Buffer *buf = E.buf;
+  first = std::max(0, std::min(first, buf->numRows));
+  end = std::max(first, std::min(end, buf->numRows));
+
+  Filter f;
+  f.y = first;
+  f.end = end;
+  if (!editorSpawnFilter(f, command)) {
+    error = strerror(errno);
+    return false;
+  }
+  if (f.y == f.end)
+    editorCloseFd(&f.in);
+
+  // A command that exits early must not take the editor with it.
+  struct sigaction ignore{}, saved;
+  ignore.sa_handler = SIG_IGN;
+  sigaction(SIGPIPE, &ignore, &saved);
+
+  // Without a terminal there is no progress to show nor key to cancel with.
+  bool interactive = isatty(E.outputFd) && isatty(E.inputFd);
+  long nextTick = editorMicros() + FilterTickMicros;
+  std::vector<char> chunk(FilterReadBytes);
+  bool cancelled = false;
+  while (!cancelled && (f.out != -1 || f.err != -1)) {
+    struct pollfd fds[4] = {{f.in, POLLOUT, 0},
+                            {f.out, POLLIN, 0},
+                            {f.err, POLLIN, 0},
+                            {interactive ? E.inputFd : -1, POLLIN, 0}};
+    long wait = interactive ? std::max(0L, nextTick - editorMicros()) : -1;
+    if (poll(fds, 4, wait == -1 ? -1 : wait / 1000 + 1) == -1 &&
+        errno != EINTR)
+      break;
+
+    if (fds[0].revents && !editorFeedFilter(f))
+      editorCloseFd(&f.in);
+    if (f.in != -1 && f.y == f.end)
+      editorCloseFd(&f.in);
+
+    if (fds[1].revents) {
+      ssize_t n = read(f.out, chunk.data(), chunk.size());
+      if (n > 0)
+        editorTakeFilterOutput(f, chunk.data(), n);
+      else if (n == 0 || (errno != EAGAIN && errno != EINTR))
+        editorCloseFd(&f.out);
+    }
+
+    if (fds[2].revents) {
+      char text[4096];
+      ssize_t n = read(f.err, text, sizeof(text));
+      size_t room = FilterErrorBytes - std::min(FilterErrorBytes,
+                                                f.errors.size());
+      if (n > 0)
+        f.errors.append(text, std::min<size_t>(n, room));
+      else if (n == 0 || (errno != EAGAIN && errno != EINTR))
+        editorCloseFd(&f.err);
+    }
+
+    if (fds[3].revents & (POLLHUP | POLLERR)) {
+      cancelled = true;
+    } else if (fds[3].revents) {
+      int c = editorReadKey();
+      cancelled = c == addCtrl('c') || c == '\x1b';
+    }
+
+    if (interactive && editorMicros() >= nextTick) {
+      editorDrawFilterProgress(f, command);
+      nextTick = editorMicros() + FilterTickMicros;
+    }
+  }
+  if (!f.partial.empty())
+    f.rows.push_back(editorBuildRow(f.partial.data(), f.partial.size()));
+
+  int status = editorEndFilter(f, cancelled || f.out != -1);
+  sigaction(SIGPIPE, &saved, nullptr);
+  bool ok = !cancelled && WIFEXITED(status) && WEXITSTATUS(status) == 0;
+  if (!ok) {
+    for (Row &row : f.rows)
+      editorFreeRow(&row);
+    if (cancelled)
+      error = "cancelled";
+    else if (WIFEXITED(status))
+      error = "exited with status " + std::to_string(WEXITSTATUS(status));
+    else
+      error = "killed by signal " + std::to_string(WTERMSIG(status));
+    size_t line = f.errors.find('\n');
+    if (!f.errors.empty() && line != 0)
+      error += ": " + f.errors.substr(0, line);
+    return false;
+  }
+
+  // The rows go in one splice, like a paste, and are highlighted the same.
+  editorDelRows(first, end - first);
+  editorInsertRows(first, f.rows.data(), f.rows.size());
+  int last = std::min<int>(first + f.rows.size(), buf->numRows - 1);
+  if (buf->syntax && f.rows.size() >= FilterHighlightRows &&
+      (buf->highlightFrom == -1 || buf->highlightFrom > first))
+    buf->highlightFrom = first;
+  bool worker = buf->highlightFrom != -1 && buf->highlightFrom <= first;
+  if (first < buf->numRows)
+    editorUpdateSyntaxRange(buf, first, worker ? first : last);
+  return true;
+}
+
+// Runs the selected lines, or the whole buffer without a selection, through
+// a shell command and replaces them with what it prints.
+void editorFilter() {
+  if (E.buf->loader) {
+    editorSetStatusMessage("Can't filter until the file has loaded");
+    return;
+  }
+  char *command = editorPrompt(
+      const_cast<char *>("Filter lines through: %s"), nullptr, false,
+      &FilterHistory);
+  if (command == nullptr) {
+    editorSetStatusMessage("Filter aborted");
+    return;
+  }
+  auto it = std::find(FilterHistory.begin(), FilterHistory.end(), command);
+  if (it != FilterHistory.end())
+    FilterHistory.erase(it);
+  FilterHistory.push_back(command);
+  if (FilterHistory.size() > FilterHistoryLength)
+    FilterHistory.erase(FilterHistory.begin());
+
+  // Under --server another client may have closed the buffer during the
+  // prompt, leaving this one on another that is still loading.
+  Buffer *buf = E.buf;
+  if (buf->loader) {
+    editorSetStatusMessage("Can't filter until the file has loaded");
+    free(command);
+    return;
+  }
+
+  // A selection ending at the start of a line leaves that line out.
+  int first = 0, end = buf->numRows;
+  Cursor from, to;
+  if (editorSelection(&from, &to)) {
+    first = from.y;
+    end = to.x == 0 && to.y > from.y ? to.y : to.y + 1;
+  }
+
+  std::string error;
+  if (!editorFilterRows(first, end, command, error)) {
+    editorSetStatusMessage("%s: %s", command, error.c_str());
+  } else {
+    // The rows under any other cursors may be gone or rearranged.
+    editorClearCursors();
+    E.view.selecting = false;
+    E.view.cursorY = std::min(first, buf->numRows);
+    E.view.cursorX = 0;
+    editorSetStatusMessage("Filtered %d lines through %s", end - first,
+                           command);
+  }
+  free(command);
+}
@@ -0,0 +1,116 @@
+#include <Editor.hpp>
+
+#include <stdio.h>
+#include <sys/resource.h>
+#include <time.h>
+#include <unistd.h>
+
+#include <algorithm>
+
+long editorMicros() {
+  struct timespec now;
+  clock_gettime(CLOCK_MONOTONIC, &now);
+  return now.tv_sec * 1000000L + now.tv_nsec / 1000;
+}
+
+long editorResidentKiB() {
+  long pages = 0;
+  if (FILE *fp = fopen("/proc/self/statm", "r")) {
+    if (fscanf(fp, "%*d %ld", &pages) != 1)
+      pages = 0;
+    fclose(fp);
+  }
+  if (pages)
+    return pages * (sysconf(_SC_PAGESIZE) / 1024);
+
+  // No procfs; the peak is the best getrusage can do.
+  struct rusage usage;
+  getrusage(RUSAGE_SELF, &usage);
+#ifdef __APPLE__
+  return usage.ru_maxrss / 1024;
+#else
+  return usage.ru_maxrss;
+#endif
+}
+
+void editorToggleHud() {
+  bool shown = !E.hud.shown;
+  E.hud = PerfHud{};
+  E.hud.shown = shown;
+  // The HUD takes a line of its own under the status bar.
+  E.screenRows += shown ? -1 : 1;
+}
+
+void editorDrawHud(AppendBuffer &ab) {
+  char hud[160];
+  int len = snprintf(
+      hud, sizeof(hud),
+      "frame %ldus %ldB | highlight %ldus +%d cascade | key to screen %ldus "
+      "| rss %ldKiB",
+      E.hud.frameMicros, E.hud.frameBytes, E.hud.highlightMicros,
+      E.hud.cascadeRows, E.hud.latencyMicros, editorResidentKiB());
+  if (len > E.screenCols)
+    len = E.screenCols;
+
+  ab.append(ReverseVideo, 4);
+  ab.append(hud, len);
+  while (len++ < E.screenCols)
+    ab.append(" ", 1);
+  ab.append(ResetColor, 3);
+  ab.append("\r\n", 2);
+}
+
+// What each category of RowPool memory holds, as reported.
+static char const *const MemoryNames[NumMemory] = {
+    "other", "text", "render", "hl", "stops",
+    "rows",  "cold", "search", "frames",
+};
+
+// `bytes` in at most four characters and a unit, like `512K` or `1.5G`.
+static void editorFormatBytes(char *out, size_t size, size_t bytes) {
+  char const *units = "BKMGT";
+  double value = bytes;
+  while (value >= 1024 && units[1]) {
+    value /= 1024;
+    ++units;
+  }
+  if (*units == 'B' || value >= 10)
+    snprintf(out, size, "%.0f%c", value, *units);
+  else
+    snprintf(out, size, "%.1f%c", value, *units);
+}
+
+void editorShowMemory() {
+  int order[NumMemory];
+  for (int c = 0; c < NumMemory; ++c)
+    order[c] = c;
+  std::sort(order, order + NumMemory, [](int a, int b) {
+    return RowPool.BytesInUse(a) > RowPool.BytesInUse(b);
+  });
+
+  char msg[sizeof(E.statusmsg)];
+  char now[16], peak[16];
+  editorFormatBytes(now, sizeof(now), RowPool.BytesInUse());
+  editorFormatBytes(peak, sizeof(peak), RowPool.PeakBytesInUse());
+  int len = snprintf(msg, sizeof(msg), "%s (peak %s):", now, peak);
+  for (int c : order) {
+    size_t bytes = RowPool.BytesInUse(c);
+    if (bytes == 0 || len >= static_cast<int>(sizeof(msg)))
+      break;
+    editorFormatBytes(now, sizeof(now), bytes);
+    len += snprintf(&msg[len], sizeof(msg) - len, " %s %s", MemoryNames[c],
+                    now);
+  }
+  editorSetStatusMessage("%s", msg);
+}
+
+void editorPrintMemoryStats(FILE *fp) {
+  fprintf(fp, "%-8s %14s %14s\n", "memory", "current", "peak");
+  for (int c = 0; c < NumMemory; ++c)
+    if (RowPool.PeakBytesInUse(c))
+      fprintf(fp, "%-8s %14zu %14zu\n", MemoryNames[c], RowPool.BytesInUse(c),
+              RowPool.PeakBytesInUse(c));
+  fprintf(fp, "%-8s %14zu %14zu\n", "total", RowPool.BytesInUse(),
+          RowPool.PeakBytesInUse());
+  fprintf(fp, "%-8s %14zu\n", "reserved", RowPool.BytesReserved());
+}
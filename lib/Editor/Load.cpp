@@ -0,0 +1,589 @@
+#include <Editor.hpp>
+
+#include <errno.h>
+#include <fcntl.h>
+#include <libgen.h>
+#include <limits.h>
+#include <poll.h>
+#include <string.h>
+#include <sys/eventfd.h>
+#include <sys/inotify.h>
+#include <sys/stat.h>
+#include <unistd.h>
+#include <zlib.h>
+
+#include <algorithm>
+#include <atomic>
+#include <chrono>
+#include <condition_variable>
+#include <deque>
+#include <mutex>
+#include <string>
+#include <thread>
+#include <vector>
+
+#include <Trace.hpp>
+
+// Files are read, and gzip files inflated, this much at a time.
+size_t const LoadChunk = 256 * 1024;
+
+// Rows are handed to the main thread in batches of up to this many rows or
+// bytes of text. The loader gets at most this many batches ahead, which
+// bounds the rows held outside any buffer, and so outside the memory budget's
+// reach, while the main thread is busy.
+size_t const LoadBatchRows = 4096;
+size_t const LoadBatchBytes = 1024 * 1024;
+size_t const LoadQueueBatches = 4;
+
+// How long the idle worker waits on a loader with nothing ready before it
+// looks for keys again.
+auto const LoadPollTime = std::chrono::milliseconds(5);
+
+// A followed file is checked this often for being replaced even without an
+// inotify event, which some filesystems never send, in milliseconds.
+int const FollowCheckTime = 1000;
+
+// A file being read on a thread of its own. The thread builds whole rows,
+// rendered and plainly highlighted, and queues them; the main thread appends
+// them to the end of the buffer between keys. A followed file is never done:
+// at its end the thread waits for it to grow and reads on from there.
+struct Loader {
+  std::thread thread;
+  std::mutex lock;
+  // Signalled when a batch is queued or the loader finishes.
+  std::condition_variable ready;
+  // Signalled when batches are taken or the load is cancelled.
+  std::condition_variable space;
+  std::deque<std::vector<Row>> batches;
+  bool done = false;
+  bool cancelled = false;
+  // Why the file stopped short, if it did. Set before `done`.
+  std::string error;
+  // Truncation or replacement of a followed file, to show once.
+  std::string notice;
+
+  // Following: `path` is reopened when it is replaced, and `wake` is
+  // signalled on cancelling so the wait for the file to grow ends.
+  bool follow = false;
+  std::string path;
+  int wake = -1;
+  // Set while a followed file has been read to its end and every row
+  // queued, so the main thread can stop polling for more.
+  std::atomic<bool> caughtUp{false};
+
+  // For the progress shown on the status bar.
+  std::atomic<uint64_t> bytesRead{0};
+  uint64_t fileSize = 0;
+  int64_t mtimeNs = 0;
+
+  // Loading with a session cache: lines are cut at the lengths it gives
+  // rather than scanned for, up to the first that doesn't end in a newline.
+  // `hash` is the CRC-32 of everything read, computed only when sessions are
+  // kept, for the main thread to check against the session's once done.
+  Session const *session = nullptr;
+  uint32_t nextLine = 0;
+  bool hashing = false;
+  uLong hash = 0;
+
+  // Only touched by the loader thread. The first batch is a screenful, so
+  // the first frame waits for as little as possible.
+  std::vector<Row> batch;
+  size_t batchBytes = 0;
+  size_t batchRows = LoadBatchRows;
+};
+
+// Hands the rows built so far to the main thread, waiting for room in the
+// queue. Returns false if the load was cancelled instead.
+static bool editorQueueBatch(Loader *loader) {
+  std::unique_lock<std::mutex> guard(loader->lock);
+  loader->space.wait(guard, [loader] {
+    return loader->cancelled || loader->batches.size() < LoadQueueBatches;
+  });
+  if (loader->cancelled)
+    return false;
+  loader->batches.push_back(std::move(loader->batch));
+  loader->batch = std::vector<Row>();
+  loader->batchBytes = 0;
+  loader->batchRows = LoadBatchRows;
+  loader->ready.notify_one();
+  return true;
+}
+
+// Builds a row, outside any buffer, from a line of a file or of a command's
+// output, less any line ending. It is drawn plain until the highlighting
+// worker gets to it.
+Row editorBuildRow(char const *line, size_t len) {
+  while (len > 0 && (line[len - 1] == '\n' || line[len - 1] == '\r'))
+    --len;
+
+  Row row{};
+  if (!editorChunkText(&row, line, len)) {
+    row.size = len;
+    row.chars = static_cast<char *>(RowPool.Allocate(len + 1, TextMemory));
+    memcpy(row.chars, line, len);
+    row.chars[len] = '\0';
+    editorRenderRow(&row);
+    row.hl = static_cast<unsigned char *>(
+        RowPool.Allocate(row.rsize, HighlightMemory));
+    memset(row.hl, Highlight::Normal, row.rsize);
+  }
+  return row;
+}
+
+// Builds a row from a line of the file. Returns false if the load was
+// cancelled.
+static bool editorLoadLine(Loader *loader, char const *line, size_t len) {
+  Row row = editorBuildRow(line, len);
+  loader->batch.push_back(row);
+  loader->batchBytes += row.size;
+  if (loader->batch.size() < loader->batchRows &&
+      loader->batchBytes < LoadBatchBytes)
+    return true;
+  return editorQueueBatch(loader);
+}
+
+// Splits the text from `p` to `end` into lines. The line it ends in is kept
+// in `partial` until the rest of it arrives.
+static bool editorLoadText(Loader *loader, char const *p, char const *end,
+                           std::string &partial) {
+  while (char const *newline =
+             static_cast<char const *>(memchr(p, '\n', end - p))) {
+    bool going;
+    if (partial.empty()) {
+      going = editorLoadLine(loader, p, newline - p);
+    } else {
+      partial.append(p, newline - p);
+      going = editorLoadLine(loader, partial.data(), partial.size());
+      partial.clear();
+    }
+    if (!going)
+      return false;
+    p = newline + 1;
+  }
+  partial.append(p, end - p);
+  return true;
+}
+
+// Like editorLoadText, but cuts lines at the lengths the loader's session
+// gives, checking only that each is followed by a newline. From the first
+// that isn't, lines are scanned for again.
+static bool editorLoadKnownText(Loader *loader, char const *p,
+                                char const *end, std::string &partial) {
+  Session const *session = loader->session;
+  uint32_t rows = session ? editorSessionRows(session) : 0;
+  while (loader->nextLine < rows) {
+    size_t length = editorSessionLength(session, loader->nextLine);
+    if (partial.size() + (end - p) <= length) {
+      partial.append(p, end - p);
+      return true;
+    }
+    char const *newline = p + (length - partial.size());
+    if (*newline != '\n') {
+      loader->session = nullptr;
+      break;
+    }
+    bool going;
+    if (partial.empty()) {
+      going = editorLoadLine(loader, p, length);
+    } else {
+      partial.append(p, newline - p);
+      going = editorLoadLine(loader, partial.data(), partial.size());
+      partial.clear();
+    }
+    if (!going)
+      return false;
+    p = newline + 1;
+    ++loader->nextLine;
+  }
+  return editorLoadText(loader, p, end, partial);
+}
+
+// Reads `fd` to its end. The line it ends in is left in `partial`.
+static bool editorReadToEnd(Loader *loader, int fd, std::string &partial) {
+  std::vector<char> in(LoadChunk);
+  while (true) {
+    ssize_t n = read(fd, in.data(), in.size());
+    if (n < 0 && errno == EINTR)
+      continue;
+    if (n < 0) {
+      loader->error = strerror(errno);
+      return true;
+    }
+    if (n == 0)
+      return true;
+    loader->bytesRead += n;
+    if (loader->hashing)
+      loader->hash = crc32(loader->hash, reinterpret_cast<Bytef *>(in.data()),
+                           n);
+    if (!editorLoadKnownText(loader, in.data(), in.data() + n, partial))
+      return false;
+  }
+}
+
+static bool editorReadPlain(Loader *loader, int fd) {
+  std::string partial;
+  return editorReadToEnd(loader, fd, partial) &&
+         (partial.empty() ||
+          editorLoadLine(loader, partial.data(), partial.size()));
+}
+
+static void editorSetNotice(Loader *loader, char const *notice) {
+  std::lock_guard<std::mutex> guard(loader->lock);
+  loader->notice = notice;
+}
+
+// Watches the followed file, and its directory for a new file taking its
+// name. Returns the file's watch.
+static int editorWatchFollowed(Loader *loader, int in) {
+  std::string dir = loader->path;
+  inotify_add_watch(in, dirname(dir.data()), IN_CREATE | IN_MOVED_TO);
+  return inotify_add_watch(in, loader->path.c_str(),
+                           IN_MODIFY | IN_ATTRIB | IN_MOVE_SELF |
+                               IN_DELETE_SELF);
+}
+
+// Waits for an inotify event, the next periodic check, or cancelling.
+// Returns false if cancelled.
+static bool editorWaitForGrowth(Loader *loader, int in) {
+  struct pollfd fds[2] = {{in, POLLIN, 0}, {loader->wake, POLLIN, 0}};
+  while (poll(fds, 2, FollowCheckTime) == -1 && errno == EINTR)
+    ;
+  if (fds[1].revents)
+    return false;
+  // Only whether anything happened matters, not what.
+  char events[4096];
+  if (fds[0].revents)
+    while (read(in, events, sizeof(events)) > 0)
+      ;
+  return true;
+}
+
+// Reads what is appended to the followed file `fd` as it grows, reopening
+// its path when the file is replaced and starting over when it is
+// truncated. Only ever reads on from where it left off. Returns when
+// cancelled, or with the loader's error set.
+static void editorFollow(Loader *loader, int &fd) {
+  int in = inotify_init1(IN_NONBLOCK | IN_CLOEXEC);
+  if (in == -1) {
+    loader->error = strerror(errno);
+    return;
+  }
+  editorWatchFollowed(loader, in);
+
+  std::string partial;
+  while (true) {
+    if (!editorReadToEnd(loader, fd, partial) || !loader->error.empty())
+      break;
+    // Show what there is so far, save an unfinished last line.
+    if (!loader->batch.empty() && !editorQueueBatch(loader))
+      break;
+    {
+      std::lock_guard<std::mutex> guard(loader->lock);
+      loader->caughtUp = true;
+      loader->ready.notify_one();
+    }
+    if (!editorWaitForGrowth(loader, in))
+      break;
+    loader->caughtUp = false;
+
+    struct stat now, named;
+    if (fstat(fd, &now) == 0 && now.st_size < lseek(fd, 0, SEEK_CUR)) {
+      lseek(fd, 0, SEEK_SET);
+      editorSetNotice(loader, "file truncated; following it from the top");
+    } else if (stat(loader->path.c_str(), &named) == 0 &&
+               (named.st_dev != now.st_dev || named.st_ino != now.st_ino)) {
+      // Whatever was written to the old file before it was replaced comes
+      // first.
+      if (!editorReadToEnd(loader, fd, partial))
+        break;
+      int next = open(loader->path.c_str(), O_RDONLY | O_CLOEXEC);
+      if (next == -1)
+        continue;
+      close(fd);
+      fd = next;
+      editorWatchFollowed(loader, in);
+      editorSetNotice(loader, "file replaced; following the new one");
+    } else {
+      continue;
+    }
+    // The old file's unfinished last line is all of it there will be.
+    if (!partial.empty() &&
+        !editorLoadLine(loader, partial.data(), partial.size()))
+      break;
+    partial.clear();
+  }
+  close(in);
+}
+
+// Inflates the gzip file `fd` a chunk at a time. Concatenated gzip members
+// read as one file. Corrupt or cut short data sets the loader's error, and
+// the lines before it are kept.
+static bool editorReadGzip(Loader *loader, int fd) {
+  z_stream zs{};
+  // 16 asks for a gzip header and trailer rather than a raw zlib stream.
+  if (inflateInit2(&zs, MAX_WBITS + 16) != Z_OK) {
+    loader->error = "out of memory";
+    return true;
+  }
+
+  std::vector<Bytef> in(LoadChunk);
+  std::vector<char> out(LoadChunk);
+  std::string partial;
+  bool memberEnded = false;
+  bool going = true;
+  while (going) {
+    if (zs.avail_in == 0) {
+      ssize_t n = read(fd, in.data(), in.size());
+      if (n < 0 && errno == EINTR)
+        continue;
+      if (n < 0) {
+        loader->error = strerror(errno);
+        break;
+      }
+      if (n == 0) {
+        if (!memberEnded)
+          loader->error = "file is truncated";
+        break;
+      }
+      loader->bytesRead += n;
+      zs.next_in = in.data();
+      zs.avail_in = n;
+    }
+    if (memberEnded) {
+      inflateReset(&zs);
+      memberEnded = false;
+    }
+
+    zs.next_out = reinterpret_cast<Bytef *>(out.data());
+    zs.avail_out = out.size();
+    int status = inflate(&zs, Z_NO_FLUSH);
+    if (status != Z_OK && status != Z_STREAM_END && status != Z_BUF_ERROR) {
+      loader->error = zs.msg ? zs.msg : "corrupt data";
+      break;
+    }
+    memberEnded = status == Z_STREAM_END;
+
+    going = editorLoadText(loader, out.data(),
+                           out.data() + out.size() - zs.avail_out, partial);
+  }
+  inflateEnd(&zs);
+  return going && (partial.empty() || editorLoadLine(loader, partial.data(),
+                                                     partial.size()));
+}
+
+static void editorRunLoader(Loader *loader, int fd, bool gzip) {
+  TRACE_SCOPE("editorRunLoader");
+  bool going = true;
+  if (loader->follow)
+    editorFollow(loader, fd);
+  else
+    going = gzip ? editorReadGzip(loader, fd) : editorReadPlain(loader, fd);
+  close(fd);
+  if (going && !loader->batch.empty())
+    editorQueueBatch(loader);
+
+  std::lock_guard<std::mutex> guard(loader->lock);
+  loader->done = true;
+  loader->ready.notify_one();
+}
+
+void editorStartLoad(Buffer *buf, int fd, bool gzip, bool follow) {
+  struct stat st;
+  auto *loader = new Loader;
+  if (fstat(fd, &st) == 0) {
+    loader->fileSize = st.st_size;
+    loader->mtimeNs = editorMtimeNs(st);
+  }
+  loader->batchRows = std::max(E.screenRows, 1);
+  if (follow && !gzip) {
+    loader->follow = true;
+    loader->path = buf->filename;
+    loader->wake = eventfd(0, EFD_CLOEXEC);
+  } else if (!gzip && !E.sessionDir.empty()) {
+    loader->session = buf->session;
+    loader->hashing = true;
+    loader->hash = crc32(0, nullptr, 0);
+  }
+  buf->loader = loader;
+  loader->thread = std::thread(editorRunLoader, loader, fd, gzip);
+}
+
+// Moves a batch of loaded rows onto the end of `buf`. Highlighting picks
+// them up from the idle worker, and rows away from the view are packed
+// straight away while the row pool is over budget. A view on the last row of
+// a followed file stays on it.
+static void editorAppendRows(Buffer *buf, std::vector<Row> &rows) {
+  TRACE_SCOPE("editorAppendRows");
+  int first = buf->numRows;
+  int last = first + rows.size();
+  if (last > buf->rowCapacity) {
+    while (last > buf->rowCapacity)
+      buf->rowCapacity = buf->rowCapacity ? buf->rowCapacity * 2 : 16;
+    buf->row = static_cast<Row *>(
+        RowPool.Reallocate(buf->row, sizeof(Row) * buf->rowCapacity,
+                           RowArrayMemory));
+  }
+  memcpy(&buf->row[first], rows.data(), sizeof(Row) * rows.size());
+  for (int y = first; y < last; ++y) {
+    buf->row[y].idx = y;
+    buf->lineIndex.Append(buf->row[y].size + 1);
+  }
+  buf->numRows = last;
+
+  View &view = buf == E.buf ? E.view : buf->savedView;
+  if (buf->loader->follow && view.cursorY >= first - 1) {
+    view.cursorY = last - 1;
+    view.cursorX = 0;
+  }
+
+  // Rows whose states a session gave are highlighted as they are shown.
+  int unknown = buf->session ? editorSessionRowsLoaded(buf, first, last)
+                             : first;
+  if (buf->syntax && buf->highlightFrom == -1 && unknown < last)
+    buf->highlightFrom = unknown;
+  editorNoteWarm(buf, first);
+  editorNoteWarm(buf, last - 1);
+  editorCompactLoaded(buf, first);
+}
+
+// Whether any of the first `rows` rows of `buf` holds a newline, as rows cut
+// at the lengths of a session for other contents, or a garbled one, might.
+static bool editorMiscut(Buffer *buf, uint32_t rows) {
+  for (uint32_t y = 0; y < rows && y < uint32_t(buf->numRows); ++y) {
+    Row *row = &buf->row[y];
+    if (memchr(editorRowText(row), '\n', row->size))
+      return true;
+  }
+  return false;
+}
+
+// Reads `buf`'s file again from the start, scanning for its lines. For when
+// it changed without its size or time changing, and its lines were cut
+// wrongly at the lengths of a session that no longer fits it.
+static void editorReload(Buffer *buf) {
+  int fd = open(buf->filename, O_RDONLY | O_CLOEXEC);
+  if (buf->dirty || fd == -1) {
+    if (fd != -1)
+      close(fd);
+    editorSetStatusMessage("%s changed while loading; reopen it",
+                           buf->filename);
+    return;
+  }
+  for (int y = 0; y < buf->numRows; ++y)
+    editorFreeRow(&buf->row[y]);
+  buf->numRows = 0;
+  buf->lineIndex.Clear();
+  buf->highlightFrom = -1;
+  buf->cold = ColdSweep{INT_MAX, -1, -1, INT_MAX, -1};
+  editorFreeUndo(buf);
+  ++buf->version;
+  View &view = buf == E.buf ? E.view : buf->savedView;
+  view = View{};
+  editorStartLoad(buf, fd, false, false);
+}
+
+static void editorFreeLoader(Loader *loader) {
+  if (loader->wake != -1)
+    close(loader->wake);
+  delete loader;
+}
+
+bool editorLoadSome(Buffer *buf, bool wait) {
+  Loader *loader = buf->loader;
+  if (loader == nullptr)
+    return false;
+
+  std::deque<std::vector<Row>> batches;
+  std::string notice;
+  bool done;
+  {
+    std::unique_lock<std::mutex> guard(loader->lock);
+    auto any = [loader] {
+      return loader->done || !loader->batches.empty() || loader->caughtUp;
+    };
+    if (wait)
+      loader->ready.wait(guard, any);
+    else
+      loader->ready.wait_for(guard, LoadPollTime, any);
+    batches.swap(loader->batches);
+    done = loader->done;
+    notice.swap(loader->notice);
+  }
+  loader->space.notify_one();
+  for (auto &rows : batches)
+    editorAppendRows(buf, rows);
+  if (!notice.empty())
+    editorSetStatusMessage("%s: %s", buf->filename, notice.c_str());
+  if (!done)
+    return !batches.empty();
+
+  loader->thread.join();
+  if (!loader->error.empty())
+    editorSetStatusMessage("%s: %s", buf->filename, loader->error.c_str());
+  uint32_t hash = loader->hash;
+  bool stamped = loader->hashing && loader->error.empty();
+  uint32_t cut = loader->nextLine;
+  if (stamped)
+    buf->stamp = FileStamp{true, loader->bytesRead, loader->mtimeNs, hash,
+                           buf->version};
+  editorFreeLoader(loader);
+  buf->loader = nullptr;
+  if (buf->session) {
+    bool fits = editorSessionLoaded(buf, hash);
+    if (!fits && stamped && editorMiscut(buf, cut))
+      editorReload(buf);
+  }
+  return true;
+}
+
+void editorFinishLoad(Buffer *buf) {
+  TRACE_SCOPE("editorFinishLoad");
+  while (buf->loader)
+    editorLoadSome(buf, true);
+}
+
+void editorCancelLoad(Buffer *buf) {
+  Loader *loader = buf->loader;
+  if (loader == nullptr)
+    return;
+  {
+    std::lock_guard<std::mutex> guard(loader->lock);
+    loader->cancelled = true;
+  }
+  loader->space.notify_one();
+  if (loader->wake != -1) {
+    uint64_t one = 1;
+    write(loader->wake, &one, sizeof(one));
+  }
+  loader->thread.join();
+
+  for (auto &rows : loader->batches)
+    for (Row &row : rows)
+      editorFreeRow(&row);
+  for (Row &row : loader->batch)
+    editorFreeRow(&row);
+  editorFreeLoader(loader);
+  buf->loader = nullptr;
+  editorCloseSession(buf->session);
+  buf->session = nullptr;
+}
+
+bool editorFollowing(Buffer const *buf) {
+  return buf->loader && buf->loader->follow;
+}
+
+// Whether `buf` is a followed file with every row so far taken.
+bool editorLoadCaughtUp(Buffer const *buf) {
+  Loader *loader = buf->loader;
+  if (loader == nullptr || !loader->caughtUp)
+    return false;
+  std::lock_guard<std::mutex> guard(loader->lock);
+  return loader->batches.empty();
+}
+
+int editorLoadPercent(Buffer const *buf) {
+  Loader const *loader = buf->loader;
+  if (loader == nullptr || loader->fileSize == 0)
+    return 100;
+  return std::min<uint64_t>(loader->bytesRead * 100 / loader->fileSize, 100);
+}
@@ -0,0 +1,422 @@
+#include <Editor.hpp>
+
+#include <errno.h>
+#include <fcntl.h>
+#include <stdio.h>
+#include <string.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+#include <unistd.h>
+
+#include <algorithm>
+#include <cmath>
+#include <vector>
+
+#include <Lexer.hpp>
+#include <Trace.hpp>
+
+// The line index keeps where every this-many-th line starts, so finding a
+// line never counts more than this many newlines from a known start.
+uint64_t const PagerCheckpointLines = 65536;
+
+// Line numbers are counted this many bytes at a time between keys.
+uint64_t const PagerScanSlice = 32 * 1024 * 1024;
+
+// Only this much of a line is shown; the rest is never rendered.
+int const PagerLineLimit = 1024 * 1024;
+
+// A file paged through read-only, in --view mode. Its text is never copied
+// out of the mapping: the only rows are those of the lines on screen, which
+// point into it, and only they are rendered and highlighted. Lines are found
+// by searching the mapping for newlines from a line already known.
+struct Pager {
+  char const *data = nullptr;
+  uint64_t size = 0;
+
+  // The sparse line index: where lines 0, PagerCheckpointLines,
+  // 2 * PagerCheckpointLines, ... start, as far as the file has been
+  // counted. `scannedTo` is the start of line `scannedLines`, or the end of
+  // the file once it has all been counted.
+  std::vector<uint64_t> checkpoints{0};
+  uint64_t scannedTo = 0;
+  uint64_t scannedLines = 0;
+
+  // Where the first line on screen starts, and its line number if known.
+  // It is unknown after a jump past what has been counted, until the idle
+  // worker counts that far.
+  uint64_t top = 0;
+  uint64_t topLine = 0;
+  bool topLineKnown = true;
+
+  // The rows of the lines on screen and where each starts, kept between
+  // frames so a line is only rendered once however long it stays on
+  // screen. `more` is whether another line follows them.
+  std::vector<Row> rows;
+  std::vector<uint64_t> starts;
+  bool more = false;
+
+  // Lines scrolled since the last frame, so the terminal can shift what it
+  // shows instead of redrawing it. `jumped` when the move wasn't a scroll.
+  int shift = 0;
+  bool jumped = true;
+  int shownColOffset = 0;
+};
+
+// Where the line after the one starting at `start` starts, or the end of
+// the file.
+static uint64_t editorPagerNextLine(Pager const *p, uint64_t start) {
+  auto *newline = static_cast<char const *>(
+      memchr(p->data + start, '\n', p->size - start));
+  return newline ? newline - p->data + 1 : p->size;
+}
+
+// Where the line holding the byte before `offset` starts.
+static uint64_t editorPagerLineBefore(Pager const *p, uint64_t offset) {
+  if (offset <= 1)
+    return 0;
+  auto *newline =
+      static_cast<char const *>(memrchr(p->data, '\n', offset - 1));
+  return newline ? newline - p->data + 1 : 0;
+}
+
+// Where the last line of the file starts.
+static uint64_t editorPagerLastLine(Pager const *p) {
+  uint64_t end = p->size;
+  if (end > 0 && p->data[end - 1] == '\n')
+    --end;
+  return editorPagerLineBefore(p, end + 1);
+}
+
+// Counts lines on from `scannedTo` for about `bytes` bytes, noting the
+// checkpoints it passes. Counted pages are dropped from the process again,
+// so counting a huge file leaves its memory use where it was.
+static void editorPagerScan(Pager *p, uint64_t bytes) {
+  TRACE_SCOPE("editorPagerScan");
+  uint64_t from = p->scannedTo;
+  uint64_t limit = std::min(p->size, from + bytes);
+  uint64_t at = from;
+  while (at < limit) {
+    auto *newline =
+        static_cast<char const *>(memchr(p->data + at, '\n', p->size - at));
+    if (newline == nullptr) {
+      at = p->size;
+      break;
+    }
+    at = newline - p->data + 1;
+    if (++p->scannedLines % PagerCheckpointLines == 0)
+      p->checkpoints.push_back(at);
+  }
+  p->scannedTo = at;
+
+  long page = sysconf(_SC_PAGESIZE);
+  uint64_t first = (from + page - 1) / page * page;
+  uint64_t last = at / page * page;
+  if (first < last)
+    madvise(const_cast<char *>(p->data) + first, last - first, MADV_DONTNEED);
+}
+
+// The line number of the line starting at `start`, which must have been
+// counted past.
+static uint64_t editorPagerLineNumber(Pager const *p, uint64_t start) {
+  size_t k = std::upper_bound(p->checkpoints.begin(), p->checkpoints.end(),
+                              start) -
+             p->checkpoints.begin() - 1;
+  uint64_t line = k * PagerCheckpointLines;
+  for (uint64_t at = p->checkpoints[k]; at < start;
+       at = editorPagerNextLine(p, at))
+    ++line;
+  return line;
+}
+
+// Moves the top of the screen to the line starting at `start`.
+static void editorPagerJump(Pager *p, uint64_t start) {
+  p->top = start;
+  p->topLineKnown = start <= p->scannedTo;
+  if (p->topLineKnown)
+    p->topLine = editorPagerLineNumber(p, start);
+  p->jumped = true;
+}
+
+static void editorPagerScrollUp(Pager *p) {
+  if (p->top == 0)
+    return;
+  p->top = editorPagerLineBefore(p, p->top);
+  --p->topLine;
+  --p->shift;
+}
+
+static void editorPagerScrollDown(Pager *p) {
+  if (!p->more)
+    return;
+  p->top = editorPagerNextLine(p, p->top);
+  ++p->topLine;
+  ++p->shift;
+}
+
+static void editorPagerFreeRow(Row *row) {
+  RowPool.Deallocate(row->render);
+  RowPool.Deallocate(row->hl);
+  RowPool.Deallocate(row->stops);
+}
+
+// A row for the line starting at `start`, pointing into the mapping.
+static Row editorPagerRow(Pager const *p, uint64_t start) {
+  uint64_t end = editorPagerNextLine(p, start);
+  if (end > start && p->data[end - 1] == '\n')
+    --end;
+  if (end > start && p->data[end - 1] == '\r')
+    --end;
+  Row row{};
+  row.size = std::min<uint64_t>(end - start, PagerLineLimit);
+  row.chars = const_cast<char *>(p->data + start);
+  editorRenderRow(&row);
+  return row;
+}
+
+// Brings the rows up to the screenful of lines from the top, keeping the
+// rows of lines that were already on screen, and highlights them. A window
+// that runs out of lines before the bottom of the screen is moved back up.
+static void editorPagerFill(Pager *p) {
+  TRACE_SCOPE("editorPagerFill");
+  std::vector<uint64_t> starts;
+  uint64_t at = p->top;
+  while (true) {
+    for (; starts.size() < static_cast<size_t>(E.screenRows) && at < p->size;
+         at = editorPagerNextLine(p, at))
+      starts.push_back(at);
+    if (starts.size() == static_cast<size_t>(E.screenRows) || p->top == 0)
+      break;
+    editorPagerScrollUp(p);
+    starts.insert(starts.begin(), p->top);
+  }
+  p->more = at < p->size;
+  if (starts == p->starts)
+    return;
+
+  // Both are in order, so the lines still on screen line up in one pass.
+  std::vector<Row> rows(starts.size());
+  size_t old = 0;
+  for (size_t y = 0; y < starts.size(); ++y) {
+    while (old < p->starts.size() && p->starts[old] < starts[y])
+      editorPagerFreeRow(&p->rows[old++]);
+    if (old < p->starts.size() && p->starts[old] == starts[y])
+      rows[y] = p->rows[old++];
+    else
+      rows[y] = editorPagerRow(p, starts[y]);
+  }
+  while (old < p->starts.size())
+    editorPagerFreeRow(&p->rows[old++]);
+  p->rows.swap(rows);
+  p->starts.swap(starts);
+
+  // Whether the top line starts inside a comment isn't known without
+  // highlighting everything above it, so it is taken not to.
+  EditorSyntax const *syntax = E.buf->syntax;
+  int inComment = 0;
+  for (Row &row : p->rows) {
+    row.hl = static_cast<unsigned char *>(
+        RowPool.Reallocate(row.hl, row.rsize, HighlightMemory));
+    if (syntax)
+      inComment =
+          syntax->highlight(syntax, &row, inComment) == Lexer::InBlockComment;
+    else
+      memset(row.hl, Highlight::Normal, row.rsize);
+  }
+}
+
+bool editorStartPager(char const *filename) {
+  int fd = open(filename, O_RDONLY);
+  if (fd == -1)
+    return false;
+  struct stat st;
+  if (fstat(fd, &st) == -1) {
+    close(fd);
+    return false;
+  }
+
+  auto *p = new Pager;
+  p->size = st.st_size;
+  if (p->size > 0) {
+    void *data = mmap(nullptr, p->size, PROT_READ, MAP_PRIVATE, fd, 0);
+    if (data == MAP_FAILED) {
+      int error = errno;
+      close(fd);
+      delete p;
+      errno = error;
+      return false;
+    }
+    p->data = static_cast<char const *>(data);
+  }
+  // The mapping stays valid without the descriptor.
+  close(fd);
+
+  // A buffer with no rows stands for the file, for its name and syntax.
+  Buffer *scratch = E.buf;
+  editorSwitchBuffer(editorNewBuffer(filename));
+  editorCloseBuffer(scratch);
+  editorSelectSyntaxHighlight();
+  E.buf->highlightFrom = -1;
+  E.pager = p;
+  return true;
+}
+
+static void editorDrawPagerLine(AppendBuffer &ab, int y) {
+  Pager *p = E.pager;
+  if (static_cast<size_t>(y) < p->rows.size())
+    editorDrawRowText(ab, &p->rows[y], -1);
+  else
+    ab.append("~", 1);
+}
+
+void editorDrawPagerRows(AppendBuffer &ab) {
+  TRACE_SCOPE("editorDrawPagerRows");
+  Pager *p = E.pager;
+  editorPagerFill(p);
+  bool scrolled = !p->jumped && p->shownColOffset == E.view.colOffset;
+  editorDrawScreenLines(ab, scrolled ? p->shift : 0, editorDrawPagerLine);
+  p->shift = 0;
+  p->jumped = false;
+  p->shownColOffset = E.view.colOffset;
+  E.screen.buf = nullptr;
+}
+
+void editorPagerStatus(char *status, char *rstatus, size_t size) {
+  Pager const *p = E.pager;
+  snprintf(status, size, "%.20s - %.1f MiB (view)", E.buf->filename,
+           p->size / 1048576.0);
+  uint64_t end = p->starts.empty() ? p->size
+                                   : editorPagerNextLine(p, p->starts.back());
+  int percent = p->size ? end * 100 / p->size : 100;
+  char line[24] = "?";
+  if (p->topLineKnown)
+    snprintf(line, sizeof(line), "%llu",
+             static_cast<unsigned long long>(p->topLine + 1));
+  snprintf(rstatus, size, "%s | line %s | %d%%",
+           E.buf->syntax ? E.buf->syntax->filetype : "no ft", line, percent);
+}
+
+bool editorPagerIdle() {
+  Pager *p = E.pager;
+  if (p->topLineKnown)
+    return false;
+  while (p->scannedTo < p->top && !editorInputPending())
+    editorPagerScan(p, PagerScanSlice);
+  if (p->scannedTo < p->top)
+    return false;
+  p->topLine = editorPagerLineNumber(p, p->top);
+  p->topLineKnown = true;
+  return true;
+}
+
+// Jumps to a target typed at the go-to prompt, as editorGoto takes them. A
+// line number counts lines up to it, but only the first time: after that
+// the line index finds it.
+static bool editorPagerGoto(char const *target) {
+  Pager *p = E.pager;
+  char *end;
+  errno = 0;
+  if (target[0] == '@') {
+    unsigned long long offset = strtoull(&target[1], &end, 0);
+    if (end == &target[1] || *end != '\0' || errno)
+      return false;
+    editorPagerJump(p, editorPagerLineBefore(
+                           p, std::min<uint64_t>(offset, p->size) + 1));
+    return true;
+  }
+
+  double value = strtod(target, &end);
+  if (end == target || errno || !std::isfinite(value))
+    return false;
+  if (*end == '%' && end[1] == '\0') {
+    value = std::clamp(value, 0.0, 100.0);
+    uint64_t offset = p->size * value / 100;
+    editorPagerJump(p, editorPagerLineBefore(p, offset + 1));
+  } else if (*end == '\0' && value >= 1) {
+    uint64_t line = value - 1;
+    while (p->scannedLines < line && p->scannedTo < p->size)
+      editorPagerScan(p, PagerScanSlice);
+    if (p->scannedLines < line) {
+      editorPagerJump(p, editorPagerLastLine(p));
+    } else {
+      uint64_t k = line / PagerCheckpointLines;
+      uint64_t at = p->checkpoints[k];
+      for (uint64_t n = k * PagerCheckpointLines; n < line; ++n)
+        at = editorPagerNextLine(p, at);
+      editorPagerJump(p, at);
+    }
+  } else {
+    return false;
+  }
+  return true;
+}
+
+void editorPagerKey(int c) {
+  Pager *p = E.pager;
+  switch (c) {
+  case addCtrl('q'):
+  case 'q':
+    write(STDOUT_FILENO, ClearScreen, 4);
+    write(STDOUT_FILENO, MoveCursorHome, 3);
+    exit(0);
+    break;
+  case addCtrl('p'):
+  case Key::ArrowUp:
+    editorPagerScrollUp(p);
+    break;
+  case addCtrl('n'):
+  case Key::ArrowDown:
+  case '\r':
+    editorPagerScrollDown(p);
+    break;
+  case Key::PageUp:
+    for (int y = 0; y < E.screenRows; ++y)
+      editorPagerScrollUp(p);
+    break;
+  case Key::PageDown:
+  case ' ':
+    // The line below the screen goes to the top; near the end of the file
+    // the next frame moves it back up to a full screen.
+    if (p->more) {
+      p->top = editorPagerNextLine(p, p->starts.back());
+      p->topLine += p->starts.size();
+      p->shift += p->starts.size();
+    }
+    break;
+  case addCtrl('b'):
+  case Key::ArrowLeft:
+    E.view.colOffset = std::max(E.view.colOffset - E.screenCols / 2, 0);
+    break;
+  case addCtrl('f'):
+  case Key::ArrowRight:
+    E.view.colOffset += E.screenCols / 2;
+    break;
+  case Key::Home:
+    editorPagerJump(p, 0);
+    break;
+  case Key::End:
+    editorPagerJump(p, editorPagerLastLine(p));
+    break;
+  case addCtrl('g'): {
+    char *target = editorPrompt(
+        const_cast<char *>("Go to: %s (line, @offset or N%%)"));
+    if (target == nullptr)
+      break;
+    if (!editorPagerGoto(target))
+      editorSetStatusMessage("Not a line, @offset or percentage: %s", target);
+    free(target);
+  } break;
+  case addCtrl('l'):
+    editorInvalidateScreen();
+    break;
+  case addCtrl('y'):
+    editorToggleHud();
+    break;
+  case addCtrl('k'):
+    editorShowMemory();
+    break;
+  default:
+    editorSetStatusMessage("Read-only view: arrows, PageUp/PageDown, Ctrl-G "
+                           "to go to, q to quit");
+    break;
+  }
+}
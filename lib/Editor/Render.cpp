@@ -0,0 +1,394 @@
+#include <Editor.hpp>
+
+#include <ctype.h>
+#include <limits.h>
+#include <stdarg.h>
+#include <stdio.h>
+#include <unistd.h>
+
+#include <algorithm>
+
+#include <Trace.hpp>
+#include <Unicode.hpp>
+
+void editorSetStatusMessage(char const *fmt, ...) {
+  va_list ap;
+  va_start(ap, fmt);
+  vsnprintf(E.statusmsg, sizeof(E.statusmsg), fmt, ap);
+  va_end(ap);
+  E.statusmsg_time = time(nullptr);
+}
+
+// Rows are highlighted in order, so catch the worker up to the bottom of the
+// screen before drawing anything, then unpack any cold rows on it and put
+// long ones back into chunks.
+static void editorHighlightScreen() {
+  if (E.buf->highlightFrom != -1 &&
+      E.buf->highlightFrom < E.view.rowOffset + E.screenRows)
+    editorHighlightSome(E.buf, E.view.rowOffset + E.screenRows -
+                                   E.buf->highlightFrom);
+  editorWarmRows(E.buf, E.view.rowOffset, E.view.rowOffset + E.screenRows);
+  editorChunkRows(E.buf, E.view.rowOffset, E.view.rowOffset + E.screenRows);
+  // Rows whose comment states came from a session are highlighted on their
+  // own, the worker having skipped them.
+  int end = std::min(E.view.rowOffset + E.screenRows, E.buf->numRows);
+  for (int y = E.view.rowOffset; y < end; ++y)
+    if (E.buf->row[y].lazy)
+      editorUpdateSyntax(E.buf, &E.buf->row[y]);
+}
+
+// Draws line `y` of the text area, leaving the rest of the line as it was.
+static void editorDrawRow(AppendBuffer &ab, int y) {
+  int fileRow = y + E.view.rowOffset;
+  if (fileRow >= E.buf->numRows) {
+    if (E.buf->numRows == 0 && y == E.screenRows / 3) {
+      char welcome[80];
+      int welcomeLength = snprintf(welcome, sizeof(welcome),
+                                   "Kilo editor -- version %s", KiloVersion);
+      if (welcomeLength > E.screenCols)
+        welcomeLength = E.screenCols;
+
+      int padding = (E.screenCols - welcomeLength) / 2;
+      if (padding) {
+        ab.append("~", 1);
+        --padding;
+      }
+      while (padding--)
+        ab.append(" ", 1);
+      ab.append(welcome, welcomeLength);
+    } else {
+      ab.append("~", 1);
+    }
+  } else {
+    editorDrawRowText(ab, &E.buf->row[fileRow], fileRow);
+  }
+}
+
+// Draws `row`, line `fileRow` of the shown buffer, from the view's column
+// offset on: its highlighting, and the cursors and selection on it. A row
+// that isn't in the buffer passes -1.
+void editorDrawRowText(AppendBuffer &ab, Row *row, int fileRow) {
+  // The screen columns of the other cursors on this row, in order.
+  std::vector<int> cursorXs;
+  auto &cursors = E.view.cursors;
+  for (auto it = std::lower_bound(cursors.begin(), cursors.end(),
+                                  Cursor{0, fileRow});
+       it != cursors.end() && it->y == fileRow; ++it)
+    cursorXs.push_back(editorRowCxToRx(row, it->x));
+  size_t nextCursor = 0;
+
+  // The screen columns of the selection on this row, to the end of the row
+  // if it takes in the newline.
+  int selectFrom = 0;
+  int selectTo = 0;
+  bool selectNewline = false;
+  Cursor from, to;
+  if (editorSelection(&from, &to) && from.y <= fileRow && fileRow <= to.y) {
+    selectFrom = fileRow == from.y ? editorRowCxToRx(row, from.x) : 0;
+    selectTo = fileRow == to.y ? editorRowCxToRx(row, to.x) : INT_MAX;
+    selectNewline = fileRow < to.y;
+  }
+
+  // A row in chunks is drawn a chunk at a time, starting from the one at the
+  // column offset, and `text` is the one being drawn.
+  Row *text = row;
+  Row piece;
+  int chunk = 0;
+  int base = 0;
+  if (row->chunks) {
+    chunk = editorChunkAt(row, &ColumnStop::rxEnd, E.view.colOffset);
+    base = editorChunkPiece(E.buf, row, chunk, &piece).rxEnd;
+    text = &piece;
+  }
+  int j = editorRowRxToRender(text, E.view.colOffset - base);
+  int renderX = base + editorRowRenderToRx(text, j);
+  int endX = E.view.colOffset + E.screenCols;
+  int current_color = -1;
+  bool reversed = false;
+  while (renderX < endX) {
+    if (j >= text->rsize) {
+      if (++chunk >= editorChunkCount(row))
+        break;
+      editorChunkPiece(E.buf, row, chunk, &piece);
+      j = 0;
+      continue;
+    }
+    char *c = &text->render[j];
+    unsigned char hl = text->hl[j];
+    int len = 1;
+    int width = 1;
+    bool malformed = false;
+    if (*c & 0x80) {
+      uint32_t codepoint;
+      len = utf8Decode(c, text->rsize - j, &codepoint);
+      malformed = len == 1;
+      width = malformed ? 1 : codepointWidth(codepoint);
+    }
+    while (nextCursor < cursorXs.size() && cursorXs[nextCursor] < renderX)
+      ++nextCursor;
+    bool reverse =
+        (nextCursor < cursorXs.size() && cursorXs[nextCursor] == renderX) ||
+        (selectFrom <= renderX && renderX < selectTo);
+    if (reverse != reversed) {
+      if (reverse)
+        ab.append(ReverseVideo, 4);
+      else
+        ab.append(ReverseVideoOff, 5);
+      reversed = reverse;
+    }
+
+    if (renderX < E.view.colOffset || renderX + width > endX) {
+      // A wide character cut in half by an edge of the screen.
+      int from = renderX < E.view.colOffset ? E.view.colOffset : renderX;
+      int to = renderX + width > endX ? endX : renderX + width;
+      for (int k = from; k < to; ++k)
+        ab.append(" ", 1);
+    } else if (malformed || (len == 1 && iscntrl(*c))) {
+      char sym = (!malformed && *c <= 26) ? '@' + *c : '?';
+      ab.append(ReverseVideo, 4);
+      ab.append(&sym, 1);
+      ab.append(ResetColor, 3);
+      reversed = false;
+      if (current_color != -1) {
+        char buf[16];
+        int clen = snprintf(buf, sizeof(buf), ColorFormatString, current_color);
+        ab.append(buf, clen);
+      }
+    } else if (hl == Highlight::Normal) {
+      if (current_color != -1) {
+        ab.append(DefaultForegroundColor, 5);
+        current_color = -1;
+      }
+      ab.append(c, len);
+    } else {
+      int color = editorSyntaxToColor(hl);
+      if (color != current_color) {
+        current_color = color;
+        char buf[16];
+        int clen = snprintf(buf, sizeof(buf), ColorFormatString, color);
+        ab.append(buf, clen);
+      }
+      ab.append(c, len);
+    }
+
+    j += len;
+    renderX += width;
+  }
+  if (reversed)
+    ab.append(ReverseVideoOff, 5);
+  // A cursor past the end of the row, or a selected newline.
+  if (((!cursorXs.empty() && cursorXs.back() == renderX) ||
+       (selectNewline && renderX >= selectFrom)) &&
+      renderX >= E.view.colOffset && renderX < endX) {
+    ab.append(ReverseVideo, 4);
+    ab.append(" ", 1);
+    ab.append(ReverseVideoOff, 5);
+  }
+  ab.append(DefaultForegroundColor, 5);
+}
+
+void editorDrawRows(AppendBuffer &ab) {
+  TRACE_SCOPE("editorDrawRows");
+  editorHighlightScreen();
+  for (int y = 0; y < E.screenRows; ++y) {
+    editorDrawRow(ab, y);
+    ab.append(ClearRow, 3);
+    ab.append("\r\n", 2);
+  }
+}
+
+void editorInvalidateScreen() {
+  E.screen.lines.clear();
+  E.screen.buf = nullptr;
+}
+
+// Draws the text area, line `y` by `drawLine(ab, y)`, as a change to what
+// the terminal already shows. If the lines moved up by `shift` since the last
+// frame, or down for a negative shift, the terminal shifts the lines it has
+// with a scroll region first; then only lines that differ are sent.
+void editorDrawScreenLines(AppendBuffer &ab, int shift,
+                           void (*drawLine)(AppendBuffer &, int)) {
+  Screen &screen = E.screen;
+  if (screen.lines.size() != static_cast<size_t>(E.screenRows) ||
+      screen.cols != E.screenCols) {
+    editorInvalidateScreen();
+    screen.lines.resize(E.screenRows);
+    screen.cols = E.screenCols;
+    shift = 0;
+  }
+
+  if (shift != 0 && abs(shift) < E.screenRows) {
+    auto region = setScrollRegion(1, E.screenRows);
+    ab.append(region.c_str(), region.size());
+    auto scroll = shift > 0 ? scrollUp(shift) : scrollDown(-shift);
+    ab.append(scroll.c_str(), scroll.size());
+    ab.append(ResetScrollRegion, 3);
+
+    auto &lines = screen.lines;
+    if (shift > 0) {
+      std::move(lines.begin() + shift, lines.end(), lines.begin());
+      for (int y = E.screenRows - shift; y < E.screenRows; ++y)
+        lines[y].clear();
+    } else {
+      std::move_backward(lines.begin(), lines.end() + shift, lines.end());
+      for (int y = 0; y < -shift; ++y)
+        lines[y].clear();
+    }
+  }
+
+  for (int y = 0; y < E.screenRows; ++y) {
+    AppendBuffer line;
+    drawLine(line, y);
+    std::string &shown = screen.lines[y];
+    if (shown.size() == static_cast<size_t>(line.length) &&
+        memcmp(shown.data(), line.buffer, line.length) == 0)
+      continue;
+
+    auto move = setCursorPosition(y + 1, 1);
+    ab.append(move.c_str(), move.size());
+    ab.append(line.buffer, line.length);
+    ab.append(ClearRow, 3);
+    shown.assign(line.buffer, line.length);
+  }
+}
+
+// Draws the rows of the shown buffer as a change to the last frame, shifting
+// the lines the terminal has when only the scroll position moved.
+void editorDrawChangedRows(AppendBuffer &ab) {
+  TRACE_SCOPE("editorDrawChangedRows");
+  editorHighlightScreen();
+
+  Screen &screen = E.screen;
+  int shift = 0;
+  if (screen.buf == E.buf && screen.colOffset == E.view.colOffset)
+    shift = E.view.rowOffset - screen.rowOffset;
+  editorDrawScreenLines(ab, shift, editorDrawRow);
+  screen.buf = E.buf;
+  screen.rowOffset = E.view.rowOffset;
+  screen.colOffset = E.view.colOffset;
+}
+
+void editorScroll() {
+  E.view.renderX = E.view.cursorX;
+  if (E.view.cursorY < E.buf->numRows) {
+    editorWarmRows(E.buf, E.view.cursorY, E.view.cursorY + 1);
+    E.view.renderX =
+        editorRowCxToRx(&E.buf->row[E.view.cursorY], E.view.cursorX);
+  }
+
+  if (E.view.cursorY < E.view.rowOffset)
+    E.view.rowOffset = E.view.cursorY;
+
+  if (E.view.cursorY >= E.view.rowOffset + E.screenRows)
+    E.view.rowOffset = E.view.cursorY - E.screenRows + 1;
+
+  if (E.view.renderX < E.view.colOffset)
+    E.view.colOffset = E.view.renderX;
+
+  if (E.view.renderX >= E.view.colOffset + E.screenCols)
+    E.view.colOffset = E.view.renderX - E.screenCols + 1;
+}
+
+void editorDrawStatusBar(AppendBuffer &ab) {
+  ab.append(ReverseVideo, 4);
+  char status[80];
+  char rstatus[80];
+  int len, rlen;
+  if (E.pager) {
+    editorPagerStatus(status, rstatus, sizeof(status));
+    len = strlen(status);
+    rlen = strlen(rstatus);
+  } else {
+    char loading[24] = "";
+    if (editorFollowing(E.buf))
+      snprintf(loading, sizeof(loading), "(following) ");
+    else if (E.buf->loader)
+      snprintf(loading, sizeof(loading), "(loading %d%%) ",
+               editorLoadPercent(E.buf));
+    len = snprintf(status, sizeof(status), "[%d/%zu] %.20s - %d lines %s%s",
+                   editorBufferIndex(E.buf) + 1, E.buffers.size(),
+                   E.buf->filename ? E.buf->filename : "[No Name]",
+                   E.buf->numRows, loading, E.buf->dirty ? "(modified)" : "");
+    char cursors[24] = "";
+    if (!E.view.cursors.empty())
+      snprintf(cursors, sizeof(cursors), "%zu cursors | ",
+               E.view.cursors.size() + 1);
+    rlen = snprintf(rstatus, sizeof(rstatus), "%s%s | %d/%d", cursors,
+                    E.buf->syntax ? E.buf->syntax->filetype : "no ft",
+                    E.view.cursorY + 1, E.buf->numRows);
+  }
+
+  if (len > E.screenCols)
+    len = E.screenCols;
+  ab.append(status, len);
+
+  while (len < E.screenCols) {
+    if (E.screenCols - len == rlen) {
+      ab.append(rstatus, rlen);
+      break;
+    } else {
+      ab.append(" ", 1);
+      ++len;
+    }
+  }
+  ab.append(ResetColor, 3);
+  ab.append("\r\n", 2);
+
+  if (E.hud.shown)
+    editorDrawHud(ab);
+}
+
+void editorDrawMessageBar(AppendBuffer &ab) {
+  ab.append(EraseLine, 3);
+  int msglen = strlen(E.statusmsg);
+  if (msglen > E.screenCols)
+    msglen = E.screenCols;
+  if (msglen && time(nullptr) - E.statusmsg_time < 5)
+    ab.append(E.statusmsg, msglen);
+}
+
+void editorRefreshScreen() {
+  TRACE_SCOPE("editorRefreshScreen");
+  // A client still taking an earlier frame is drawn once it has, from the
+  // screen that frame leaves.
+  if (E.server && editorClientBacklogged())
+    return;
+  long start = E.hud.shown ? editorMicros() : 0;
+  if (!E.pager)
+    editorScroll();
+
+  AppendBuffer ab;
+  ab.append(BeginSynchronizedUpdate, 8);
+  ab.append(MakeCursorInvisible, 6);
+
+  if (E.pager)
+    editorDrawPagerRows(ab);
+  else
+    editorDrawChangedRows(ab);
+  auto barsMove = setCursorPosition(E.screenRows + 1, 1);
+  ab.append(barsMove.c_str(), barsMove.size());
+  editorDrawStatusBar(ab);
+  editorDrawMessageBar(ab);
+
+  // A pager has no cursor of its own; it rests at the top of the screen.
+  auto cursorMove =
+      E.pager ? setCursorPosition(1, 1)
+              : setCursorPosition((E.view.cursorY - E.view.rowOffset) + 1,
+                                  (E.view.renderX - E.view.colOffset) + 1);
+  ab.append(cursorMove.c_str(), cursorMove.size());
+
+  ab.append(EndSynchronizedUpdate, 8);
+  ab.append(MakeCursorVisible, 6);
+
+  editorWriteOutput(ab.buffer, ab.length);
+
+  if (E.hud.shown) {
+    long now = editorMicros();
+    E.hud.frameMicros = now - start;
+    E.hud.frameBytes = ab.length;
+    if (E.hud.keyMicros) {
+      E.hud.latencyMicros = now - E.hud.keyMicros;
+      E.hud.keyMicros = 0;
+    }
+  }
+}
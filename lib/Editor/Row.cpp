@@ -0,0 +1,380 @@
+#include <Editor.hpp>
+
+#include <string.h>
+
+#include <algorithm>
+#include <vector>
+
+#include <Trace.hpp>
+#include <Unicode.hpp>
+
+// Re-highlights an edited row, timing it for the HUD when that is shown.
+static void editorRowUpdateSyntax(Row *row) {
+  if (!E.hud.shown) {
+    editorUpdateSyntax(E.buf, row);
+    return;
+  }
+  long start = editorMicros();
+  editorUpdateSyntax(E.buf, row);
+  E.hud.highlightMicros += editorMicros() - start;
+}
+
+void editorRenderRow(Row *row, int column) {
+  RowPool.Deallocate(row->render);
+
+  // Pure ASCII without tabs renders verbatim and needs no column stops.
+  bool ascii = utf8IsAscii(row->chars, row->size);
+  if (ascii && !memchr(row->chars, '\t', row->size)) {
+    row->render =
+        static_cast<char *>(RowPool.Allocate(row->size + 1, RenderMemory));
+    memcpy(row->render, row->chars, row->size);
+    row->render[row->size] = '\0';
+    row->rsize = row->size;
+    RowPool.Deallocate(row->stops);
+    row->stops = nullptr;
+    row->numStops = 0;
+    return;
+  }
+
+  int tabs = 0;
+  int wide = 0;
+  for (int j = 0; j < row->size; ++j) {
+    if (row->chars[j] == '\t')
+      ++tabs;
+    else if (!ascii && (row->chars[j] & 0x80) &&
+             !utf8IsContinuation(row->chars[j]))
+      ++wide;
+  }
+
+  row->render = static_cast<char *>(
+      RowPool.Allocate(row->size + tabs * (TabSize - 1) + 1, RenderMemory));
+  row->stops = static_cast<ColumnStop *>(
+      RowPool.Reallocate(row->stops, sizeof(ColumnStop) * (tabs + wide),
+                         StopsMemory));
+
+  int index = 0;
+  int renderX = 0;
+  int stop = 0;
+  for (int j = 0; j < row->size;) {
+    unsigned char c = row->chars[j];
+    if (c == '\t') {
+      row->render[index++] = ' ';
+      ++renderX;
+      while ((column + renderX) % TabSize != 0) {
+        row->render[index++] = ' ';
+        ++renderX;
+      }
+      row->stops[stop++] = {j, j + 1, renderX, index};
+      ++j;
+    } else if (c < 0x80) {
+      row->render[index++] = c;
+      ++renderX;
+      ++j;
+    } else {
+      uint32_t codepoint;
+      int len = utf8Decode(&row->chars[j], row->size - j, &codepoint);
+      // A malformed byte is drawn as a single `?` cell.
+      int width = len == 1 ? 1 : codepointWidth(codepoint);
+      memcpy(&row->render[index], &row->chars[j], len);
+      index += len;
+      renderX += width;
+      if (len != 1)
+        row->stops[stop++] = {j, j + len, renderX, index};
+      j += len;
+    }
+  }
+
+  row->render[index] = '\0';
+  row->rsize = index;
+  row->numStops = stop;
+}
+
+void editorUpdateRow(Row *row) {
+  TRACE_SCOPE("editorUpdateRow");
+  if (!editorChunkRow(row))
+    editorRenderRow(row);
+  E.buf->lineIndex.Set(row->idx, row->size + 1);
+  editorRowUpdateSyntax(row);
+  editorNoteWarm(E.buf, row->idx);
+}
+
+void editorMarkChanged(Buffer *buf) {
+  ++buf->dirty;
+  ++buf->version;
+}
+
+// Moves `count` rows, text and all, into the buffer at `at`, shifting the
+// rows after them once however many there are. Rendering and highlighting
+// the new rows is up to the caller.
+void editorInsertRows(int at, Row *rows, int count) {
+  Buffer *buf = E.buf;
+  if (at < 0 || at > buf->numRows || count <= 0)
+    return;
+
+  if (buf->numRows + count > buf->rowCapacity) {
+    while (buf->numRows + count > buf->rowCapacity)
+      buf->rowCapacity = buf->rowCapacity ? buf->rowCapacity * 2 : 16;
+    buf->row = static_cast<Row *>(
+        RowPool.Reallocate(buf->row, sizeof(Row) * buf->rowCapacity,
+                           RowArrayMemory));
+  }
+  memmove(&buf->row[at + count], &buf->row[at],
+          sizeof(Row) * (buf->numRows - at));
+  for (int j = at + count; j < buf->numRows + count; ++j)
+    buf->row[j].idx += count;
+  if (buf->highlightFrom != -1 && at < buf->highlightFrom)
+    buf->highlightFrom += count;
+  editorShiftCold(buf, at, count);
+
+  std::vector<uint64_t> lengths(count);
+  for (int j = 0; j < count; ++j) {
+    buf->row[at + j] = rows[j];
+    buf->row[at + j].idx = at + j;
+    lengths[j] = rows[j].size + 1;
+  }
+  buf->lineIndex.Insert(at, lengths.data(), count);
+  buf->numRows += count;
+  editorNoteWarm(buf, at);
+  editorNoteWarm(buf, at + count - 1);
+  editorMarkChanged(buf);
+}
+
+void editorInsertRow(int at, char *s, size_t len) {
+  if (at < 0 || at > E.buf->numRows)
+    return;
+
+  Row row{};
+  row.size = len;
+  row.chars = static_cast<char *>(RowPool.Allocate(len + 1, TextMemory));
+  memcpy(row.chars, s, len);
+  row.chars[len] = '\0';
+  editorInsertRows(at, &row, 1);
+  editorUpdateRow(&E.buf->row[at]);
+}
+
+void editorRowInsertChar(Row *row, int at, int c) {
+  if (at < 0 || at > row->size)
+    at = row->size;
+  if (row->chunks) {
+    char ch = c;
+    editorChunkInsert(E.buf, row, at, &ch, 1);
+    editorMarkChanged(E.buf);
+    return;
+  }
+
+  row->chars = static_cast<char *>(
+      RowPool.Reallocate(row->chars, row->size + 2, TextMemory));
+  memmove(&row->chars[at + 1], &row->chars[at], row->size - at + 1);
+  row->size++;
+  row->chars[at] = c;
+  editorUpdateRow(row);
+  editorMarkChanged(E.buf);
+}
+
+void editorRowInsertString(Row *row, int at, char const *s, size_t len) {
+  if (at < 0 || at > row->size)
+    at = row->size;
+  if (row->chunks) {
+    editorChunkInsert(E.buf, row, at, s, len);
+    editorMarkChanged(E.buf);
+    return;
+  }
+
+  row->chars = static_cast<char *>(
+      RowPool.Reallocate(row->chars, row->size + len + 1, TextMemory));
+  memmove(&row->chars[at + len], &row->chars[at], row->size - at + 1);
+  memcpy(&row->chars[at], s, len);
+  row->size += len;
+  editorUpdateRow(row);
+  editorMarkChanged(E.buf);
+}
+
+void editorInsertChar(int c) {
+  if (E.view.cursorY == E.buf->numRows)
+    editorInsertRow(E.buf->numRows, const_cast<char *>(""), 0);
+
+  editorWarmRows(E.buf, E.view.cursorY, E.view.cursorY + 1);
+  editorRowInsertChar(&E.buf->row[E.view.cursorY], E.view.cursorX, c);
+  E.view.cursorX++;
+}
+
+void editorInsertNewLine() {
+  if (E.view.cursorX == 0)
+    editorInsertRow(E.view.cursorY, const_cast<char *>(""), 0);
+  else {
+    Row *row = &E.buf->row[E.view.cursorY];
+    editorWarmRow(E.buf, row);
+    editorInsertRow(E.view.cursorY + 1, &row->chars[E.view.cursorX],
+                    row->size - E.view.cursorX);
+    row = &E.buf->row[E.view.cursorY];
+    row->chars = static_cast<char *>(RowPool.Unshare(row->chars));
+    row->size = E.view.cursorX;
+    row->chars[row->size] = '\0';
+    editorUpdateRow(row);
+  }
+  E.view.cursorY++;
+  E.view.cursorX = 0;
+}
+
+// Inserts `len` bytes at the cursor, splitting rows at newlines. Each run
+// between newlines goes into its row in one piece.
+void editorInsertText(char const *s, size_t len) {
+  while (true) {
+    if (E.view.cursorY == E.buf->numRows)
+      editorInsertRow(E.buf->numRows, const_cast<char *>(""), 0);
+
+    char const *newline = static_cast<char const *>(memchr(s, '\n', len));
+    size_t run = newline ? newline - s : len;
+    if (run) {
+      editorWarmRows(E.buf, E.view.cursorY, E.view.cursorY + 1);
+      editorRowInsertString(&E.buf->row[E.view.cursorY], E.view.cursorX, s,
+                            run);
+      E.view.cursorX += run;
+    }
+    if (newline == nullptr)
+      break;
+    editorInsertNewLine();
+    s += run + 1;
+    len -= run + 1;
+  }
+}
+
+// Deletes the whole character starting at `at`, which may span several bytes.
+void editorRowDelChar(Row *row, int at) {
+  if (at < 0 || at >= row->size)
+    return;
+
+  int len = editorRowNextBoundary(row, at) - at;
+  if (row->chunks) {
+    editorChunkDelete(E.buf, row, at, len);
+    editorMarkChanged(E.buf);
+    return;
+  }
+  row->chars = static_cast<char *>(RowPool.Unshare(row->chars));
+  memmove(&row->chars[at], &row->chars[at + len], row->size - at - len + 1);
+  row->size -= len;
+  editorUpdateRow(row);
+  editorMarkChanged(E.buf);
+}
+
+void editorFreeRow(Row *row) {
+  editorDropCold(row);
+  editorDropChunks(row);
+  RowPool.Deallocate(row->render);
+  RowPool.Deallocate(row->chars);
+  RowPool.Deallocate(row->hl);
+  RowPool.Deallocate(row->stops);
+}
+
+void editorRowAppendString(Row *row, char *s, size_t len) {
+  row->chars = static_cast<char *>(
+      RowPool.Reallocate(row->chars, row->size + len + 1, TextMemory));
+  memcpy(&row->chars[row->size], s, len);
+  row->size += len;
+  row->chars[row->size] = '\0';
+  editorUpdateRow(row);
+  editorMarkChanged(E.buf);
+}
+
+// Frees the `count` rows from `at`, or moves them to `taken` if given, and
+// closes the gap in one shift.
+void editorDelRows(int at, int count, Row *taken) {
+  Buffer *buf = E.buf;
+  if (at < 0 || count <= 0 || at + count > buf->numRows)
+    return;
+
+  if (taken)
+    memcpy(taken, &buf->row[at], sizeof(Row) * count);
+  else
+    for (int j = at; j < at + count; ++j)
+      editorFreeRow(&buf->row[j]);
+  buf->lineIndex.Erase(at, count);
+  memmove(&buf->row[at], &buf->row[at + count],
+          sizeof(Row) * (buf->numRows - at - count));
+  buf->numRows -= count;
+  for (int j = at; j < buf->numRows; ++j)
+    buf->row[j].idx -= count;
+  if (buf->highlightFrom != -1 && at < buf->highlightFrom)
+    buf->highlightFrom = std::max(at, buf->highlightFrom - count);
+  editorShiftCold(buf, at, -count);
+  editorMarkChanged(buf);
+}
+
+void editorDelRow(int at) { editorDelRows(at, 1); }
+
+void editorDelChar() {
+  if (E.view.cursorY == E.buf->numRows)
+    return;
+  if (E.view.cursorX == 0 && E.view.cursorY == 0)
+    return;
+
+  Row *row = &E.buf->row[E.view.cursorY];
+  if (E.view.cursorX > 0) {
+    editorWarmRows(E.buf, E.view.cursorY, E.view.cursorY + 1);
+    E.view.cursorX = editorRowPrevBoundary(row, E.view.cursorX);
+    editorRowDelChar(row, E.view.cursorX);
+  } else {
+    editorWarmRow(E.buf, row);
+    E.view.cursorX = E.buf->row[E.view.cursorY - 1].size;
+    editorWarmRow(E.buf, &E.buf->row[E.view.cursorY - 1]);
+    editorRowAppendString(&E.buf->row[E.view.cursorY - 1], row->chars,
+                          row->size);
+    editorDelRow(E.view.cursorY);
+    E.view.cursorY--;
+  }
+}
+
+// Maps a position on one axis of the row (`ColumnStop::cxEnd` for bytes of
+// `chars`, `rxEnd` for screen columns, `renderEnd` for bytes of `render`) to
+// another. A position inside a stop maps to the start of that stop.
+static int editorRowMap(Row *row, int ColumnStop::*from, int ColumnStop::*to,
+                        int value) {
+  // A chunked row maps through the chunk the position falls in.
+  if (row->chunks) {
+    Row piece;
+    ColumnStop start = editorChunkPiece(
+        E.buf, row, editorChunkAt(row, from, value), &piece);
+    return start.*to + editorRowMap(&piece, from, to, value - start.*from);
+  }
+  int lo = 0;
+  int hi = row->numStops;
+  while (lo < hi) {
+    int mid = lo + (hi - lo) / 2;
+    if (row->stops[mid].*from <= value)
+      lo = mid + 1;
+    else
+      hi = mid;
+  }
+
+  ColumnStop base = lo > 0 ? row->stops[lo - 1] : ColumnStop{0, 0, 0, 0};
+  int offset = value - base.*from;
+  if (lo < row->numStops && offset > row->stops[lo].cx - base.cxEnd)
+    offset = row->stops[lo].cx - base.cxEnd;
+  return base.*to + offset;
+}
+
+int editorRowCxToRx(Row *row, int cursorX) {
+  return editorRowMap(row, &ColumnStop::cxEnd, &ColumnStop::rxEnd, cursorX);
+}
+
+int editorRowRxToCx(Row *row, int renderX) {
+  int cx = editorRowMap(row, &ColumnStop::rxEnd, &ColumnStop::cxEnd, renderX);
+  return cx < row->size ? cx : row->size;
+}
+
+int editorRowRenderToCx(Row *row, int renderIndex) {
+  int cx = editorRowMap(row, &ColumnStop::renderEnd, &ColumnStop::cxEnd,
+                        renderIndex);
+  return cx < row->size ? cx : row->size;
+}
+
+int editorRowRxToRender(Row *row, int renderX) {
+  int index =
+      editorRowMap(row, &ColumnStop::rxEnd, &ColumnStop::renderEnd, renderX);
+  return index < row->rsize ? index : row->rsize;
+}
+
+int editorRowRenderToRx(Row *row, int renderIndex) {
+  return editorRowMap(row, &ColumnStop::renderEnd, &ColumnStop::rxEnd,
+                      renderIndex);
+}
@@ -0,0 +1,503 @@
+#include <Editor.hpp>
+
+#include <string.h>
+
+#include <algorithm>
+#include <string>
+#include <string_view>
+#include <thread>
+#include <vector>
+
+#include <Trace.hpp>
+#include <Unicode.hpp>
+
+// The query of the last search that was accepted with Enter.
+static std::string LastQuery;
+
+// Queries accepted at the search and replace prompts, oldest first, without
+// repeats. Kept in session caches, see Session.cpp.
+static std::vector<std::string> SearchHistory;
+size_t const SearchHistoryLength = 32;
+
+// Cursors are added at no more matches than this.
+size_t const MaxCursors = 100000;
+
+// Marks the `len` bytes at `at` in `row`, which is in chunks, as a match,
+// through the renderings of the chunks they fall in.
+static void editorMarkChunkMatch(Row *row, int at, int len) {
+  int end = at + len;
+  for (int k = editorChunkAt(row, &ColumnStop::cxEnd, at);
+       at < end && k < editorChunkCount(row); ++k) {
+    Row piece;
+    int base = editorChunkPiece(E.buf, row, k, &piece).cxEnd;
+    int to = std::min(end - base, piece.size);
+    int start = editorRowRxToRender(&piece, editorRowCxToRx(&piece, at - base));
+    int stop = editorRowRxToRender(&piece, editorRowCxToRx(&piece, to));
+    memset(&piece.hl[start], Highlight::Match, stop - start);
+    at = base + piece.size;
+  }
+}
+
+void editorFindCallback(char *query, int key) {
+  SearchState &search = E.search;
+
+  // Under --server another client may have edited or closed the buffer
+  // since the match was marked, so the row is only put back as it was if it
+  // is still there and the same size.
+  if (search.buf == E.buf && search.line < E.buf->numRows) {
+    Row *row = &E.buf->row[search.line];
+    if (search.chunks && row->chunks)
+      editorForgetChunks(row);
+    else if (search.savedHl && !row->cold && !row->chunks &&
+             row->rsize == search.savedSize)
+      std::memcpy(row->hl, search.savedHl, row->rsize);
+  }
+  if (search.savedHl) {
+    RowPool.Deallocate(search.savedHl);
+    search.savedHl = nullptr;
+  }
+  search.buf = nullptr;
+  search.chunks = false;
+
+  if (key == '\r' || key == '\x1b') {
+    search.lastMatch = -1;
+    search.direction = 1;
+    return;
+  } else if (key == Key::ArrowRight || key == Key::ArrowDown) {
+    search.direction = 1;
+  } else if (key == Key::ArrowLeft || key == ArrowUp) {
+    search.direction = -1;
+  } else {
+    search.lastMatch = -1;
+    search.direction = 1;
+  }
+
+  if (search.lastMatch == -1)
+    search.direction = 1;
+
+  int current = std::min(search.lastMatch, E.buf->numRows - 1);
+
+  for (int i = 0; i < E.buf->numRows; ++i) {
+    current += search.direction;
+    if (current == -1)
+      current = E.buf->numRows - 1;
+    else if (current == E.buf->numRows)
+      current = 0;
+
+    Row *row = &E.buf->row[current];
+    if (row->cold) {
+      // Rendering only expands tabs, so a cold row without them can be ruled
+      // out without unpacking it for good.
+      char const *text = editorRowText(row);
+      if (!memchr(text, '\t', row->size) &&
+          !memmem(text, row->size, query, strlen(query)))
+        continue;
+      editorWarmRow(E.buf, row);
+    }
+    if (editorChunkRow(row))
+      editorUpdateSyntax(E.buf, row);
+    if (row->chunks) {
+      // Matched against the text rather than the rendering, which is only
+      // ever there for the chunks in view.
+      char const *text = editorRowText(row);
+      char const *found = static_cast<char const *>(
+          memmem(text, row->size, query, strlen(query)));
+      if (found == nullptr)
+        continue;
+      search.lastMatch = current;
+      E.view.cursorY = current;
+      E.view.cursorX = found - text;
+      E.view.rowOffset = E.buf->numRows;
+      search.buf = E.buf;
+      search.line = current;
+      search.chunks = true;
+      editorMarkChunkMatch(row, E.view.cursorX, strlen(query));
+      break;
+    }
+    char *match = strstr(row->render, query);
+    if (match) {
+      search.lastMatch = current;
+      E.view.cursorY = current;
+      E.view.cursorX = editorRowRenderToCx(row, match - row->render);
+      E.view.rowOffset = E.buf->numRows;
+
+      search.buf = E.buf;
+      search.line = current;
+      row->hl = static_cast<unsigned char *>(RowPool.Unshare(row->hl));
+      search.savedHl =
+          static_cast<char *>(RowPool.Allocate(row->rsize, SearchMemory));
+      search.savedSize = row->rsize;
+      memcpy(search.savedHl, row->hl, row->rsize);
+      std::memset(&row->hl[match - row->render], Highlight::Match,
+                  strlen(query));
+      break;
+    }
+  }
+}
+
+std::vector<std::string> const &editorSearchHistory() {
+  return SearchHistory;
+}
+
+void editorAddSearchHistory(std::string const &query) {
+  auto it = std::find(SearchHistory.begin(), SearchHistory.end(), query);
+  if (it != SearchHistory.end())
+    SearchHistory.erase(it);
+  else if (SearchHistory.size() == SearchHistoryLength)
+    SearchHistory.erase(SearchHistory.begin());
+  SearchHistory.push_back(query);
+  LastQuery = query;
+}
+
+void editorFind() {
+  int saved_cx = E.view.cursorX;
+  int saved_cy = E.view.cursorY;
+  int saved_coloff = E.view.colOffset;
+  int saved_rowoff = E.view.rowOffset;
+
+  char *query =
+      editorPrompt(const_cast<char *>("Search: %s (Use ESC/Arrows/Enter)"),
+                   editorFindCallback, false, &SearchHistory);
+
+  if (query) {
+    editorAddSearchHistory(query);
+    free(query);
+  } else {
+    // Other clients may have removed rows meanwhile, the saved one among
+    // them.
+    E.view.cursorX = saved_cx;
+    E.view.cursorY = std::min(saved_cy, E.buf->numRows);
+    E.view.colOffset = saved_coloff;
+    E.view.rowOffset = saved_rowoff;
+    editorClampCursor();
+  }
+}
+
+// Puts a cursor at the start of every match of the last search, besides the
+// main cursor, which stays where it is.
+void editorAddCursorsAtMatches() {
+  TRACE_SCOPE("editorAddCursorsAtMatches");
+  if (LastQuery.empty()) {
+    editorSetStatusMessage("Search first (Ctrl-/), then add cursors at the "
+                           "matches");
+    return;
+  }
+
+  std::vector<Cursor> cursors;
+  for (int y = 0; y < E.buf->numRows && cursors.size() < MaxCursors; ++y) {
+    Row *row = &E.buf->row[y];
+    char const *text = editorRowText(row);
+    char const *end = text + row->size;
+    for (char const *match = text;
+         cursors.size() < MaxCursors &&
+         (match = static_cast<char const *>(memmem(
+              match, end - match, LastQuery.data(), LastQuery.size())));
+         match += LastQuery.size())
+      cursors.push_back({static_cast<int>(match - text), y});
+  }
+  bool capped = cursors.size() == MaxCursors;
+  editorSetCursors(std::move(cursors));
+  editorSetStatusMessage("%zu cursors%s; Esc goes back to one",
+                         E.view.cursors.size() + 1,
+                         capped ? " (the first matches only)" : "");
+}
+
+// Below this many rows per worker, starting another thread for replace-all
+// costs more than the matching it takes over.
+int const ReplaceRowsPerThread = 16384;
+
+// Fills in `out` as `row` with every occurrence of `query` replaced, rendered
+// but not highlighted. Returns the number of matches, leaving `out` untouched
+// if there are none. Only touches the row pool, so workers can run it.
+static int editorReplaceInRow(Row const *row, char const *text,
+                              std::string_view query,
+                              std::string_view replacement, Row *out) {
+  char const *match = static_cast<char const *>(
+      memmem(text, row->size, query.data(), query.size()));
+  if (match == nullptr)
+    return 0;
+
+  int matches = 0;
+  for (char const *m = match; m; ++matches) {
+    m += query.size();
+    m = static_cast<char const *>(
+        memmem(m, text + row->size - m, query.data(), query.size()));
+  }
+
+  size_t size = row->size + matches * (static_cast<long>(replacement.size()) -
+                                       static_cast<long>(query.size()));
+  char *chars = static_cast<char *>(RowPool.Allocate(size + 1, TextMemory));
+  char *to = chars;
+  char const *in = text;
+  for (char const *m = match; m;) {
+    memcpy(to, in, m - in);
+    to += m - in;
+    memcpy(to, replacement.data(), replacement.size());
+    to += replacement.size();
+    in = m + query.size();
+    m = static_cast<char const *>(
+        memmem(in, text + row->size - in, query.data(), query.size()));
+  }
+  memcpy(to, in, text + row->size - in);
+  chars[size] = '\0';
+
+  *out = Row{};
+  out->idx = row->idx;
+  out->chars = chars;
+  out->size = size;
+  editorRenderRow(out);
+  return matches;
+}
+
+// Puts the text and rendering of `replaced` into the buffer row it was built
+// from, keeping the old text in `step`.
+static void editorSwapInRow(Row const &replaced, UndoStep &step) {
+  Row *row = &E.buf->row[replaced.idx];
+  step.rows.push_back({row->idx, editorTakeRowText(row), row->size});
+  RowPool.Deallocate(row->render);
+  RowPool.Deallocate(row->stops);
+  row->chars = replaced.chars;
+  row->size = replaced.size;
+  row->render = replaced.render;
+  row->rsize = replaced.rsize;
+  row->stops = replaced.stops;
+  row->numStops = replaced.numStops;
+  E.buf->lineIndex.Set(row->idx, row->size + 1);
+  editorNoteWarm(E.buf, row->idx);
+}
+
+// Replaces every occurrence of `query` in the shown buffer as one undo step,
+// and returns how many were replaced, and in how many rows through `rows`.
+//
+// Worker threads each take a run of rows, matching them and building and
+// rendering their new contents. This thread then swaps the new rows in and
+// re-highlights the affected range in a single pass.
+int editorReplaceAll(char const *query, char const *replacement, int *rows) {
+  TRACE_SCOPE("editorReplaceAll");
+  std::string_view queryView = query;
+  std::string_view replacementView = replacement;
+  if (rows)
+    *rows = 0;
+  if (queryView.empty() || E.buf->numRows == 0)
+    return 0;
+
+  struct Replaced {
+    Row row;
+    int matches;
+  };
+  int numRows = E.buf->numRows;
+  int cores = std::max(1u, std::thread::hardware_concurrency());
+  int workers = std::clamp(numRows / ReplaceRowsPerThread, 1, cores);
+  std::vector<std::vector<Replaced>> results(workers);
+  std::vector<std::thread> threads;
+  for (int w = 0; w < workers; ++w) {
+    int first = static_cast<long>(numRows) * w / workers;
+    int last = static_cast<long>(numRows) * (w + 1) / workers;
+    threads.emplace_back([=, &results] {
+      TRACE_SCOPE("editorReplaceRows");
+      ColdCache cache;
+      for (int y = first; y < last; ++y) {
+        Row const *row = &E.buf->row[y];
+        Replaced replaced;
+        replaced.matches =
+            editorReplaceInRow(row, editorRowText(row, cache), queryView,
+                               replacementView, &replaced.row);
+        if (replaced.matches)
+          results[w].push_back(replaced);
+      }
+    });
+  }
+  for (auto &thread : threads)
+    thread.join();
+
+  UndoStep step{E.buf->version, 0, {}};
+  int count = 0;
+  for (auto &chunk : results) {
+    for (auto &replaced : chunk) {
+      editorSwapInRow(replaced.row, step);
+      count += replaced.matches;
+    }
+  }
+  if (step.rows.empty())
+    return 0;
+
+  if (rows)
+    *rows = step.rows.size();
+  editorMarkChanged(E.buf);
+  step.after = E.buf->version;
+  editorUpdateSyntaxRange(E.buf, step.rows.front().idx, step.rows.back().idx);
+  editorPushUndo(E.buf, std::move(step));
+  editorClampCursor();
+  return count;
+}
+
+// Replaces the `length` bytes at `at` in `row` with `replacement`, keeping
+// the row's old text in `step` unless an earlier replacement already did.
+static void editorReplaceAt(Row *row, int at, int length,
+                            std::string_view replacement, UndoStep &step) {
+  editorWarmRow(E.buf, row);
+  bool saved = std::any_of(step.rows.begin(), step.rows.end(),
+                           [&](auto &s) { return s.idx == row->idx; });
+  if (!saved) {
+    char *copy =
+        static_cast<char *>(RowPool.Allocate(row->size + 1, TextMemory));
+    memcpy(copy, row->chars, row->size + 1);
+    step.rows.push_back({row->idx, copy, row->size});
+  }
+
+  int size = row->size - length + replacement.size();
+  char *chars = static_cast<char *>(RowPool.Allocate(size + 1, TextMemory));
+  memcpy(chars, row->chars, at);
+  memcpy(&chars[at], replacement.data(), replacement.size());
+  memcpy(&chars[at + replacement.size()], &row->chars[at + length],
+         row->size - at - length + 1);
+  RowPool.Deallocate(row->chars);
+  row->chars = chars;
+  row->size = size;
+  editorUpdateRow(row);
+  editorMarkChanged(E.buf);
+}
+
+// Shows the match of `length` bytes at `at` in the cursor row and asks what
+// to do with it. Returns the key pressed, or `q` if another client changed
+// the buffer while this one was asking, as rows may have moved under it.
+static int editorAskReplace(int at, int length) {
+  Buffer *buf = E.buf;
+  unsigned long version = buf->version;
+  Row *row = &buf->row[E.view.cursorY];
+  E.view.cursorX = at;
+  E.view.rowOffset = E.buf->numRows;
+
+  if (row->chunks) {
+    editorMarkChunkMatch(row, at, length);
+  } else {
+    int start = editorRowRxToRender(row, editorRowCxToRx(row, at));
+    int end = editorRowRxToRender(row, editorRowCxToRx(row, at + length));
+    row->hl = static_cast<unsigned char *>(RowPool.Unshare(row->hl));
+    memset(&row->hl[start], Highlight::Match, end - start);
+  }
+
+  int c;
+  do {
+    editorSetStatusMessage("Replace this match? y/n, a for all, q to stop");
+    editorRefreshScreen();
+    c = editorReadKey();
+  } while (c == Key::Idle);
+
+  if (E.buf != buf || buf->version != version) {
+    if (E.view.cursorY < E.buf->numRows)
+      editorUpdateSyntax(E.buf, &E.buf->row[E.view.cursorY]);
+    return 'q';
+  }
+  if (row->chunks)
+    editorForgetChunks(row);
+  else
+    editorUpdateSyntax(E.buf, row);
+  return c;
+}
+
+// Asks for a query and its replacement, then steps through the matches from
+// the cursor on, wrapping around once, asking about each. `a` replaces every
+// match in the buffer at once, including any skipped so far. Each run of
+// single replacements and each replace-all is one undo step.
+void editorReplace() {
+  char *query = editorPrompt(const_cast<char *>("Replace: %s (ESC to cancel)"),
+                             nullptr, false, &SearchHistory);
+  if (query == nullptr)
+    return;
+  editorAddSearchHistory(query);
+
+  // The query becomes part of the next prompt, which is a format string.
+  std::string prompt = "Replace ";
+  for (char const *c = query; *c; ++c)
+    prompt += *c == '%' ? "%%" : std::string(1, *c);
+  prompt += " with: %s";
+  char *replacement =
+      editorPrompt(const_cast<char *>(prompt.c_str()), nullptr, true);
+  if (replacement == nullptr) {
+    free(query);
+    return;
+  }
+
+  std::string_view queryView = query;
+  std::string_view replacementView = replacement;
+  Buffer *buf = E.buf;
+  int startY = E.view.cursorY;
+  int startX = E.view.cursorX;
+  UndoStep step{buf->version, buf->version, {}};
+  int replaced = 0;
+  bool all = false;
+  bool stop = false;
+
+  // The start row is visited twice: from the cursor on, and after wrapping
+  // around, up to where the cursor was. The line past the end holds no text
+  // but is where the cursor wraps through.
+  int lines = E.buf->numRows + 1;
+  for (int i = 0; i <= lines && !stop; ++i) {
+    int y = (startY + i) % lines;
+    if (y == E.buf->numRows)
+      continue;
+    Row *row = &E.buf->row[y];
+    bool wrapped = i == lines;
+    int from = i == 0 ? startX : 0;
+    int limit = wrapped ? startX : row->size;
+
+    while (!stop) {
+      char const *text = editorRowText(row);
+      char const *match = static_cast<char const *>(
+          memmem(text + from, std::max(0, limit - from), queryView.data(),
+                 queryView.size()));
+      if (match == nullptr)
+        break;
+
+      int at = match - text;
+      editorWarmRows(E.buf, y, y + 1);
+      E.view.cursorY = y;
+      int c = editorAskReplace(at, queryView.size());
+      if (c == 'y') {
+        editorReplaceAt(row, at, queryView.size(), replacementView, step);
+        step.after = buf->version;
+        ++replaced;
+        from = at + replacementView.size();
+        if (wrapped)
+          limit += replacementView.size() - queryView.size();
+        else
+          limit = row->size;
+      } else if (c == 'n') {
+        from = at + queryView.size();
+      } else {
+        all = c == 'a';
+        stop = true;
+      }
+    }
+  }
+
+  // Edits other clients made since leave the step as of the last
+  // replacement, which undo then refuses; a buffer they closed takes none.
+  bool interrupted = E.buf != buf || buf->version != step.after;
+  std::sort(step.rows.begin(), step.rows.end(),
+            [](auto &a, auto &b) { return a.idx < b.idx; });
+  if (E.buf == buf) {
+    editorPushUndo(buf, std::move(step));
+  } else {
+    for (auto &saved : step.rows)
+      RowPool.Deallocate(saved.chars);
+  }
+
+  if (all) {
+    long start = editorMicros();
+    int rows;
+    int count = editorReplaceAll(query, replacement, &rows);
+    double ms = (editorMicros() - start) / 1000.0;
+    editorSetStatusMessage(
+        "Replaced %d matches in %d rows in %.1f ms; Ctrl-Z undoes",
+        count, rows, ms);
+  } else if (interrupted) {
+    editorSetStatusMessage("Replaced %d matches; stopped as the buffer changed",
+                           replaced);
+  } else {
+    editorSetStatusMessage("Replaced %d matches", replaced);
+  }
+  free(query);
+  free(replacement);
+}
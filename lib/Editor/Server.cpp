@@ -0,0 +1,605 @@
+#include <Editor.hpp>
+
+#include <errno.h>
+#include <fcntl.h>
+#include <limits.h>
+#include <poll.h>
+#include <signal.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <sys/ioctl.h>
+#include <sys/socket.h>
+#include <sys/stat.h>
+#include <sys/un.h>
+#include <unistd.h>
+
+#include <algorithm>
+#include <condition_variable>
+#include <mutex>
+#include <string>
+#include <thread>
+#include <utility>
+#include <vector>
+
+#include <Trace.hpp>
+
+// A client's hello is its working directory and the files it names, each
+// ended by a NUL, sent along with its terminal's input and output. It must
+// fit in one packet of this size.
+size_t const HelloBytes = 64 * 1024;
+
+// How long the server waits for a key before doing idle work, as long as
+// raw mode has a terminal wait.
+int const ServerTickMillis = 100;
+
+// A terminal attached to the server. While it is served, the state it keeps
+// here is swapped with E's, so each client has its own buffer on show, view,
+// screen, status message and search while the buffers themselves are shared.
+struct Client {
+  // A SOCK_SEQPACKET connection, over which the client sends its hello and
+  // a byte whenever its window is resized. Closing it lets the client exit.
+  int socket;
+  // The client's terminal, or -1 until the hello brings it. The output is
+  // opened again to write without blocking: what the terminal doesn't take
+  // at once waits in `pending`, and the client gets no frames until it has
+  // all gone. `stale` is set if one was skipped meanwhile.
+  int input = -1;
+  int output = -1;
+  std::string pending;
+  bool stale = false;
+  // Set once the client asked to go or went away; dropped after the key.
+  bool detached = false;
+  // Handles the client's keys, so that a prompt it is at waits on a stack of
+  // its own while the others are served. Only the server's thread or one
+  // client's runs at a time: `turn` is set while this one's does.
+  std::thread keys;
+  bool turn = false;
+  bool finished = false;
+
+  Buffer *buf = nullptr;
+  View view{};
+  Screen screen{};
+  int screenRows = 24 - 2;
+  int screenCols = 80;
+  char statusmsg[80] = "";
+  time_t statusmsg_time = 0;
+  SearchState search;
+  // The view each buffer has while this client is served, for switching to
+  // it. Buffers are added as the client is first served after they open.
+  std::vector<std::pair<Buffer *, View>> views;
+};
+
+struct Server {
+  int listener;
+  std::vector<Client *> clients;
+  // The client swapped into E, or nullptr. E holds what the server had
+  // before any client was served meanwhile: a buffer that stays valid.
+  Client *current = nullptr;
+  // Hands the turn between the server's thread and the clients'.
+  std::mutex lock;
+  std::condition_variable turns;
+};
+
+std::string editorDefaultSocketPath() {
+  char const *dir = getenv("XDG_RUNTIME_DIR");
+  if (dir && *dir)
+    return std::string(dir) + "/kilo.sock";
+  return "/tmp/kilo-" + std::to_string(getuid()) + ".sock";
+}
+
+static bool editorSocketAddress(char const *path, sockaddr_un *address) {
+  *address = sockaddr_un{};
+  address->sun_family = AF_UNIX;
+  if (strlen(path) >= sizeof(address->sun_path)) {
+    errno = ENAMETOOLONG;
+    return false;
+  }
+  strcpy(address->sun_path, path);
+  return true;
+}
+
+// Connects to the server at `path`. Returns -1 with errno set if there is
+// none.
+static int editorConnect(char const *path) {
+  sockaddr_un address;
+  if (!editorSocketAddress(path, &address))
+    return -1;
+  int fd = socket(AF_UNIX, SOCK_SEQPACKET | SOCK_CLOEXEC, 0);
+  if (fd == -1)
+    return -1;
+  if (connect(fd, reinterpret_cast<sockaddr *>(&address), sizeof(address)) ==
+      0)
+    return fd;
+  int saved = errno;
+  close(fd);
+  errno = saved;
+  return -1;
+}
+
+// Listens at `path`, taking it over from a server that is gone but not from
+// one still running. Only this user may connect.
+static int editorListen(char const *path) {
+  int running = editorConnect(path);
+  if (running != -1) {
+    close(running);
+    errno = EADDRINUSE;
+    return -1;
+  }
+  if (errno == ECONNREFUSED)
+    unlink(path);
+
+  sockaddr_un address;
+  if (!editorSocketAddress(path, &address))
+    return -1;
+  int fd = socket(AF_UNIX, SOCK_SEQPACKET | SOCK_CLOEXEC, 0);
+  if (fd == -1)
+    return -1;
+  mode_t mask = umask(0077);
+  bool ok = bind(fd, reinterpret_cast<sockaddr *>(&address),
+                 sizeof(address)) == 0 &&
+            listen(fd, 16) == 0;
+  umask(mask);
+  if (ok)
+    return fd;
+  int saved = errno;
+  close(fd);
+  errno = saved;
+  return -1;
+}
+
+// Swaps the state `c` keeps with E's. Doing it twice undoes it.
+static void editorSwapClient(Client *c) {
+  std::swap(E.buf, c->buf);
+  std::swap(E.view, c->view);
+  std::swap(E.screen, c->screen);
+  std::swap(E.screenRows, c->screenRows);
+  std::swap(E.screenCols, c->screenCols);
+  std::swap(E.statusmsg, c->statusmsg);
+  std::swap(E.statusmsg_time, c->statusmsg_time);
+  std::swap(E.search, c->search);
+  for (auto &[buf, view] : c->views)
+    std::swap(buf->savedView, view);
+}
+
+// Other clients may have shortened or dropped the rows the view of the one
+// being served was on.
+static void editorClampView() {
+  View &view = E.view;
+  view.cursorY = std::min(view.cursorY, E.buf->numRows);
+  editorClampCursor();
+  for (Cursor const &cursor : view.cursors) {
+    if (cursor.y >= E.buf->numRows ||
+        cursor.x > E.buf->row[cursor.y].size) {
+      editorClearCursors();
+      break;
+    }
+  }
+  if (view.selecting && view.anchor.y > E.buf->numRows)
+    view.selecting = false;
+}
+
+// Makes `c` the client whose keys are read and whose frames are drawn, or
+// none.
+static void editorServe(Server *s, Client *c) {
+  if (s->current == c)
+    return;
+  if (s->current)
+    editorSwapClient(s->current);
+  s->current = c;
+  if (c == nullptr)
+    return;
+  for (Buffer *buf : E.buffers) {
+    auto known = [buf](auto const &entry) { return entry.first == buf; };
+    if (std::none_of(c->views.begin(), c->views.end(), known))
+      c->views.push_back({buf, buf->savedView});
+  }
+  editorSwapClient(c);
+  E.inputFd = c->input;
+  E.outputFd = c->output;
+  editorClampView();
+}
+
+// Sizes the text area to the served client's window.
+static void editorClientWindowSize() {
+  struct winsize ws;
+  if (ioctl(E.outputFd, TIOCGWINSZ, &ws) == 0 && ws.ws_col != 0) {
+    E.screenRows = ws.ws_row - (E.hud.shown ? 3 : 2);
+    E.screenCols = ws.ws_col;
+  }
+}
+
+// Opens the terminal `fd` again for output that doesn't block. Setting
+// O_NONBLOCK on `fd` itself would set it for the client's shell too, which
+// shares the open file.
+static int editorOpenOutput(int fd) {
+  char const *name = ttyname(fd);
+  if (name == nullptr)
+    return -1;
+  return open(name, O_WRONLY | O_NOCTTY | O_NONBLOCK | O_CLOEXEC);
+}
+
+// Writes as much of what `c` has pending as its terminal takes now. A
+// terminal that fails is let go.
+static void editorFlushClient(Client *c) {
+  while (!c->pending.empty()) {
+    ssize_t n = write(c->output, c->pending.data(), c->pending.size());
+    if (n > 0) {
+      c->pending.erase(0, n);
+    } else if (n == -1 && errno != EINTR) {
+      if (errno != EAGAIN)
+        c->detached = true;
+      return;
+    }
+  }
+}
+
+static void editorQueueOutput(Client *c, char const *data, size_t length) {
+  c->pending.append(data, length);
+  editorFlushClient(c);
+}
+
+void editorClientWrite(char const *data, size_t length) {
+  editorQueueOutput(E.server->current, data, length);
+}
+
+// Whether the served client's terminal hasn't taken all of the last frame
+// yet, so the next is to wait until it has.
+bool editorClientBacklogged() {
+  Client *c = E.server->current;
+  if (c->pending.empty())
+    return false;
+  c->stale = true;
+  return true;
+}
+
+// Gives `c` the turn until its thread waits for another key, or is done.
+static void editorResume(Server *s, Client *c) {
+  editorServe(s, c);
+  std::unique_lock<std::mutex> guard(s->lock);
+  c->turn = true;
+  s->turns.notify_all();
+  s->turns.wait(guard, [c] { return !c->turn; });
+}
+
+// Hands the turn from the thread of `c` back to the server's, until it is
+// given back.
+static void editorYield(Server *s, Client *c) {
+  std::unique_lock<std::mutex> guard(s->lock);
+  c->turn = false;
+  s->turns.notify_all();
+  s->turns.wait(guard, [c] { return c->turn; });
+}
+
+static void editorHandleKeys(Server *s, Client *c) {
+  {
+    std::unique_lock<std::mutex> guard(s->lock);
+    s->turns.wait(guard, [c] { return c->turn; });
+  }
+  while (!c->detached)
+    editorProcessKeypress();
+  std::lock_guard<std::mutex> guard(s->lock);
+  c->finished = true;
+  c->turn = false;
+  s->turns.notify_all();
+}
+
+// Waits for a key from the served client, on its thread: the turn goes back
+// to the server until the client's terminal has one. Returns false if the
+// client went away instead, which backs it out of whatever it was at.
+bool editorClientWaitKey() {
+  Server *s = E.server;
+  Client *c = s->current;
+  while (!editorClientGone()) {
+    pollfd fd = {c->input, POLLIN, 0};
+    if (poll(&fd, 1, 0) > 0)
+      return true;
+    editorYield(s, c);
+  }
+  return false;
+}
+
+static void editorDropClient(Server *s, Client *c) {
+  // Its thread sees it detached at its next key, and backs out.
+  c->detached = true;
+  if (c->keys.joinable()) {
+    while (!c->finished)
+      editorResume(s, c);
+    c->keys.join();
+  }
+  if (s->current == c)
+    editorServe(s, nullptr);
+  if (c->output != -1) {
+    editorFlushClient(c);
+    if (c->pending.empty()) {
+      write(c->output, ClearScreen, 4);
+      write(c->output, MoveCursorHome, 3);
+    }
+    close(c->output);
+  }
+  if (c->input != -1)
+    close(c->input);
+  close(c->socket);
+  s->clients.erase(std::find(s->clients.begin(), s->clients.end(), c));
+  delete c;
+}
+
+static void editorAccept(Server *s) {
+  int fd = accept4(s->listener, nullptr, nullptr, SOCK_CLOEXEC);
+  if (fd == -1)
+    return;
+  // The client hands over its terminal, so only its own user may attach.
+  struct ucred peer;
+  socklen_t length = sizeof(peer);
+  if (getsockopt(fd, SOL_SOCKET, SO_PEERCRED, &peer, &length) != 0 ||
+      peer.uid != geteuid()) {
+    close(fd);
+    return;
+  }
+  auto *c = new Client;
+  c->socket = fd;
+  s->clients.push_back(c);
+}
+
+// Takes the hello of `c`, then shows it the files it named, opening those
+// that aren't resident yet. Returns false if the hello was malformed.
+static bool editorGreet(Server *s, Client *c) {
+  std::vector<char> hello(HelloBytes);
+  char control[CMSG_SPACE(2 * sizeof(int))];
+  iovec part = {hello.data(), hello.size()};
+  msghdr message{};
+  message.msg_iov = &part;
+  message.msg_iovlen = 1;
+  message.msg_control = control;
+  message.msg_controllen = sizeof(control);
+  ssize_t n = recvmsg(c->socket, &message, MSG_CMSG_CLOEXEC);
+
+  int fds[2] = {-1, -1};
+  cmsghdr *header = n > 0 ? CMSG_FIRSTHDR(&message) : nullptr;
+  if (header && header->cmsg_level == SOL_SOCKET &&
+      header->cmsg_type == SCM_RIGHTS &&
+      header->cmsg_len == CMSG_LEN(sizeof(fds)))
+    memcpy(fds, CMSG_DATA(header), sizeof(fds));
+  int output = -1;
+  if (n > 0 && !(message.msg_flags & (MSG_TRUNC | MSG_CTRUNC)) &&
+      fds[0] != -1 && hello[n - 1] == '\0')
+    output = editorOpenOutput(fds[1]);
+  if (fds[1] != -1)
+    close(fds[1]);
+  if (output == -1) {
+    if (fds[0] != -1)
+      close(fds[0]);
+    return false;
+  }
+
+  // Served from what the server had, in a window of the client's size.
+  editorServe(s, nullptr);
+  c->input = fds[0];
+  c->output = output;
+  c->buf = E.buf;
+  editorServe(s, c);
+  editorClientWindowSize();
+  editorQueueOutput(c, ClearScreen, 4);
+
+  char const *cwd = hello.data();
+  char const *end = hello.data() + n;
+  Buffer *first = nullptr;
+  for (char const *name = cwd + strlen(cwd) + 1; name < end;
+       name += strlen(name) + 1) {
+    std::string path = name[0] == '/' ? name : std::string(cwd) + "/" + name;
+    Buffer *buf = editorOpen(path.c_str());
+    if (buf == nullptr)
+      editorSetStatusMessage("Can't open %s: %s", name, strerror(errno));
+    else if (first == nullptr)
+      first = buf;
+  }
+  if (first)
+    editorSwitchBuffer(first);
+  c->keys = std::thread(editorHandleKeys, s, c);
+  return true;
+}
+
+bool editorServerInputPending() {
+  Server *s = E.server;
+  std::vector<pollfd> fds = {{s->listener, POLLIN, 0}};
+  for (Client *c : s->clients)
+    fds.push_back({c->input != -1 ? c->input : c->socket, POLLIN, 0});
+  return poll(fds.data(), fds.size(), 0) > 0;
+}
+
+// Whether the served client's terminal or connection went away, in which
+// case it is dropped once its key is handled.
+bool editorClientGone() {
+  Client *c = E.server->current;
+  pollfd fds[2] = {{c->socket, 0, 0}, {c->input, 0, 0}};
+  poll(fds, 2, 0);
+  if ((fds[0].revents | fds[1].revents) & (POLLHUP | POLLERR | POLLNVAL))
+    c->detached = true;
+  return c->detached;
+}
+
+void editorDetachClient() { E.server->current->detached = true; }
+
+// Points clients that showed `buf`, just closed, at another buffer.
+void editorServerForgetBuffer(Buffer *buf) {
+  for (Client *c : E.server->clients) {
+    if (c->buf == buf) {
+      c->buf = E.buffers.front();
+      c->view = View{};
+      c->screen = Screen{};
+    }
+    auto shown = [buf](auto const &entry) { return entry.first == buf; };
+    c->views.erase(std::remove_if(c->views.begin(), c->views.end(), shown),
+                   c->views.end());
+  }
+}
+
+static void editorRefreshClients(Server *s) {
+  TRACE_SCOPE("editorRefreshClients");
+  for (Client *c : s->clients) {
+    if (c->input == -1 || c->detached)
+      continue;
+    editorServe(s, c);
+    editorClientWindowSize();
+    c->stale = false;
+    editorRefreshScreen();
+  }
+}
+
+// Keeps the buffers resident between clients: each client that attaches
+// shows its files from here, opening only those not open already, and sees
+// the changes every other client makes. Keys are taken one at a time, each
+// on the thread of the client it came from; one at a prompt waits there for
+// its next key while the others go on. A client whose terminal is slow to
+// take its frames is skipped until it has.
+int editorRunServer(char const *path) {
+  int listener = editorListen(path);
+  if (listener == -1) {
+    fprintf(stderr, "%s: %s\n", path,
+            errno == EADDRINUSE ? "a server is already running there"
+                                : strerror(errno));
+    return 1;
+  }
+  // Writes to a terminal that closed fail instead.
+  signal(SIGPIPE, SIG_IGN);
+
+  Server server;
+  server.listener = listener;
+  E.server = &server;
+  while (true) {
+    std::vector<Client *> clients = server.clients;
+    std::vector<pollfd> fds = {{listener, POLLIN, 0}};
+    for (Client *c : clients) {
+      fds.push_back({c->socket, POLLIN, 0});
+      fds.push_back({c->input, POLLIN, 0});
+      fds.push_back({c->pending.empty() ? -1 : c->output, POLLOUT, 0});
+    }
+    int ready = poll(fds.data(), fds.size(), ServerTickMillis);
+    if (ready == -1 && errno != EINTR)
+      die("poll");
+
+    bool redraw = false;
+    if (ready > 0 && (fds[0].revents & POLLIN))
+      editorAccept(&server);
+    for (size_t j = 0; ready > 0 && j < clients.size(); ++j) {
+      Client *c = clients[j];
+      short connection = fds[1 + 3 * j].revents;
+      short terminal = fds[2 + 3 * j].revents;
+      short output = fds[3 + 3 * j].revents;
+      if (connection & POLLIN) {
+        char resized;
+        if (c->input == -1) {
+          c->detached = !editorGreet(&server, c);
+          redraw = true;
+          continue;
+        }
+        if (recv(c->socket, &resized, 1, MSG_DONTWAIT) <= 0) {
+          c->detached = true;
+        } else {
+          editorServe(&server, c);
+          editorInvalidateScreen();
+          editorQueueOutput(c, ClearScreen, 4);
+          redraw = true;
+        }
+      }
+      if ((connection | terminal | output) & (POLLHUP | POLLERR | POLLNVAL))
+        c->detached = true;
+      if (output & POLLOUT) {
+        editorFlushClient(c);
+        if (c->pending.empty() && c->stale)
+          redraw = true;
+      }
+      if (!c->detached && (terminal & POLLIN)) {
+        editorServe(&server, c);
+        editorClientWindowSize();
+        editorResume(&server, c);
+        redraw = true;
+      }
+    }
+    for (Client *c : clients)
+      if (c->detached)
+        editorDropClient(&server, c);
+
+    // Progress shows on the status bar of any client, not just the served
+    // one, while files load.
+    if (ready == 0) {
+      bool loading = editorAnyBufferLoading();
+      if (editorRunIdleWork() || loading)
+        redraw = true;
+    }
+    if (redraw)
+      editorRefreshClients(&server);
+  }
+}
+
+static volatile sig_atomic_t Resized = 0;
+
+static void editorNoteResize(int) { Resized = 1; }
+
+// Hands this terminal to the server at `path` to show `files` in, and waits
+// until the server lets it go.
+int editorRunClient(char const *path, std::vector<std::string> const &files) {
+  if (!isatty(STDIN_FILENO) || !isatty(STDOUT_FILENO)) {
+    fprintf(stderr, "--client needs a terminal\n");
+    return 1;
+  }
+  int fd = editorConnect(path);
+  if (fd == -1) {
+    fprintf(stderr, "%s: %s; is `kilo --server` running?\n", path,
+            strerror(errno));
+    return 1;
+  }
+
+  char cwd[PATH_MAX];
+  if (getcwd(cwd, sizeof(cwd)) == nullptr) {
+    perror("getcwd");
+    return 1;
+  }
+  std::string hello = cwd;
+  hello += '\0';
+  for (auto const &file : files) {
+    hello += file;
+    hello += '\0';
+  }
+  if (hello.size() > HelloBytes) {
+    fprintf(stderr, "too many files for one client\n");
+    return 1;
+  }
+
+  enableRawMode();
+  int terminal[2] = {STDIN_FILENO, STDOUT_FILENO};
+  char control[CMSG_SPACE(sizeof(terminal))] = {};
+  iovec part = {hello.data(), hello.size()};
+  msghdr message{};
+  message.msg_iov = &part;
+  message.msg_iovlen = 1;
+  message.msg_control = control;
+  message.msg_controllen = sizeof(control);
+  cmsghdr *header = CMSG_FIRSTHDR(&message);
+  header->cmsg_level = SOL_SOCKET;
+  header->cmsg_type = SCM_RIGHTS;
+  header->cmsg_len = CMSG_LEN(sizeof(terminal));
+  memcpy(CMSG_DATA(header), terminal, sizeof(terminal));
+  if (sendmsg(fd, &message, MSG_NOSIGNAL) == -1)
+    die("sendmsg");
+
+  // Without SA_RESTART, a resize interrupts the wait below to be passed on.
+  struct sigaction action{};
+  action.sa_handler = editorNoteResize;
+  sigaction(SIGWINCH, &action, nullptr);
+  while (true) {
+    char c;
+    ssize_t n = read(fd, &c, 1);
+    if (n == -1 && errno == EINTR) {
+      if (Resized) {
+        Resized = 0;
+        send(fd, "r", 1, MSG_NOSIGNAL);
+      }
+      continue;
+    }
+    if (n <= 0)
+      break;
+  }
+  close(fd);
+  return 0;
+}
@@ -0,0 +1,332 @@
+#include <Editor.hpp>
+
+#include <errno.h>
+#include <fcntl.h>
+#include <limits.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+#include <unistd.h>
+#include <zlib.h>
+
+#include <algorithm>
+#include <string>
+#include <vector>
+
+#include <Trace.hpp>
+
+// Bumped whenever the layout below changes; older sessions are ignored.
+uint32_t const SessionFormat = 2;
+char const SessionMagic[8] = {'k', 'i', 'l', 'o', 's', 'e', 's', 's'};
+
+// Sessions are written through a stdio buffer of this size.
+size_t const SessionWriteChunk = 256 * 1024;
+
+// A session file is this header, then `numRows` line lengths, then
+// `numStates` highlight checkpoints, then NUL-terminated strings: the file's
+// path, its syntax's filetype, and the search history, oldest first. Every
+// part is read in place from a mapping of the file.
+struct SessionHeader {
+  char magic[8];
+  uint32_t format;
+  // CRC-32 of the file's contents.
+  uint32_t hash;
+  uint64_t size;
+  int64_t mtimeNs;
+  uint32_t numRows;
+  // Rows whose comment states the checkpoints give; rows after were not
+  // highlighted yet when the session was written.
+  uint32_t highlightedRows;
+  uint32_t numStates;
+  // CRC-32 of the line lengths and checkpoints, which are trusted to cut and
+  // highlight the file while it loads and only checked once it has.
+  uint32_t bodyHash;
+  uint32_t numQueries;
+  uint32_t stringBytes;
+  int32_t cursorX;
+  int32_t cursorY;
+  int32_t rowOffset;
+  int32_t colOffset;
+};
+
+// The comment state `row` ends in. Only rows ending in a different state
+// than the row before them get one.
+struct SessionState {
+  uint32_t row;
+  int32_t state;
+};
+
+// A session file mapped for reopening its file.
+struct Session {
+  void *map;
+  size_t mapSize;
+  SessionHeader const *header;
+  uint32_t const *lengths;
+  SessionState const *states;
+  char const *filetype;
+  // Whether the checkpoints are for the buffer's syntax.
+  bool statesUsable;
+  // The next checkpoint for rows yet to arrive, and the state they start in.
+  uint32_t nextState;
+  int state;
+  // Set until the saved view is restored, or the cursor moved first.
+  bool viewPending;
+};
+
+// CRC-32 of `len` bytes at `data`, continuing from `hash`.
+static uLong editorCrc32(uLong hash, void const *data, size_t len) {
+  auto const *bytes = static_cast<Bytef const *>(data);
+  // crc32() takes at most 4 GiB at a time.
+  for (size_t done = 0; done < len;) {
+    uInt n = std::min<size_t>(len - done, UINT_MAX);
+    hash = crc32(hash, bytes + done, n);
+    done += n;
+  }
+  return hash;
+}
+
+int64_t editorMtimeNs(struct stat const &st) {
+  return static_cast<int64_t>(st.st_mtim.tv_sec) * 1000000000 +
+         st.st_mtim.tv_nsec;
+}
+
+// Where the session for `filename` is kept: a file in the session directory
+// named for a hash of the file's absolute path.
+static std::string editorSessionPath(char const *filename,
+                                     std::string *absolute) {
+  char resolved[PATH_MAX];
+  if (E.sessionDir.empty() || realpath(filename, resolved) == nullptr)
+    return "";
+  *absolute = resolved;
+  // FNV-1a, which stays the same from one build to the next.
+  uint64_t hash = 0xcbf29ce484222325;
+  for (char const *c = resolved; *c; ++c)
+    hash = (hash ^ static_cast<unsigned char>(*c)) * 0x100000001b3;
+  char name[32];
+  snprintf(name, sizeof(name), "/%016llx.session",
+           static_cast<unsigned long long>(hash));
+  return E.sessionDir + name;
+}
+
+Session *editorOpenSession(char const *filename, struct stat const &st,
+                           EditorSyntax const *syntax) {
+  TRACE_SCOPE("editorOpenSession");
+  std::string absolute;
+  std::string path = editorSessionPath(filename, &absolute);
+  if (path.empty())
+    return nullptr;
+  int fd = open(path.c_str(), O_RDONLY | O_CLOEXEC);
+  if (fd == -1)
+    return nullptr;
+  struct stat sst;
+  void *map = MAP_FAILED;
+  if (fstat(fd, &sst) == 0 &&
+      static_cast<size_t>(sst.st_size) >= sizeof(SessionHeader))
+    map = mmap(nullptr, sst.st_size, PROT_READ, MAP_PRIVATE, fd, 0);
+  close(fd);
+  if (map == MAP_FAILED)
+    return nullptr;
+
+  auto *s = new Session{};
+  s->map = map;
+  s->mapSize = sst.st_size;
+  s->header = static_cast<SessionHeader const *>(map);
+  SessionHeader const *h = s->header;
+  uint64_t stringsAt = sizeof(SessionHeader) + sizeof(uint32_t) * h->numRows +
+                       sizeof(SessionState) * uint64_t(h->numStates);
+  // A session for a file of another size or time, or one cut short, is of
+  // no use; neither is one whose name it only shares by a hash collision.
+  char const *strings = static_cast<char const *>(map) + stringsAt;
+  if (memcmp(h->magic, SessionMagic, sizeof(SessionMagic)) != 0 ||
+      h->format != SessionFormat || h->numRows == 0 ||
+      h->size != static_cast<uint64_t>(st.st_size) ||
+      h->mtimeNs != editorMtimeNs(st) ||
+      stringsAt + h->stringBytes != s->mapSize || h->stringBytes == 0 ||
+      strings[h->stringBytes - 1] != '\0' || absolute != strings) {
+    editorCloseSession(s);
+    return nullptr;
+  }
+  s->lengths = reinterpret_cast<uint32_t const *>(h + 1);
+  s->states = reinterpret_cast<SessionState const *>(s->lengths + h->numRows);
+  s->filetype = strings + absolute.size() + 1;
+  s->statesUsable = syntax && strcmp(s->filetype, syntax->filetype) == 0;
+  s->viewPending = true;
+
+  // The history is merged into what this run searched for already.
+  char const *end = strings + h->stringBytes;
+  char const *query = s->filetype + strlen(s->filetype) + 1;
+  for (uint32_t j = 0; j < h->numQueries && query < end; ++j) {
+    editorAddSearchHistory(query);
+    query += strlen(query) + 1;
+  }
+  return s;
+}
+
+void editorCloseSession(Session *session) {
+  if (session == nullptr)
+    return;
+  munmap(session->map, session->mapSize);
+  delete session;
+}
+
+uint32_t editorSessionRows(Session const *session) {
+  return session->header->numRows;
+}
+
+uint32_t editorSessionLength(Session const *session, uint32_t row) {
+  return session->lengths[row];
+}
+
+// Restores the saved view once the rows it shows are in, unless the cursor
+// was moved before they were.
+static void editorRestoreView(Buffer *buf, Session *s) {
+  View &view = buf == E.buf ? E.view : buf->savedView;
+  SessionHeader const *h = s->header;
+  if (view.cursorX != 0 || view.cursorY != 0 || view.rowOffset != 0 ||
+      view.colOffset != 0) {
+    s->viewPending = false;
+    return;
+  }
+  int shown = std::min<int64_t>(int64_t(h->rowOffset) + E.screenRows,
+                                h->numRows);
+  if (buf->numRows < std::max(shown, h->cursorY + 1) && buf->loader &&
+      buf->numRows < static_cast<int>(h->numRows))
+    return;
+  view.cursorY = std::clamp(h->cursorY, 0, buf->numRows);
+  view.cursorX = view.cursorY < buf->numRows
+                     ? std::clamp(h->cursorX, 0, buf->row[view.cursorY].size)
+                     : 0;
+  view.rowOffset = std::clamp(h->rowOffset, 0, view.cursorY);
+  view.colOffset = std::max(h->colOffset, 0);
+  s->viewPending = false;
+}
+
+int editorSessionRowsLoaded(Buffer *buf, int first, int last) {
+  Session *s = buf->session;
+  int known = first;
+  if (s->statesUsable) {
+    SessionHeader const *h = s->header;
+    known = std::clamp<int64_t>(h->highlightedRows, first, last);
+    for (int y = first; y < known; ++y) {
+      while (s->nextState < h->numStates &&
+             s->states[s->nextState].row <= static_cast<uint32_t>(y))
+        s->state = s->states[s->nextState++].state;
+      Row *row = &buf->row[y];
+      row->hl_open_comment = s->state;
+      row->lazy = true;
+    }
+  }
+  if (s->viewPending)
+    editorRestoreView(buf, s);
+  return known;
+}
+
+bool editorSessionLoaded(Buffer *buf, uint32_t hash) {
+  Session *s = buf->session;
+  buf->session = nullptr;
+  // States saved for other contents, or garbled since, may be wrong
+  // anywhere, so everything is highlighted afresh.
+  SessionHeader const *h = s->header;
+  uLong body = editorCrc32(crc32(0, nullptr, 0), s->lengths,
+                           sizeof(uint32_t) * uint64_t(h->numRows) +
+                               sizeof(SessionState) * uint64_t(h->numStates));
+  bool fits = hash == h->hash && body == h->bodyHash;
+  if (!fits && s->statesUsable && buf->syntax) {
+    buf->highlightFrom = 0;
+    for (int y = 0; y < buf->numRows; ++y)
+      buf->row[y].lazy = false;
+  }
+  if (s->viewPending)
+    editorRestoreView(buf, s);
+  editorCloseSession(s);
+  return fits;
+}
+
+// Writes the session for `buf`, which must match its file, to `path` by way
+// of a temporary file, so a reader never sees half of one.
+static bool editorWriteSession(Buffer const *buf, std::string const &path,
+                               std::string const &absolute) {
+  View const &view = buf == E.buf ? E.view : buf->savedView;
+  SessionHeader h{};
+  memcpy(h.magic, SessionMagic, sizeof(SessionMagic));
+  h.format = SessionFormat;
+  h.hash = buf->stamp.hash;
+  h.size = buf->stamp.size;
+  h.mtimeNs = buf->stamp.mtimeNs;
+  h.numRows = buf->numRows;
+  h.highlightedRows = buf->highlightFrom == -1 ? buf->numRows
+                                               : buf->highlightFrom;
+  h.cursorX = view.cursorX;
+  h.cursorY = view.cursorY;
+  h.rowOffset = view.rowOffset;
+  h.colOffset = view.colOffset;
+
+  std::vector<SessionState> states;
+  int state = 0;
+  for (uint32_t y = 0; y < h.highlightedRows; ++y) {
+    if (buf->row[y].hl_open_comment != state) {
+      state = buf->row[y].hl_open_comment;
+      states.push_back({y, state});
+    }
+  }
+  h.numStates = states.size();
+
+  std::string strings = absolute;
+  strings += '\0';
+  strings += buf->syntax ? buf->syntax->filetype : "";
+  strings += '\0';
+  for (auto const &query : editorSearchHistory()) {
+    strings += query;
+    strings += '\0';
+    ++h.numQueries;
+  }
+  h.stringBytes = strings.size();
+
+  std::string temporary = path + ".tmp";
+  FILE *out = fopen(temporary.c_str(), "w");
+  if (out == nullptr)
+    return false;
+  std::vector<char> buffer(SessionWriteChunk);
+  setvbuf(out, buffer.data(), _IOFBF, buffer.size());
+  // The header goes in again once the hash of what follows it is known.
+  fwrite(&h, sizeof(h), 1, out);
+  uLong body = crc32(0, nullptr, 0);
+  uint32_t lengths[1024];
+  for (int y = 0; y < buf->numRows;) {
+    int n = std::min<int>(buf->numRows - y, std::size(lengths));
+    for (int j = 0; j < n; ++j)
+      lengths[j] = buf->row[y + j].size;
+    body = editorCrc32(body, lengths, sizeof(uint32_t) * n);
+    fwrite(lengths, sizeof(uint32_t), n, out);
+    y += n;
+  }
+  body = editorCrc32(body, states.data(), sizeof(SessionState) * states.size());
+  fwrite(states.data(), sizeof(SessionState), states.size(), out);
+  fwrite(strings.data(), 1, strings.size(), out);
+  h.bodyHash = body;
+  fseek(out, 0, SEEK_SET);
+  fwrite(&h, sizeof(h), 1, out);
+  bool ok = !ferror(out);
+  ok = fclose(out) == 0 && ok;
+  if (ok && rename(temporary.c_str(), path.c_str()) == 0)
+    return true;
+  unlink(temporary.c_str());
+  return false;
+}
+
+void editorSaveSession(Buffer const *buf) {
+  // Only a buffer that still matches its file, as last read or written in
+  // full, has line lengths and states worth keeping.
+  if (E.sessionDir.empty() || buf->filename == nullptr || buf->gzip ||
+      buf->loader || !buf->stamp.valid || buf->stamp.version != buf->version)
+    return;
+  TRACE_SCOPE("editorSaveSession");
+  std::string absolute;
+  std::string path = editorSessionPath(buf->filename, &absolute);
+  if (path.empty())
+    return;
+  mkdir(E.sessionDir.c_str(), 0700);
+  editorWriteSession(buf, path, absolute);
+}
@@ -0,0 +1,429 @@
+#include <Editor.hpp>
+
+#include <ctype.h>
+#include <dirent.h>
+#include <errno.h>
+#include <stdio.h>
+#include <string.h>
+
+#include <algorithm>
+#include <array>
+#include <iterator>
+#include <memory>
+#include <string_view>
+#include <utility>
+
+#include <Lexer.hpp>
+#include <Trace.hpp>
+
+// A built-in language, described in constants so that highlightRow is
+// compiled once per language with its delimiters, flags and keywords folded
+// in rather than looked up for every byte.
+struct CLanguage {
+  static constexpr std::string_view LineComment = "//";
+  static constexpr std::string_view BlockCommentStart = "/*";
+  static constexpr std::string_view BlockCommentEnd = "*/";
+  static constexpr int Flags = HL_HIGHLIGHT_NUMBERS | HL_HIGHLIGHT_STRINGS;
+  static constexpr std::string_view Keywords[] = {
+      "switch", "if",     "while", "for",     "break",  "continue",
+      "return", "else",   "struct", "union",  "typedef", "static",
+      "enum",   "class",  "case"};
+  static constexpr std::string_view Types[] = {
+      "int", "long", "double", "float", "char", "unsigned", "signed", "void"};
+};
+
+// Bytes that end a word: whitespace, NUL and some operators.
+static constexpr std::array<bool, 256> Separators = [] {
+  std::array<bool, 256> separators{};
+  for (unsigned char c : std::string_view(" \t\n\v\f\r,.()+-/*=~%<>[];"))
+    separators[c] = true;
+  separators[0] = true;
+  return separators;
+}();
+
+// Bytes that some keyword or type of `Language` starts with.
+template <typename Language>
+static constexpr std::array<bool, 256> WordStarts = [] {
+  std::array<bool, 256> starts{};
+  for (auto word : Language::Keywords)
+    starts[static_cast<unsigned char>(word[0])] = true;
+  for (auto word : Language::Types)
+    starts[static_cast<unsigned char>(word[0])] = true;
+  return starts;
+}();
+
+static bool startsWith(char const *text, int length, std::string_view prefix) {
+  return static_cast<size_t>(length) >= prefix.size() &&
+         memcmp(text, prefix.data(), prefix.size()) == 0;
+}
+
+// Length of `word` if `text` starts with it as a whole word, else 0.
+static int matchWord(char const *text, int length, std::string_view word) {
+  if (!startsWith(text, length, word))
+    return 0;
+  if (word.size() < static_cast<size_t>(length) &&
+      !Separators[static_cast<unsigned char>(text[word.size()])])
+    return 0;
+  return word.size();
+}
+
+// Tries every word of `words` at `text`, unrolled so each comparison is
+// against a constant string of constant length.
+template <auto const &words, size_t... I>
+static int matchWords(char const *text, int length,
+                      std::index_sequence<I...>) {
+  int matched = 0;
+  ((matched = matchWord(text, length, words[I])) || ...);
+  return matched;
+}
+
+// Set in a string state when the piece before ended on the escape character.
+static int const StringEscaped = 0x200;
+
+template <typename Language>
+static int highlightRow(EditorSyntax const *, Row *row, int state) {
+  constexpr std::string_view scs = Language::LineComment;
+  constexpr std::string_view mcs = Language::BlockCommentStart;
+  constexpr std::string_view mce = Language::BlockCommentEnd;
+  constexpr auto keywords = std::make_index_sequence<
+      std::size(Language::Keywords)>();
+  constexpr auto types = std::make_index_sequence<std::size(Language::Types)>();
+
+  char const *render = row->render;
+  unsigned char *hl = row->hl;
+  int size = row->rsize;
+  memset(hl, Highlight::Normal, size);
+
+  int prev_sep = 1;
+  int in_comment = state == Lexer::InBlockComment;
+  int in_string = state >= Lexer::InString ? state & 0xff : 0;
+  bool escaped = state & StringEscaped;
+
+  int i = 0;
+  if (escaped && size > 0) {
+    hl[0] = Highlight::String;
+    escaped = false;
+    i = 1;
+  }
+  while (i < size) {
+    char c = render[i];
+    unsigned char prev_hl =
+        (i > 0) ? hl[i - 1] : static_cast<unsigned char>(Highlight::Normal);
+
+    if constexpr (!scs.empty()) {
+      if (!in_string && !in_comment && startsWith(&render[i], size - i, scs)) {
+        memset(&hl[i], Highlight::Comment, size - i);
+        break;
+      }
+    }
+
+    if constexpr (!mcs.empty() && !mce.empty()) {
+      if (!in_string) {
+        if (in_comment) {
+          hl[i] = Highlight::MultiLineComment;
+          if (startsWith(&render[i], size - i, mce)) {
+            memset(&hl[i], Highlight::MultiLineComment, mce.size());
+            i += mce.size();
+            in_comment = 0;
+            prev_sep = 1;
+          } else {
+            ++i;
+          }
+          continue;
+        } else if (startsWith(&render[i], size - i, mcs)) {
+          memset(&hl[i], Highlight::MultiLineComment, mcs.size());
+          i += mcs.size();
+          in_comment = 1;
+          continue;
+        }
+      }
+    }
+
+    if constexpr ((Language::Flags & HL_HIGHLIGHT_STRINGS) != 0) {
+      if (in_string) {
+        hl[i] = Highlight::String;
+        if (c == '\\') {
+          if (i + 1 < size)
+            hl[i + 1] = Highlight::String;
+          else
+            escaped = true;
+          i += 2;
+          continue;
+        }
+        if (c == in_string)
+          in_string = 0;
+        ++i;
+        prev_sep = 1;
+        continue;
+      } else if (c == '"' || c == '\'') {
+        in_string = c;
+        hl[i] = Highlight::String;
+        ++i;
+        continue;
+      }
+    }
+
+    if constexpr ((Language::Flags & HL_HIGHLIGHT_NUMBERS) != 0) {
+      if ((isdigit(c) && (prev_sep || prev_hl == Highlight::Number)) ||
+          (c == '.' && prev_hl == Highlight::Number)) {
+        hl[i] = Highlight::Number;
+        ++i;
+        prev_sep = 0;
+        continue;
+      }
+    }
+
+    if (prev_sep && WordStarts<Language>[static_cast<unsigned char>(c)]) {
+      if (int length = matchWords<Language::Keywords>(&render[i], size - i,
+                                                      keywords)) {
+        memset(&hl[i], Highlight::Keyword2, length);
+        i += length;
+        prev_sep = 0;
+        continue;
+      }
+      if (int length =
+              matchWords<Language::Types>(&render[i], size - i, types)) {
+        memset(&hl[i], Highlight::Keyword1, length);
+        i += length;
+        prev_sep = 0;
+        continue;
+      }
+    }
+
+    prev_sep = Separators[static_cast<unsigned char>(c)];
+    ++i;
+  }
+  if (in_string)
+    return Lexer::InString | in_string | (escaped ? StringEscaped : 0);
+  return in_comment;
+}
+
+static int lexRow(EditorSyntax const *syntax, Row *row, int state) {
+  return syntax->lexer->ScanFrom(row->render, row->rsize, row->hl, state);
+}
+
+int const HLDB_ENTRIES = 1;
+char const *C_HL_extensions[] = {".c", ".h", ".cpp", nullptr};
+
+struct EditorSyntax HLDB[] = {
+    {"c", C_HL_extensions, highlightRow<CLanguage>, nullptr},
+};
+
+// A syntax read from a definition file, with the strings its EditorSyntax
+// points into.
+struct LoadedSyntax {
+  LexerSpec spec;
+  std::vector<char const *> filematch;
+  std::unique_ptr<Lexer> lexer;
+  EditorSyntax syntax;
+};
+
+// Newest first, so a definition loaded later wins. Replaced definitions are
+// kept, since buffers may still point at them.
+static std::vector<std::unique_ptr<LoadedSyntax>> LoadedSyntaxes;
+
+// Keywords draw like the built-in C keywords, and types like its `|` ones.
+static unsigned char const LexerHighlights[Lexer::NumTokens] = {
+    Highlight::Normal, Highlight::Comment,  Highlight::MultiLineComment,
+    Highlight::String, Highlight::Number,   Highlight::Keyword2,
+    Highlight::Keyword1,
+};
+
+// Highlights one row from the comment state of the row above it. Returns
+// true if the row now ends in a different state, so the next row is stale.
+static bool editorHighlightRow(Buffer *buf, Row *row) {
+  row->lazy = false;
+  if (row->cold) {
+    // A cold row only keeps its comment state, so highlight a scratch copy
+    // to bring that up to date.
+    Row scratch{};
+    scratch.idx = row->idx;
+    scratch.size = row->size;
+    scratch.chars = const_cast<char *>(editorRowText(row));
+    scratch.hl_open_comment = row->hl_open_comment;
+    editorRenderRow(&scratch);
+    bool changed = editorHighlightRow(buf, &scratch);
+    row->hl_open_comment = scratch.hl_open_comment;
+    RowPool.Deallocate(scratch.render);
+    RowPool.Deallocate(scratch.hl);
+    RowPool.Deallocate(scratch.stops);
+    return changed;
+  }
+  if (row->chunks)
+    return editorHighlightChunks(buf, row, 0);
+
+  row->hl = static_cast<unsigned char *>(
+      RowPool.Reallocate(row->hl, row->rsize, HighlightMemory));
+
+  if (buf->syntax == nullptr ||
+      (buf->highlightFrom != -1 && row->idx >= buf->highlightFrom)) {
+    memset(row->hl, Highlight::Normal, row->rsize);
+    return false;
+  }
+
+  int in_comment = (row->idx > 0 && buf->row[row->idx - 1].hl_open_comment);
+  in_comment = buf->syntax->highlight(buf->syntax, row, in_comment) ==
+               Lexer::InBlockComment;
+
+  int changed = (row->hl_open_comment != in_comment);
+  row->hl_open_comment = in_comment;
+  return changed;
+}
+
+// Re-highlights the rows after `last` for as long as the comment state
+// keeps changing.
+void editorCascadeSyntax(Buffer *buf, int last) {
+  for (int y = last + 1; y < buf->numRows; ++y) {
+    if (buf->highlightFrom == -1 || y < buf->highlightFrom)
+      ++E.hud.cascadeRows;
+    if (!editorHighlightRow(buf, &buf->row[y]))
+      break;
+  }
+}
+
+void editorUpdateSyntax(Buffer *buf, Row *row) {
+  TRACE_SCOPE("editorUpdateSyntax");
+  if (editorHighlightRow(buf, row))
+    editorCascadeSyntax(buf, row->idx);
+}
+
+// Highlights rows `first` through `last` in one pass, cascading past `last`
+// only if its comment state changed.
+void editorUpdateSyntaxRange(Buffer *buf, int first, int last) {
+  TRACE_SCOPE("editorUpdateSyntaxRange");
+  bool changed = false;
+  for (int y = first; y <= last; ++y)
+    changed = editorHighlightRow(buf, &buf->row[y]);
+  if (changed)
+    editorCascadeSyntax(buf, last);
+}
+
+// Highlights up to `count` more rows of `buf` in order, continuing where the
+// worker left off. Returns true if rows are still left after that.
+bool editorHighlightSome(Buffer *buf, int count) {
+  if (buf->highlightFrom == -1)
+    return false;
+
+  int end = buf->highlightFrom + count;
+  if (end > buf->numRows)
+    end = buf->numRows;
+  while (buf->highlightFrom < end) {
+    Row *row = &buf->row[buf->highlightFrom++];
+    editorUpdateSyntax(buf, row);
+  }
+
+  if (buf->highlightFrom >= buf->numRows)
+    buf->highlightFrom = -1;
+  return buf->highlightFrom != -1;
+}
+
+void editorSelectSyntaxHighlight() {
+  E.buf->syntax = nullptr;
+  if (E.buf->filename == nullptr)
+    return;
+
+  // A compressed file is highlighted as what it holds.
+  std::string name = E.buf->filename;
+  if (editorHasGzipExtension(name.c_str()))
+    name.resize(name.size() - 3);
+  char const *ext = strchr(name.c_str(), '.');
+
+  for (unsigned int j = 0; j < LoadedSyntaxes.size() + HLDB_ENTRIES; ++j) {
+    struct EditorSyntax *s = j < LoadedSyntaxes.size()
+                                 ? &LoadedSyntaxes[j]->syntax
+                                 : &HLDB[j - LoadedSyntaxes.size()];
+    unsigned int i = 0;
+
+    while (s->filematch[i]) {
+      int is_ext = (s->filematch[i][0] == '.');
+      if ((is_ext && ext && !strcmp(ext, s->filematch[i])) ||
+          (!is_ext && strstr(name.c_str(), s->filematch[i]))) {
+        // Highlighting happens in the background, see editorRunIdleWork.
+        E.buf->syntax = s;
+        E.buf->highlightFrom = 0;
+        return;
+      }
+      ++i;
+    }
+  }
+}
+
+// Reads, parses and compiles one definition file.
+static std::unique_ptr<LoadedSyntax> editorLoadSyntax(char const *path,
+                                                      std::string &error) {
+  FILE *fp = fopen(path, "r");
+  if (!fp) {
+    error = strerror(errno);
+    return nullptr;
+  }
+  std::string text;
+  char chunk[4096];
+  size_t n;
+  while ((n = fread(chunk, 1, sizeof(chunk), fp)) > 0)
+    text.append(chunk, n);
+  fclose(fp);
+
+  auto loaded = std::make_unique<LoadedSyntax>();
+  if (!parseLexerSpec(text, loaded->spec, error))
+    return nullptr;
+  loaded->lexer = Lexer::Compile(loaded->spec, LexerHighlights, error);
+  if (!loaded->lexer)
+    return nullptr;
+
+  for (auto const &file : loaded->spec.files)
+    loaded->filematch.push_back(file.c_str());
+  loaded->filematch.push_back(nullptr);
+  loaded->syntax = EditorSyntax{loaded->spec.name.c_str(),
+                                loaded->filematch.data(), lexRow,
+                                loaded->lexer.get()};
+  return loaded;
+}
+
+int editorLoadSyntaxDir(char const *dir, std::string &errors) {
+  DIR *d = opendir(dir);
+  if (!d)
+    return 0;
+  std::vector<std::string> names;
+  while (struct dirent *entry = readdir(d)) {
+    std::string name = entry->d_name;
+    if (name.size() > 7 && name.compare(name.size() - 7, 7, ".syntax") == 0)
+      names.push_back(name);
+  }
+  closedir(d);
+  std::sort(names.begin(), names.end());
+
+  int loaded = 0;
+  for (auto const &name : names) {
+    std::string path = std::string(dir) + "/" + name;
+    std::string error;
+    auto syntax = editorLoadSyntax(path.c_str(), error);
+    if (!syntax) {
+      errors += path + ": " + error + "\n";
+      continue;
+    }
+    LoadedSyntaxes.insert(LoadedSyntaxes.begin(), std::move(syntax));
+    ++loaded;
+  }
+  return loaded;
+}
+
+int editorSyntaxToColor(int hl) {
+  switch (hl) {
+  case Highlight::Comment:
+    [[fallthrough]];
+  case Highlight::MultiLineComment:
+    return 36;
+  case Highlight::Number:
+    return 31;
+  case Highlight::String:
+    return 35;
+  case Highlight::Match:
+    return 34;
+  case Highlight::Keyword1:
+    return 33;
+  case Highlight::Keyword2:
+    return 32;
+  default:
+    return 37;
+  }
+}
@@ -0,0 +1,262 @@
+#include <Editor.hpp>
+
+#include <errno.h>
+#include <poll.h>
+#include <stdio.h>
+#include <sys/ioctl.h>
+#include <unistd.h>
+
+#include <Trace.hpp>
+
+// https://vt100.net/docs/vt100-ug/chapter3.html
+const char *ClearScreen = "\x1b[2J";
+const char *MoveCursorHome = "\x1b[H";
+char const *MakeCursorInvisible = "\x1b[?25l";
+char const *MakeCursorVisible = "\x1b[?25h";
+char const *PleaseReportActivePosition = "\x1b[6n";
+char const *ClearRow = "\x1b[K";
+std::string moveCursorUp(int n) { return "\x1b[" + std::to_string(n) + "A"; }
+std::string moveCursorDown(int n) { return "\x1b[" + std::to_string(n) + "B"; }
+std::string moveCursorRight(int n) { return "\x1b[" + std::to_string(n) + "C"; }
+std::string moveCursorLeft(int n) { return "\x1b[" + std::to_string(n) + "D"; }
+char const *DefaultForegroundColor = "\x1b[39m";
+std::string setColor_m(int n) { return "\x1b[" + std::to_string(n) + "m"; }
+char const *ResetColor = "\x1b[m";
+char const *ColorFormatString = "\x1b[%dm";
+char const *ReverseVideo = "\x1b[7m";
+char const *ReverseVideoOff = "\x1b[27m";
+char const *EraseLine = "\x1b[K";
+std::string setCursorPosition(int x, int y) {
+  return "\x1b[" + std::to_string(x) + ';' + std::to_string(y) + 'H';
+}
+// https://vt100.net/docs/vt510-rm/DECSTBM.html
+std::string setScrollRegion(int top, int bottom) {
+  return "\x1b[" + std::to_string(top) + ';' + std::to_string(bottom) + 'r';
+}
+char const *ResetScrollRegion = "\x1b[r";
+std::string scrollUp(int n) { return "\x1b[" + std::to_string(n) + "S"; }
+std::string scrollDown(int n) { return "\x1b[" + std::to_string(n) + "T"; }
+// Terminals hold the screen still between these so a frame never shows half
+// drawn; those that don't know the mode ignore it.
+// https://gist.github.com/christianparpart/d8a62cc1ab659194337d73e399004036
+char const *BeginSynchronizedUpdate = "\x1b[?2026h";
+char const *EndSynchronizedUpdate = "\x1b[?2026l";
+
+void die(const char *s) {
+  write(STDOUT_FILENO, ClearScreen, 4);
+  write(STDOUT_FILENO, MoveCursorHome, 3);
+
+  perror(s);
+  exit(1);
+}
+
+int editorReadKey() {
+  TRACE_SCOPE("editorReadKey");
+  int numberRead;
+  char c;
+  while (true) {
+    // A client of a server waits for its key in the server's poll loop,
+    // which serves the other clients and does the idle work meanwhile. One
+    // whose terminal went away backs out of any prompt it was in.
+    if (E.server && !editorClientWaitKey())
+      return '\x1b';
+    // While files load, the idle worker waits on them rather than read
+    // waiting out its timeout.
+    if (!E.server && editorAnyBufferLoading() && !editorInputPending())
+      numberRead = 0;
+    else
+      numberRead = read(E.inputFd, &c, 1);
+    if (numberRead == 1)
+      break;
+    if (numberRead == -1) {
+      if (errno == EAGAIN || errno == EINTR)
+        continue;
+      // A client's terminal failing only loses the server that client.
+      if (!E.server)
+        die("read");
+      editorDetachClient();
+      return '\x1b';
+    } else if (!E.server && editorRunIdleWork()) {
+      return Key::Idle;
+    }
+  }
+
+  if (E.hud.shown) {
+    E.hud.keyMicros = editorMicros();
+    E.hud.highlightMicros = 0;
+    E.hud.cascadeRows = 0;
+  }
+
+  if (c == '\x1b') {
+    char sequence[3];
+
+    if (read(E.inputFd, &sequence[0], 1) != 1)
+      return '\x1b';
+    if (read(E.inputFd, &sequence[1], 1) != 1)
+      return '\x1b';
+
+    if (sequence[0] == '[') {
+      if (sequence[1] >= '0' && sequence[1] <= '9') {
+        if (read(E.inputFd, &sequence[2], 1) != 1)
+          return '\x1b';
+        if (sequence[2] == '~') {
+          switch (sequence[1]) {
+          case '1':
+            return Key::Home;
+          case '3':
+            return Key::Delete;
+          case '4':
+            return Key::End;
+          case '5':
+            return Key::PageUp;
+          case '6':
+            return Key::PageDown;
+          case '7':
+            return Key::Home;
+          case '8':
+            return Key::End;
+          }
+        }
+      } else {
+        switch (sequence[1]) {
+        case 'A':
+          return Key::ArrowUp;
+        case 'B':
+          return Key::ArrowDown;
+        case 'C':
+          return Key::ArrowRight;
+        case 'D':
+          return Key::ArrowLeft;
+        case 'H':
+          return Key::Home;
+        case 'F':
+          return Key::End;
+        }
+      }
+    } else if (sequence[0] == '0') {
+      switch (sequence[1]) {
+      case 'H':
+        return Key::Home;
+      case 'F':
+        return Key::End;
+      }
+    }
+
+    return '\x1b';
+  } else {
+    return static_cast<unsigned char>(c);
+  }
+}
+
+int getCursorPosition(int *rows, int *cols) {
+  char buffer[32];
+
+  if (write(E.outputFd, PleaseReportActivePosition, 4) != 4)
+    return -1;
+
+  // We're expecting back \033[ Pn ; Pn R where the `Pn` are the vt100 manual's
+  // way of specifying a numerical parameter. This gives back the cursor
+  // position as a response to the above lines asking for
+  // `PleaseReportActivePosition`.
+  unsigned int i = 0;
+  while (i < sizeof(buffer) - 1) {
+    if (read(E.inputFd, &buffer[i], 1) != 1)
+      break;
+    if (buffer[i] == 'R')
+      break;
+    ++i;
+  }
+  buffer[i] = '\0';
+
+  if (buffer[0] != '\x1b' || buffer[1] != '[')
+    return -1;
+  if (sscanf(&buffer[2], "%d;%d", rows, cols) != 2)
+    return -1;
+
+  return 0;
+}
+
+int getWindowSize(int *rows, int *cols) {
+  struct winsize ws;
+
+  if (ioctl(E.outputFd, TIOCGWINSZ, &ws) == -1 || ws.ws_col == 0) {
+    auto move = moveCursorLeft(999) + moveCursorDown(999);
+    if (write(E.outputFd, move.c_str(), 12) != 12)
+      return -1;
+    return getCursorPosition(rows, cols);
+  } else {
+    *cols = ws.ws_col;
+    *rows = ws.ws_row;
+    return 0;
+  }
+}
+
+void editorUpdateWindowSize() {
+  if (getWindowSize(&E.screenRows, &E.screenCols) == -1)
+    die("getWindowSize");
+
+  // for the status line
+  E.screenRows -= E.hud.shown ? 3 : 2;
+}
+
+void disableRawMode() {
+  if (tcsetattr(STDIN_FILENO, TCSAFLUSH, &E.originalTermios) == -1)
+    die("tcsetattr");
+}
+
+void enableRawMode() {
+  if (tcgetattr(STDIN_FILENO, &E.originalTermios) == -1)
+    die("tcgetattr");
+
+  atexit(disableRawMode);
+
+  struct termios raw = E.originalTermios;
+
+  // --- IFLAGS ---
+  // This uses ctrl-s and ctrl-q to control input and output for old days
+  raw.c_iflag &= ~(IXON);
+  // This flag stops the terminal from  mapping CTRL-M to CTRL-J
+  raw.c_iflag &= ~(ICRNL);
+
+  // --- LFLAGS ---
+  // IEXTEN stops macOS terminal driver from getting rid of ctrl-o
+  raw.c_lflag &= ~(IEXTEN);
+  // Causes your input not to be echoed back
+  raw.c_lflag &= ~(ECHO);
+  // Causes input not to be buffered -- e.g. the char is sent right away
+  // without return being pressed
+  raw.c_lflag &= ~(ICANON);
+  // Disables signals being sent to the child processes
+  raw.c_lflag &= ~(ICANON | ISIG);
+
+  raw.c_iflag &= ~(BRKINT);
+  raw.c_iflag &= ~(INPCK);
+  raw.c_iflag &= ~(ISTRIP);
+
+  raw.c_cflag |= (CS8);
+
+  raw.c_cc[VMIN] = 0;
+  raw.c_cc[VTIME] = 1;
+
+  // --- OFLAGS ---
+  raw.c_oflag &= ~(OPOST);
+
+  if (tcsetattr(STDIN_FILENO, TCSAFLUSH, &raw) == -1)
+    die("tcsetattr");
+}
+
+// Writes output for the terminal, or for the served client's, which takes it
+// without holding up the server.
+void editorWriteOutput(char const *data, size_t length) {
+  if (E.server)
+    editorClientWrite(data, length);
+  else
+    write(E.outputFd, data, length);
+}
+
+bool editorInputPending() {
+  if (E.server)
+    return editorServerInputPending();
+  struct pollfd fd = {E.inputFd, POLLIN, 0};
+  return poll(&fd, 1, 0) > 0;
+}
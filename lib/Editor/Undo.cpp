@@ -0,0 +1,63 @@
+#include <Editor.hpp>
+
+// Each step holds a full copy of every row it touched, so only the last few
+// are kept.
+size_t const UndoDepth = 8;
+
+static void editorFreeUndoStep(UndoStep &step) {
+  for (auto &saved : step.rows)
+    RowPool.Deallocate(saved.chars);
+}
+
+void editorPushUndo(Buffer *buf, UndoStep &&step) {
+  if (step.rows.empty())
+    return;
+  if (buf->undo.size() == UndoDepth) {
+    editorFreeUndoStep(buf->undo.front());
+    buf->undo.erase(buf->undo.begin());
+  }
+  buf->undo.push_back(std::move(step));
+}
+
+void editorFreeUndo(Buffer *buf) {
+  for (auto &step : buf->undo)
+    editorFreeUndoStep(step);
+  buf->undo.clear();
+}
+
+void editorUndo() {
+  Buffer *buf = E.buf;
+  if (buf->undo.empty()) {
+    editorSetStatusMessage("Nothing to undo");
+    return;
+  }
+
+  // Rows are saved by index, which any other edit since may have shifted.
+  UndoStep &step = buf->undo.back();
+  if (step.after != buf->version) {
+    editorFreeUndo(buf);
+    editorSetStatusMessage("Can't undo: the buffer was edited since");
+    return;
+  }
+
+  for (auto &saved : step.rows) {
+    Row *row = &buf->row[saved.idx];
+    RowPool.Deallocate(row->chars);
+    editorDropCold(row);
+    editorDropChunks(row);
+    row->chars = saved.chars;
+    row->size = saved.size;
+    editorRenderRow(row);
+    buf->lineIndex.Set(row->idx, row->size + 1);
+    editorNoteWarm(buf, row->idx);
+  }
+  editorUpdateSyntaxRange(buf, step.rows.front().idx, step.rows.back().idx);
+
+  editorMarkChanged(buf);
+  buf->version = step.before;
+  int count = step.rows.size();
+  buf->undo.pop_back();
+
+  editorClampCursor();
+  editorSetStatusMessage("Undid a replace in %d rows", count);
+}
@@ -0,0 +1,371 @@
+#include <Lexer.hpp>
+
+#include <ctype.h>
+#include <string.h>
+
+#include <algorithm>
+#include <array>
+#include <map>
+
+bool parseLexerSpec(std::string const &text, LexerSpec &spec,
+                    std::string &error) {
+  spec = LexerSpec{};
+  size_t lineStart = 0;
+  for (int lineNumber = 1; lineStart < text.size(); ++lineNumber) {
+    size_t lineEnd = text.find('\n', lineStart);
+    if (lineEnd == std::string::npos)
+      lineEnd = text.size();
+    std::string line = text.substr(lineStart, lineEnd - lineStart);
+    lineStart = lineEnd + 1;
+
+    auto fail = [&](std::string const &what) {
+      error = "line " + std::to_string(lineNumber) + ": " + what;
+      return false;
+    };
+
+    std::vector<std::string> words;
+    size_t equals = std::string::npos;
+    for (size_t i = 0; i < line.size();) {
+      if (isspace(static_cast<unsigned char>(line[i]))) {
+        ++i;
+        continue;
+      }
+      if (words.empty() && line[i] == '#')
+        break;
+      size_t end = i;
+      while (end < line.size() &&
+             !isspace(static_cast<unsigned char>(line[end])))
+        ++end;
+      if (equals == std::string::npos && words.size() == 1 && line[i] == '=') {
+        // Allow `key =value` as well as `key = value`.
+        equals = words.size();
+        if (end - i > 1)
+          words.push_back(line.substr(i + 1, end - i - 1));
+      } else {
+        words.push_back(line.substr(i, end - i));
+      }
+      i = end;
+    }
+    if (words.empty())
+      continue;
+    if (equals == std::string::npos)
+      return fail("expected `key = value`");
+
+    std::string key = words[0];
+    std::vector<std::string> values(words.begin() + 1, words.end());
+    if (key == "name") {
+      if (values.size() != 1)
+        return fail("name takes one word");
+      spec.name = values[0];
+    } else if (key == "files") {
+      spec.files.insert(spec.files.end(), values.begin(), values.end());
+    } else if (key == "keywords") {
+      spec.keywords.insert(spec.keywords.end(), values.begin(), values.end());
+    } else if (key == "types") {
+      spec.types.insert(spec.types.end(), values.begin(), values.end());
+    } else if (key == "line_comment") {
+      spec.lineComments.insert(spec.lineComments.end(), values.begin(),
+                               values.end());
+    } else if (key == "block_comment") {
+      if (values.size() != 2)
+        return fail("block_comment takes a start and an end");
+      spec.blockCommentStart = values[0];
+      spec.blockCommentEnd = values[1];
+    } else if (key == "strings") {
+      for (auto const &quote : values) {
+        if (quote.size() != 1)
+          return fail("strings are delimited by single characters");
+        spec.quotes += quote;
+      }
+    } else if (key == "escape") {
+      if (values.size() != 1 || (values[0].size() != 1 && values[0] != "none"))
+        return fail("escape takes one character or `none`");
+      spec.escape = values[0] == "none" ? 0 : values[0][0];
+    } else if (key == "numbers") {
+      if (values.size() != 1 || (values[0] != "yes" && values[0] != "no"))
+        return fail("numbers is `yes` or `no`");
+      spec.numbers = values[0] == "yes";
+    } else {
+      return fail("unknown key `" + key + "`");
+    }
+  }
+
+  if (spec.name.empty()) {
+    error = "no name given";
+    return false;
+  }
+  return true;
+}
+
+namespace {
+
+uint16_t const Dead = 0;
+
+// Identifiers, keywords and numbers are runs of these. Bytes of multibyte
+// UTF-8 characters count, so non-ASCII identifiers stay whole.
+bool isWordByte(unsigned char c) {
+  return (c >= 'a' && c <= 'z') || (c >= 'A' && c <= 'Z') ||
+         (c >= '0' && c <= '9') || c == '_' || c >= 0x80;
+}
+
+bool isDigit(unsigned char c) { return c >= '0' && c <= '9'; }
+
+// The DFA with a full 256-entry row per state, before byte classes squeeze
+// it.
+struct Builder {
+  std::vector<std::array<uint16_t, 256>> next;
+  std::vector<Lexer::Token> token;
+  std::vector<uint8_t> accepting;
+  std::vector<uint8_t> inBlock;
+  std::vector<uint8_t> inString;
+
+  uint16_t Add(Lexer::Token t, bool accept, bool block = false) {
+    next.emplace_back();
+    next.back().fill(Dead);
+    token.push_back(t);
+    accepting.push_back(accept);
+    inBlock.push_back(block);
+    inString.push_back(false);
+    return next.size() - 1;
+  }
+
+  void Loop(uint16_t state, bool (*byteClass)(unsigned char)) {
+    for (int c = 0; c < 256; ++c)
+      if (byteClass(c))
+        next[state][c] = state;
+  }
+};
+
+} // namespace
+
+std::unique_ptr<Lexer> Lexer::Compile(LexerSpec const &spec,
+                                      unsigned char const output[NumTokens],
+                                      std::string &error) {
+  Builder b;
+  b.Add(Normal, false);
+  uint16_t start = b.Add(Normal, false);
+  uint16_t punct = b.Add(Normal, true);
+  uint16_t ident = b.Add(Normal, true);
+  b.Loop(ident, isWordByte);
+  for (int c = 0; c < 256; ++c)
+    b.next[start][c] = isWordByte(c) ? ident : punct;
+
+  if (spec.numbers) {
+    uint16_t number = b.Add(Number, true);
+    b.Loop(number, isWordByte);
+    b.next[number]['.'] = number;
+    for (int c = '0'; c <= '9'; ++c)
+      b.next[start][c] = number;
+  }
+
+  for (unsigned char quote : spec.quotes) {
+    if (isWordByte(quote)) {
+      error = std::string("string delimiter `") + char(quote) +
+              "` is part of words";
+      return nullptr;
+    }
+    uint16_t string = b.Add(String, true);
+    uint16_t closed = b.Add(String, true);
+    b.next[string].fill(string);
+    b.next[string][quote] = closed;
+    b.inString[string] = true;
+    if (spec.escape && static_cast<unsigned char>(spec.escape) != quote) {
+      uint16_t escaped = b.Add(String, true);
+      b.next[escaped].fill(string);
+      b.next[string][static_cast<unsigned char>(spec.escape)] = escaped;
+      b.inString[escaped] = true;
+    }
+    b.next[start][quote] = string;
+  }
+
+  // Keywords and types branch off identifiers, so a word only gets their
+  // colour if it ends exactly where they do.
+  std::vector<uint8_t> inTrie;
+  auto addWords = [&](std::vector<std::string> const &words, Token t) {
+    for (auto const &word : words) {
+      if (word.empty() || isDigit(word[0]) ||
+          !std::all_of(word.begin(), word.end(),
+                       [](unsigned char c) { return isWordByte(c); })) {
+        error = "`" + word + "` is not a word";
+        return false;
+      }
+      uint16_t state = start;
+      for (unsigned char c : word) {
+        uint16_t next = b.next[state][c];
+        if (next == ident || next >= inTrie.size() || !inTrie[next]) {
+          next = b.Add(Normal, true);
+          for (int d = 0; d < 256; ++d)
+            if (isWordByte(d))
+              b.next[next][d] = ident;
+          b.next[state][c] = next;
+          inTrie.resize(b.next.size());
+          inTrie[next] = true;
+        }
+        state = next;
+      }
+      if (b.token[state] == Normal)
+        b.token[state] = t;
+    }
+    return true;
+  };
+  if (!addWords(spec.keywords, Keyword) || !addWords(spec.types, Type))
+    return nullptr;
+
+  // Comment delimiters are spelled out by a trie hanging off the start
+  // state. Its first level stands in for the lone punctuation character, so
+  // `/` followed by anything but `/` or `*` is still one Normal token.
+  std::vector<uint8_t> inDelimiters;
+  auto addDelimiter = [&](std::string const &delimiter, uint16_t target) {
+    if (delimiter.empty() || isWordByte(delimiter[0]) ||
+        spec.quotes.find(delimiter[0]) != std::string::npos) {
+      error = "comment delimiter `" + delimiter +
+              "` must start with punctuation that doesn't open a string";
+      return false;
+    }
+    uint16_t state = start;
+    for (size_t i = 0; i + 1 < delimiter.size(); ++i) {
+      unsigned char c = delimiter[i];
+      uint16_t next = b.next[state][c];
+      if (next >= inDelimiters.size() || !inDelimiters[next]) {
+        if (next != punct && next != Dead) {
+          error = "comment delimiter `" + delimiter + "` overlaps another";
+          return false;
+        }
+        next = b.Add(Normal, i == 0);
+        b.next[state][c] = next;
+        inDelimiters.resize(b.next.size());
+        inDelimiters[next] = true;
+      }
+      state = next;
+    }
+    unsigned char last = delimiter.back();
+    uint16_t existing = b.next[state][last];
+    if ((existing < inDelimiters.size() && inDelimiters[existing]) ||
+        (state != start && existing != Dead)) {
+      error = "comment delimiter `" + delimiter + "` overlaps another";
+      return false;
+    }
+    b.next[state][last] = target;
+    return true;
+  };
+
+  if (!spec.lineComments.empty()) {
+    uint16_t comment = b.Add(Comment, true);
+    b.next[comment].fill(comment);
+    for (auto const &delimiter : spec.lineComments)
+      if (!addDelimiter(delimiter, comment))
+        return nullptr;
+  }
+
+  uint16_t blockStart = start;
+  if (!spec.blockCommentStart.empty()) {
+    // One state per prefix of the end delimiter matched so far, with
+    // Knuth-Morris-Pratt fallbacks, so `**/` still closes `/*`.
+    std::string const &end = spec.blockCommentEnd;
+    if (end.empty()) {
+      error = "block comments need an end delimiter";
+      return nullptr;
+    }
+    std::vector<uint16_t> matched;
+    for (size_t k = 0; k < end.size(); ++k)
+      matched.push_back(b.Add(BlockComment, true, true));
+    uint16_t closed = b.Add(BlockComment, true);
+    for (size_t k = 0; k < end.size(); ++k) {
+      for (int c = 0; c < 256; ++c) {
+        std::string seen = end.substr(0, k) + char(c);
+        size_t j = seen.size();
+        while (j > 0 && seen.compare(seen.size() - j, j, end, 0, j) != 0)
+          --j;
+        b.next[matched[k]][c] = j == end.size() ? closed : matched[j];
+      }
+    }
+    blockStart = matched[0];
+    if (!addDelimiter(spec.blockCommentStart, blockStart))
+      return nullptr;
+  }
+
+  if (b.next.size() > UINT16_MAX) {
+    error = "too many states";
+    return nullptr;
+  }
+
+  // Bytes whose columns agree in every state share a class.
+  std::unique_ptr<Lexer> lexer(new Lexer());
+  std::map<std::vector<uint16_t>, uint8_t> classes;
+  std::vector<std::vector<uint16_t>> columns;
+  for (int c = 0; c < 256; ++c) {
+    std::vector<uint16_t> column(b.next.size());
+    for (size_t s = 0; s < b.next.size(); ++s)
+      column[s] = b.next[s][c];
+    auto inserted = classes.emplace(column, columns.size());
+    if (inserted.second)
+      columns.push_back(column);
+    lexer->m_classes[c] = inserted.first->second;
+  }
+
+  lexer->m_numClasses = columns.size();
+  lexer->m_table.resize(b.next.size() * columns.size());
+  for (size_t s = 0; s < b.next.size(); ++s)
+    for (size_t k = 0; k < columns.size(); ++k)
+      lexer->m_table[s * columns.size() + k] = columns[k][s];
+  for (Token t : b.token)
+    lexer->m_output.push_back(output[t]);
+  lexer->m_accepting = b.accepting;
+  lexer->m_inBlock = b.inBlock;
+  lexer->m_inString = b.inString;
+  lexer->m_start = start;
+  lexer->m_blockStart = blockStart;
+  return lexer;
+}
+
+bool Lexer::Scan(char const *text, int length, unsigned char *hl,
+                 bool inBlockComment) const {
+  return ScanFrom(text, length, hl,
+                  inBlockComment ? InBlockComment : Outside) == InBlockComment;
+}
+
+int Lexer::ScanFrom(char const *text, int length, unsigned char *hl,
+                    int from) const {
+  int state = m_start;
+  if (from == InBlockComment)
+    state = m_blockStart;
+  else if (from >= InString && from - InString < NumStates() &&
+           m_inString[from - InString])
+    state = from - InString;
+  int lastToken = state;
+  int tokenStart = 0;
+  int acceptEnd = 0;
+  int acceptState = state;
+  int i = 0;
+  while (true) {
+    int next = Dead;
+    if (i < length)
+      next = m_table[state * m_numClasses +
+                     m_classes[static_cast<unsigned char>(text[i])]];
+    if (next != Dead) {
+      state = next;
+      ++i;
+      if (m_accepting[state]) {
+        acceptEnd = i;
+        acceptState = state;
+      }
+      continue;
+    }
+
+    // The token ends at the longest prefix that was one; anything read past
+    // that is read again as the start of the next token.
+    if (acceptEnd == tokenStart)
+      break;
+    memset(hl + tokenStart, m_output[acceptState], acceptEnd - tokenStart);
+    lastToken = acceptState;
+    i = tokenStart = acceptEnd;
+    state = m_start;
+  }
+  if (m_inBlock[lastToken])
+    return InBlockComment;
+  // A string still open at the end of the text is resumed from the state
+  // the DFA was in, which also knows whether an escape is pending.
+  if (m_inString[lastToken])
+    return InString + lastToken;
+  return Outside;
+}
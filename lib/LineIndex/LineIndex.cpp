@@ -0,0 +1,250 @@
+#include <LineIndex.hpp>
+
+#include <algorithm>
+#include <iterator>
+
+// Blocks are filled to this many lines when built, split once they hold
+// twice as many, and merged into a neighbour once a pair would fit in one.
+// Finding a line within a block is a scan, so they are kept short.
+static size_t const BlockLines = 512;
+
+static size_t lowBit(size_t i) { return i & (~i + 1); }
+
+static void treeAdd(std::vector<uint64_t> &tree, size_t i, int64_t delta) {
+  for (++i; i < tree.size(); i += lowBit(i))
+    tree[i] += delta;
+}
+
+static uint64_t treePrefix(std::vector<uint64_t> const &tree, size_t count) {
+  uint64_t sum = 0;
+  for (size_t i = count; i > 0; i -= lowBit(i))
+    sum += tree[i];
+  return sum;
+}
+
+// Adds a node for one more element, `value`. The new node covers the
+// elements (i - lowBit(i), i], all but the last of which are already in the
+// tree.
+static void treeAppend(std::vector<uint64_t> &tree, uint64_t value) {
+  size_t i = tree.size();
+  tree.push_back(value + treePrefix(tree, i - 1) -
+                 treePrefix(tree, i - lowBit(i)));
+}
+
+// Walks down the tree to the longest prefix of elements whose sum is still
+// <= `target`. Returns its length, leaving in `target` what is left over.
+static size_t treeDescend(std::vector<uint64_t> const &tree,
+                          uint64_t &target) {
+  size_t n = tree.size() - 1;
+  size_t step = 1;
+  while (step * 2 <= n)
+    step *= 2;
+  size_t pos = 0;
+  for (; step > 0; step /= 2) {
+    if (pos + step <= n && tree[pos + step] <= target) {
+      pos += step;
+      target -= tree[pos];
+    }
+  }
+  return pos;
+}
+
+static uint64_t sum(uint64_t const *lengths, size_t count) {
+  uint64_t total = 0;
+  for (size_t j = 0; j < count; ++j)
+    total += lengths[j];
+  return total;
+}
+
+// Builds both trees afresh, each node adding itself into its parent.
+void LineIndex::Rebuild() {
+  size_t n = m_blocks.size();
+  m_lines.assign(n + 1, 0);
+  m_bytes.assign(n + 1, 0);
+  for (size_t i = 1; i <= n; ++i) {
+    m_lines[i] += m_blocks[i - 1].lengths.size();
+    m_bytes[i] += m_blocks[i - 1].bytes;
+    size_t parent = i + lowBit(i);
+    if (parent <= n) {
+      m_lines[parent] += m_lines[i];
+      m_bytes[parent] += m_bytes[i];
+    }
+  }
+}
+
+void LineIndex::AddBlock(uint64_t length) {
+  m_blocks.push_back({{length}, length});
+  treeAppend(m_lines, 1);
+  treeAppend(m_bytes, length);
+  ++m_size;
+}
+
+void LineIndex::Grow(size_t block, int64_t lines, int64_t bytes) {
+  m_blocks[block].bytes += bytes;
+  treeAdd(m_lines, block, lines);
+  treeAdd(m_bytes, block, bytes);
+  m_size += lines;
+}
+
+size_t LineIndex::Find(size_t line, size_t *within) const {
+  uint64_t left = line;
+  size_t block = treeDescend(m_lines, left);
+  *within = left;
+  return block;
+}
+
+// Splits `block` if it has grown too long, or folds it into a neighbour if
+// together they would make one block.
+void LineIndex::SplitOrMerge(size_t block) {
+  auto &lengths = m_blocks[block].lengths;
+  if (lengths.size() >= 2 * BlockLines) {
+    std::vector<Block> pieces;
+    for (size_t j = 0; j < lengths.size(); j += BlockLines) {
+      size_t count = std::min(BlockLines, lengths.size() - j);
+      pieces.push_back({{lengths.begin() + j, lengths.begin() + j + count},
+                        sum(&lengths[j], count)});
+    }
+    m_blocks.erase(m_blocks.begin() + block);
+    m_blocks.insert(m_blocks.begin() + block,
+                    std::make_move_iterator(pieces.begin()),
+                    std::make_move_iterator(pieces.end()));
+  } else if (lengths.empty()) {
+    m_blocks.erase(m_blocks.begin() + block);
+  } else if (block + 1 < m_blocks.size() &&
+             lengths.size() + m_blocks[block + 1].lengths.size() <=
+                 BlockLines) {
+    Block &next = m_blocks[block + 1];
+    lengths.insert(lengths.end(), next.lengths.begin(), next.lengths.end());
+    m_blocks[block].bytes += next.bytes;
+    m_blocks.erase(m_blocks.begin() + block + 1);
+  } else if (block > 0 && m_blocks[block - 1].lengths.size() +
+                                  lengths.size() <=
+                              BlockLines) {
+    Block &previous = m_blocks[block - 1];
+    previous.lengths.insert(previous.lengths.end(), lengths.begin(),
+                            lengths.end());
+    previous.bytes += m_blocks[block].bytes;
+    m_blocks.erase(m_blocks.begin() + block);
+  } else {
+    return;
+  }
+  Rebuild();
+}
+
+uint64_t LineIndex::Length(size_t line) const {
+  size_t within;
+  size_t block = Find(line, &within);
+  return m_blocks[block].lengths[within];
+}
+
+void LineIndex::Clear() {
+  m_blocks.clear();
+  m_lines.assign(1, 0);
+  m_bytes.assign(1, 0);
+  m_size = 0;
+}
+
+void LineIndex::Append(uint64_t length) {
+  if (m_blocks.empty() || m_blocks.back().lengths.size() >= BlockLines) {
+    AddBlock(length);
+    return;
+  }
+  m_blocks.back().lengths.push_back(length);
+  Grow(m_blocks.size() - 1, 1, length);
+}
+
+void LineIndex::Insert(size_t line, uint64_t const *lengths, size_t count) {
+  if (line == m_size) {
+    for (size_t j = 0; j < count; ++j)
+      Append(lengths[j]);
+    return;
+  }
+  if (count == 0)
+    return;
+
+  size_t within;
+  size_t block = Find(line, &within);
+  auto &target = m_blocks[block].lengths;
+  target.insert(target.begin() + within, lengths, lengths + count);
+  Grow(block, count, sum(lengths, count));
+  SplitOrMerge(block);
+}
+
+void LineIndex::Erase(size_t line, size_t count) {
+  if (count == 0)
+    return;
+  size_t within;
+  size_t block = Find(line, &within);
+  auto &lengths = m_blocks[block].lengths;
+  if (within + count <= lengths.size()) {
+    uint64_t bytes = sum(&lengths[within], count);
+    lengths.erase(lengths.begin() + within, lengths.begin() + within + count);
+    Grow(block, -static_cast<int64_t>(count), -static_cast<int64_t>(bytes));
+    SplitOrMerge(block);
+    return;
+  }
+
+  // A run over several blocks trims each of them, and the trees are rebuilt
+  // once at the end.
+  m_size -= count;
+  count -= lengths.size() - within;
+  m_blocks[block].bytes = sum(lengths.data(), within);
+  lengths.resize(within);
+  size_t last = block;
+  while (count > 0) {
+    Block &next = m_blocks[++last];
+    size_t taken = std::min(count, next.lengths.size());
+    next.bytes -= sum(next.lengths.data(), taken);
+    next.lengths.erase(next.lengths.begin(), next.lengths.begin() + taken);
+    count -= taken;
+  }
+  m_blocks.erase(std::remove_if(m_blocks.begin() + block,
+                                m_blocks.begin() + last + 1,
+                                [](Block const &b) {
+                                  return b.lengths.empty();
+                                }),
+                 m_blocks.begin() + last + 1);
+  Rebuild();
+  if (block < m_blocks.size())
+    SplitOrMerge(block);
+}
+
+void LineIndex::Set(size_t line, uint64_t length) {
+  size_t within;
+  size_t block = Find(line, &within);
+  uint64_t &slot = m_blocks[block].lengths[within];
+  int64_t delta = length - slot;
+  if (delta == 0)
+    return;
+  slot = length;
+  m_blocks[block].bytes += delta;
+  treeAdd(m_bytes, block, delta);
+}
+
+uint64_t LineIndex::Offset(size_t line) const {
+  if (line >= m_size)
+    return TotalBytes();
+  size_t within;
+  size_t block = Find(line, &within);
+  return treePrefix(m_bytes, block) + sum(m_blocks[block].lengths.data(), within);
+}
+
+uint64_t LineIndex::TotalBytes() const {
+  return treePrefix(m_bytes, m_blocks.size());
+}
+
+size_t LineIndex::LineAt(uint64_t offset) const {
+  if (m_size == 0)
+    return 0;
+  size_t block = treeDescend(m_bytes, offset);
+  if (block == m_blocks.size())
+    return m_size - 1;
+  size_t line = treePrefix(m_lines, block);
+  for (uint64_t length : m_blocks[block].lengths) {
+    if (offset < length)
+      return line;
+    offset -= length;
+    ++line;
+  }
+  return line < m_size ? line : m_size - 1;
+}
@@ -0,0 +1,180 @@
+#include <Pool.hpp>
+
+#include <cstdlib>
+#include <cstring>
+
+namespace {
+// Sits in front of every block. Kept at 16 bytes so blocks stay aligned.
+struct Header {
+  uint64_t capacity;
+  uint16_t sizeClass;
+  uint16_t category;
+  // Owners of the block; see Pool::Share.
+  std::atomic<uint32_t> refs;
+};
+
+void raisePeak(std::atomic<size_t> &peak, size_t now) {
+  size_t seen = peak.load(std::memory_order_relaxed);
+  while (now > seen &&
+         !peak.compare_exchange_weak(seen, now, std::memory_order_relaxed))
+    ;
+}
+
+size_t const SlabSize = 256 * 1024;
+
+int classFor(size_t size) {
+  int sizeClass = 0;
+  size_t capacity = Pool::SmallestClass;
+  while (capacity < size) {
+    capacity *= 2;
+    ++sizeClass;
+  }
+  return sizeClass;
+}
+
+Header *headerOf(void const *p) {
+  return const_cast<Header *>(reinterpret_cast<Header const *>(p) - 1);
+}
+} // namespace
+
+Pool::~Pool() {
+  for (void *slab : m_slabs)
+    free(slab);
+}
+
+void Pool::Count(int category, size_t bytes) {
+  Category &c = m_categories[category];
+  size_t total = m_inUse.fetch_add(bytes, std::memory_order_relaxed);
+  size_t inCategory = c.inUse.fetch_add(bytes, std::memory_order_relaxed);
+  raisePeak(m_peak, total + bytes);
+  raisePeak(c.peak, inCategory + bytes);
+}
+
+void Pool::Uncount(int category, size_t bytes) {
+  m_inUse.fetch_sub(bytes, std::memory_order_relaxed);
+  m_categories[category].inUse.fetch_sub(bytes, std::memory_order_relaxed);
+}
+
+void Pool::Refill(int sizeClass) {
+  size_t blockSize = sizeof(Header) + (SmallestClass << sizeClass);
+  size_t count = SlabSize / blockSize;
+  if (count == 0)
+    count = 1;
+
+  char *slab = static_cast<char *>(malloc(blockSize * count));
+  if (slab == nullptr)
+    return;
+  {
+    std::lock_guard<std::mutex> guard(m_slabLock);
+    m_slabs.push_back(slab);
+  }
+  m_reserved.fetch_add(blockSize * count, std::memory_order_relaxed);
+
+  SizeClass &c = m_classes[sizeClass];
+  for (size_t i = 0; i < count; ++i) {
+    auto *block = reinterpret_cast<FreeBlock *>(slab + i * blockSize);
+    block->next = c.free;
+    c.free = block;
+  }
+}
+
+void *Pool::Allocate(size_t size, int category) {
+  if (size > LargestClass) {
+    auto *header = static_cast<Header *>(malloc(sizeof(Header) + size));
+    if (header == nullptr)
+      return nullptr;
+    header->capacity = size;
+    header->sizeClass = NumClasses;
+    header->category = category;
+    header->refs.store(1, std::memory_order_relaxed);
+    Count(category, size);
+    m_reserved.fetch_add(sizeof(Header) + size, std::memory_order_relaxed);
+    return header + 1;
+  }
+
+  int sizeClass = classFor(size);
+  SizeClass &c = m_classes[sizeClass];
+  FreeBlock *block;
+  {
+    std::lock_guard<std::mutex> guard(c.lock);
+    if (c.free == nullptr)
+      Refill(sizeClass);
+    block = c.free;
+    if (block == nullptr)
+      return nullptr;
+    c.free = block->next;
+  }
+
+  auto *header = reinterpret_cast<Header *>(block);
+  header->capacity = SmallestClass << sizeClass;
+  header->sizeClass = sizeClass;
+  header->category = category;
+  header->refs.store(1, std::memory_order_relaxed);
+  Count(category, header->capacity);
+  return header + 1;
+}
+
+void *Pool::Reallocate(void *p, size_t size, int category) {
+  if (p == nullptr)
+    return Allocate(size, category);
+
+  Header *header = headerOf(p);
+  if (size <= header->capacity &&
+      header->refs.load(std::memory_order_acquire) == 1 &&
+      (header->sizeClass == NumClasses || size * 2 > header->capacity ||
+       header->sizeClass == 0))
+    return p;
+
+  void *n = Allocate(size, category);
+  if (n == nullptr)
+    return nullptr;
+  memcpy(n, p, size < header->capacity ? size : header->capacity);
+  Deallocate(p);
+  return n;
+}
+
+void Pool::Deallocate(void *p) {
+  if (p == nullptr)
+    return;
+
+  Header *header = headerOf(p);
+  if (header->refs.fetch_sub(1, std::memory_order_acq_rel) > 1)
+    return;
+  Uncount(header->category, header->capacity);
+  if (header->sizeClass == NumClasses) {
+    m_reserved.fetch_sub(sizeof(Header) + header->capacity,
+                         std::memory_order_relaxed);
+    free(header);
+    return;
+  }
+
+  SizeClass &c = m_classes[header->sizeClass];
+  auto *block = reinterpret_cast<FreeBlock *>(header);
+  std::lock_guard<std::mutex> guard(c.lock);
+  block->next = c.free;
+  c.free = block;
+}
+
+void Pool::Share(void *p) {
+  if (p)
+    headerOf(p)->refs.fetch_add(1, std::memory_order_relaxed);
+}
+
+void *Pool::Unshare(void *p) {
+  if (p == nullptr)
+    return nullptr;
+  Header *header = headerOf(p);
+  if (header->refs.load(std::memory_order_acquire) == 1)
+    return p;
+
+  void *n = Allocate(header->capacity, header->category);
+  if (n == nullptr)
+    return nullptr;
+  memcpy(n, p, header->capacity);
+  Deallocate(p);
+  return n;
+}
+
+size_t Pool::Capacity(void const *p) const {
+  return p ? headerOf(p)->capacity : 0;
+}
@@ -0,0 +1,152 @@
+#include <Trace.hpp>
+
+#include <pthread.h>
+#include <sys/syscall.h>
+#include <time.h>
+#include <unistd.h>
+
+Tracer Trace;
+
+static std::atomic<uint64_t> NextTracerId{1};
+
+// The ring the calling thread last recorded into, and the tracer it belongs
+// to. Tracers are told apart by id rather than address, since a new one may
+// be constructed where an old one was. The ring is shared with the tracer,
+// so whichever of the two goes last frees it; a thread going first hands it
+// back for reuse.
+struct ThreadSlot {
+  uint64_t tracerId = 0;
+  std::shared_ptr<Tracer::Ring> ring;
+
+  void Release() {
+    if (ring)
+      ring->owned.store(false, std::memory_order_release);
+    ring.reset();
+    tracerId = 0;
+  }
+  ~ThreadSlot() { Release(); }
+};
+
+static thread_local ThreadSlot Slot;
+
+// The kernel's id for the calling thread, which is what trace viewers and
+// profilers show.
+static int threadId() {
+#ifdef __APPLE__
+  uint64_t id;
+  pthread_threadid_np(nullptr, &id);
+  return static_cast<int>(id);
+#else
+  return static_cast<int>(syscall(SYS_gettid));
+#endif
+}
+
+static thread_local int ThreadId = threadId();
+
+Tracer::Tracer() : m_id(NextTracerId++) {}
+
+Tracer::~Tracer() {
+  if (m_file)
+    fclose(m_file);
+}
+
+uint64_t Tracer::Now() {
+  struct timespec now;
+  clock_gettime(CLOCK_MONOTONIC, &now);
+  return now.tv_sec * 1000000000ULL + now.tv_nsec;
+}
+
+bool Tracer::Start(char const *path) {
+  if (m_file)
+    fclose(m_file);
+  m_file = fopen(path, "w");
+  if (!m_file)
+    return false;
+  m_start = Now();
+  m_enabled.store(true, std::memory_order_relaxed);
+  return true;
+}
+
+Tracer::Ring *Tracer::ThreadRing() {
+  if (Slot.tracerId == m_id)
+    return Slot.ring.get();
+
+  Slot.Release();
+  std::lock_guard<std::mutex> lock(m_ringLock);
+  for (auto const &ring : m_rings) {
+    bool owned = false;
+    if (ring->owned.compare_exchange_strong(owned, true,
+                                            std::memory_order_acquire)) {
+      Slot.ring = ring;
+      break;
+    }
+  }
+  if (!Slot.ring) {
+    m_rings.push_back(std::make_shared<Ring>());
+    Slot.ring = m_rings.back();
+  }
+  Slot.tracerId = m_id;
+  return Slot.ring.get();
+}
+
+// The slot is marked incomplete before its fields change and complete after,
+// so `Flush` can tell an event it read whole from one torn by this thread.
+void Tracer::Record(char const *name, uint64_t begin, uint64_t end) {
+  if (!Enabled())
+    return;
+  Ring *ring = ThreadRing();
+  uint64_t head = ring->head.load(std::memory_order_relaxed);
+  Event &event = ring->events[head % RingSize];
+  event.seq.store(0, std::memory_order_relaxed);
+  std::atomic_thread_fence(std::memory_order_release);
+  event.name.store(name, std::memory_order_relaxed);
+  event.begin.store(begin, std::memory_order_relaxed);
+  event.end.store(end, std::memory_order_relaxed);
+  event.tid.store(ThreadId, std::memory_order_relaxed);
+  event.seq.store(head + 1, std::memory_order_release);
+  ring->head.store(head + 1, std::memory_order_release);
+}
+
+size_t Tracer::Rings() {
+  std::lock_guard<std::mutex> lock(m_ringLock);
+  return m_rings.size();
+}
+
+bool Tracer::Flush() {
+  if (!m_file)
+    return false;
+  m_enabled.store(false, std::memory_order_relaxed);
+
+  fprintf(m_file, "{\"traceEvents\":[");
+  char const *separator = "\n";
+  int pid = getpid();
+  std::lock_guard<std::mutex> lock(m_ringLock);
+  for (auto const &ring : m_rings) {
+    uint64_t head = ring->head.load(std::memory_order_acquire);
+    uint64_t first = head > RingSize ? head - RingSize : 0;
+    for (uint64_t i = first; i < head; ++i) {
+      Event const &event = ring->events[i % RingSize];
+      uint64_t seq = event.seq.load(std::memory_order_acquire);
+      char const *name = event.name.load(std::memory_order_relaxed);
+      uint64_t begin = event.begin.load(std::memory_order_relaxed);
+      uint64_t end = event.end.load(std::memory_order_relaxed);
+      int tid = event.tid.load(std::memory_order_relaxed);
+      std::atomic_thread_fence(std::memory_order_acquire);
+      if (seq != i + 1 || event.seq.load(std::memory_order_relaxed) != seq ||
+          begin < m_start)
+        continue;
+      fprintf(m_file,
+              "%s{\"name\":\"%s\",\"ph\":\"X\",\"ts\":%.3f,\"dur\":%.3f,"
+              "\"pid\":%d,\"tid\":%d}",
+              separator, name, (begin - m_start) / 1000.0,
+              (end - begin) / 1000.0, pid, tid);
+      separator = ",\n";
+    }
+  }
+  fprintf(m_file, "\n],\"displayTimeUnit\":\"ns\"}\n");
+
+  bool ok = !ferror(m_file);
+  ok &= fclose(m_file) == 0;
+  m_file = nullptr;
+  return ok;
+}
@@ -0,0 +1,202 @@
+#include <Unicode.hpp>
+
+#include <cstring>
+
+#if defined(__SSE2__)
+#include <emmintrin.h>
+#elif defined(__ARM_NEON)
+#include <arm_neon.h>
+#endif
+
+bool utf8IsAscii(char const *s, size_t len) {
+  size_t i = 0;
+
+#if defined(__SSE2__)
+  for (; i + 64 <= len; i += 64) {
+    __m128i a = _mm_loadu_si128(reinterpret_cast<__m128i const *>(s + i));
+    __m128i b = _mm_loadu_si128(reinterpret_cast<__m128i const *>(s + i + 16));
+    __m128i c = _mm_loadu_si128(reinterpret_cast<__m128i const *>(s + i + 32));
+    __m128i d = _mm_loadu_si128(reinterpret_cast<__m128i const *>(s + i + 48));
+    __m128i any = _mm_or_si128(_mm_or_si128(a, b), _mm_or_si128(c, d));
+    if (_mm_movemask_epi8(any))
+      return false;
+  }
+  for (; i + 16 <= len; i += 16) {
+    __m128i a = _mm_loadu_si128(reinterpret_cast<__m128i const *>(s + i));
+    if (_mm_movemask_epi8(a))
+      return false;
+  }
+#elif defined(__ARM_NEON)
+  for (; i + 64 <= len; i += 64) {
+    uint8x16_t a = vld1q_u8(reinterpret_cast<uint8_t const *>(s + i));
+    uint8x16_t b = vld1q_u8(reinterpret_cast<uint8_t const *>(s + i + 16));
+    uint8x16_t c = vld1q_u8(reinterpret_cast<uint8_t const *>(s + i + 32));
+    uint8x16_t d = vld1q_u8(reinterpret_cast<uint8_t const *>(s + i + 48));
+    if (vmaxvq_u8(vorrq_u8(vorrq_u8(a, b), vorrq_u8(c, d))) & 0x80)
+      return false;
+  }
+  for (; i + 16 <= len; i += 16) {
+    uint8x16_t a = vld1q_u8(reinterpret_cast<uint8_t const *>(s + i));
+    if (vmaxvq_u8(a) & 0x80)
+      return false;
+  }
+#endif
+
+  for (; i + 8 <= len; i += 8) {
+    uint64_t word;
+    memcpy(&word, s + i, sizeof(word));
+    if (word & 0x8080808080808080ull)
+      return false;
+  }
+  for (; i < len; ++i)
+    if (s[i] & 0x80)
+      return false;
+  return true;
+}
+
+int utf8Decode(char const *s, size_t len, uint32_t *codepoint) {
+  auto const *u = reinterpret_cast<unsigned char const *>(s);
+  *codepoint = ReplacementCharacter;
+  if (len == 0)
+    return 1;
+
+  unsigned char lead = u[0];
+  if (lead < 0x80) {
+    *codepoint = lead;
+    return 1;
+  }
+
+  int n;
+  uint32_t cp;
+  uint32_t min;
+  if ((lead & 0xe0) == 0xc0) {
+    n = 2;
+    cp = lead & 0x1f;
+    min = 0x80;
+  } else if ((lead & 0xf0) == 0xe0) {
+    n = 3;
+    cp = lead & 0x0f;
+    min = 0x800;
+  } else if ((lead & 0xf8) == 0xf0) {
+    n = 4;
+    cp = lead & 0x07;
+    min = 0x10000;
+  } else {
+    return 1;
+  }
+
+  if (len < static_cast<size_t>(n))
+    return 1;
+  for (int i = 1; i < n; ++i) {
+    if ((u[i] & 0xc0) != 0x80)
+      return 1;
+    cp = (cp << 6) | (u[i] & 0x3f);
+  }
+
+  if (cp < min || cp > 0x10ffff || (cp >= 0xd800 && cp <= 0xdfff))
+    return 1;
+
+  *codepoint = cp;
+  return n;
+}
+
+namespace {
+struct Interval {
+  uint32_t first;
+  uint32_t last;
+};
+
+// Combining marks and format characters that take no column of their own.
+Interval const ZeroWidth[] = {
+    {0x0300, 0x036f},   {0x0483, 0x0489},   {0x0591, 0x05bd},
+    {0x05bf, 0x05bf},   {0x05c1, 0x05c2},   {0x05c4, 0x05c5},
+    {0x05c7, 0x05c7},   {0x0610, 0x061a},   {0x064b, 0x065f},
+    {0x0670, 0x0670},   {0x06d6, 0x06dc},   {0x06df, 0x06e4},
+    {0x06e7, 0x06e8},   {0x06ea, 0x06ed},   {0x0711, 0x0711},
+    {0x0730, 0x074a},   {0x0900, 0x0902},   {0x093a, 0x093a},
+    {0x093c, 0x093c},   {0x0941, 0x0948},   {0x094d, 0x094d},
+    {0x0951, 0x0957},   {0x0e31, 0x0e31},   {0x0e34, 0x0e3a},
+    {0x0e47, 0x0e4e},   {0x1ab0, 0x1aff},   {0x1dc0, 0x1dff},
+    {0x200b, 0x200f},   {0x202a, 0x202e},   {0x2060, 0x2064},
+    {0x20d0, 0x20ff},   {0x302a, 0x302d},   {0x3099, 0x309a},
+    {0xfe00, 0xfe0f},   {0xfe20, 0xfe2f},   {0xfeff, 0xfeff},
+    {0x1f3fb, 0x1f3ff}, {0xe0001, 0xe007f}, {0xe0100, 0xe01ef},
+};
+
+// East Asian Wide and Fullwidth ranges, plus the emoji blocks terminals
+// render in two columns.
+Interval const DoubleWidth[] = {
+    {0x1100, 0x115f},   {0x231a, 0x231b},   {0x2329, 0x232a},
+    {0x23e9, 0x23ec},   {0x23f0, 0x23f0},   {0x23f3, 0x23f3},
+    {0x25fd, 0x25fe},   {0x2614, 0x2615},   {0x2648, 0x2653},
+    {0x267f, 0x267f},   {0x2693, 0x2693},   {0x26a1, 0x26a1},
+    {0x26aa, 0x26ab},   {0x26bd, 0x26be},   {0x26c4, 0x26c5},
+    {0x26ce, 0x26ce},   {0x26d4, 0x26d4},   {0x26ea, 0x26ea},
+    {0x26f2, 0x26f3},   {0x26f5, 0x26f5},   {0x26fa, 0x26fa},
+    {0x26fd, 0x26fd},   {0x2705, 0x2705},   {0x270a, 0x270b},
+    {0x2728, 0x2728},   {0x274c, 0x274c},   {0x274e, 0x274e},
+    {0x2753, 0x2755},   {0x2757, 0x2757},   {0x2795, 0x2797},
+    {0x27b0, 0x27b0},   {0x27bf, 0x27bf},   {0x2b1b, 0x2b1c},
+    {0x2b50, 0x2b50},   {0x2b55, 0x2b55},   {0x2e80, 0x303e},
+    {0x3041, 0x33ff},   {0x3400, 0x4dbf},   {0x4e00, 0x9fff},
+    {0xa000, 0xa4cf},   {0xa960, 0xa97f},   {0xac00, 0xd7a3},
+    {0xf900, 0xfaff},   {0xfe10, 0xfe19},   {0xfe30, 0xfe6f},
+    {0xff00, 0xff60},   {0xffe0, 0xffe6},   {0x16fe0, 0x16fe4},
+    {0x17000, 0x18cff}, {0x1b000, 0x1b2ff}, {0x1f004, 0x1f004},
+    {0x1f0cf, 0x1f0cf}, {0x1f18e, 0x1f18e}, {0x1f191, 0x1f19a},
+    {0x1f200, 0x1f251}, {0x1f300, 0x1f3fa}, {0x1f400, 0x1f64f},
+    {0x1f680, 0x1f6ff}, {0x1f7e0, 0x1f7eb}, {0x1f900, 0x1f9ff},
+    {0x1fa70, 0x1faff}, {0x20000, 0x2fffd}, {0x30000, 0x3fffd},
+};
+
+template <size_t N>
+bool inTable(Interval const (&table)[N], uint32_t codepoint) {
+  if (codepoint < table[0].first || codepoint > table[N - 1].last)
+    return false;
+
+  size_t lo = 0;
+  size_t hi = N;
+  while (lo < hi) {
+    size_t mid = lo + (hi - lo) / 2;
+    if (table[mid].last < codepoint)
+      lo = mid + 1;
+    else
+      hi = mid;
+  }
+  return lo < N && table[lo].first <= codepoint;
+}
+} // namespace
+
+int codepointWidth(uint32_t codepoint) {
+  if (codepoint < 0x300)
+    return 1;
+  if (inTable(ZeroWidth, codepoint))
+    return 0;
+  if (inTable(DoubleWidth, codepoint))
+    return 2;
+  return 1;
+}
+
+int utf8NextBoundary(char const *s, int len, int at) {
+  if (at >= len)
+    return len;
+  uint32_t codepoint;
+  return at + utf8Decode(&s[at], len - at, &codepoint);
+}
+
+int utf8PrevBoundary(char const *s, int at) {
+  if (at <= 0)
+    return 0;
+
+  // Walk back over at most three continuation bytes, then make sure the lead
+  // byte we found really decodes to a sequence that ends at `at`. If it does
+  // not, the byte before `at` was a lone malformed byte.
+  int start = at - 1;
+  while (start > 0 && at - start < 4 && utf8IsContinuation(s[start]))
+    --start;
+
+  uint32_t codepoint;
+  if (start + utf8Decode(&s[start], at - start, &codepoint) == at)
+    return start;
+  return at - 1;
+}
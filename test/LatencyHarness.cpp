@@ -0,0 +1,380 @@
+// End-to-end keystroke latency harness.
+//
+// Runs kilo on a pseudo-terminal against a large generated C file, replays
+// key sequences for typing, pasting, searching and paging, and times every
+// keystroke from the write() of its bytes to the end of the frame kilo draws
+// in response. kilo ends every frame by making the cursor visible again, so
+// the frame is complete once that sequence has been read back. Startup is
+// timed to the first frame, for that file and for one ten times its size,
+// which should take no longer since the rest of a file loads behind it.
+//
+// Usage: LatencyHarness <kilo> <baseline> [--update-baseline]
+//
+// Each scenario's p50/p99 latency and mean bytes per frame are compared with
+// the baseline file and the run fails if any of them regressed past the
+// allowed slack. --update-baseline rewrites the file with this run instead.
+
+#include <fcntl.h>
+#include <poll.h>
+#include <signal.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <sys/ioctl.h>
+#include <sys/wait.h>
+#include <termios.h>
+#include <unistd.h>
+
+#include <algorithm>
+#include <chrono>
+#include <fstream>
+#include <map>
+#include <sstream>
+#include <string>
+#include <thread>
+#include <vector>
+
+using Clock = std::chrono::steady_clock;
+
+static char const FrameEnd[] = "\x1b[?25h";
+static int const ScreenRows = 40;
+static int const ScreenCols = 120;
+static int const FixtureLines = 200000;
+static int const LargeFixtureLines = 10 * FixtureLines;
+
+// kilo shows its help in the message bar for up to this long after starting.
+// Frames drawn while it is up are bigger, so scenarios wait it out to keep
+// their byte counts independent of how fast kilo starts.
+static auto const HelpMessageTime = std::chrono::seconds(6);
+
+// A latency may grow to this multiple of its baseline plus this many
+// microseconds before it counts as a regression; timings are noisy.
+static double const LatencySlackFactor = 2.0;
+static double const LatencySlackMicros = 2000;
+// Frame sizes are deterministic, so they get much less room.
+static double const BytesSlackFactor = 1.1;
+
+struct Result {
+  double p50;
+  double p99;
+  double bytesPerFrame;
+};
+
+class Terminal {
+  int m_master = -1;
+  pid_t m_child = -1;
+  std::string m_pending;
+
+public:
+  bool Spawn(char const *kilo, char const *file) {
+    m_master = posix_openpt(O_RDWR | O_NOCTTY);
+    if (m_master == -1 || grantpt(m_master) == -1 || unlockpt(m_master) == -1)
+      return false;
+
+    struct winsize ws = {};
+    ws.ws_row = ScreenRows;
+    ws.ws_col = ScreenCols;
+    char const *slaveName = ptsname(m_master);
+
+    m_child = fork();
+    if (m_child == 0) {
+      setsid();
+      int slave = open(slaveName, O_RDWR);
+      ioctl(slave, TIOCSCTTY, 0);
+      ioctl(slave, TIOCSWINSZ, &ws);
+      dup2(slave, STDIN_FILENO);
+      dup2(slave, STDOUT_FILENO);
+      dup2(slave, STDERR_FILENO);
+      close(slave);
+      close(m_master);
+      setenv("TERM", "xterm-256color", 1);
+      execl(kilo, kilo, file, static_cast<char *>(nullptr));
+      _exit(127);
+    }
+    return m_child > 0;
+  }
+
+  void Send(std::string const &keys) {
+    size_t sent = 0;
+    while (sent < keys.size()) {
+      ssize_t n = write(m_master, keys.data() + sent, keys.size() - sent);
+      if (n <= 0)
+        return;
+      sent += n;
+    }
+  }
+
+  // Reads until `frames` more frames have finished. Returns the bytes those
+  // frames took, or -1 on timeout.
+  long WaitForFrames(int frames, int timeoutMs = 10000) {
+    long bytes = 0;
+    auto deadline = Clock::now() + std::chrono::milliseconds(timeoutMs);
+    while (frames > 0) {
+      size_t end = m_pending.find(FrameEnd);
+      if (end != std::string::npos) {
+        end += sizeof(FrameEnd) - 1;
+        bytes += end;
+        m_pending.erase(0, end);
+        --frames;
+        continue;
+      }
+
+      int left = std::chrono::duration_cast<std::chrono::milliseconds>(
+                     deadline - Clock::now())
+                     .count();
+      if (left <= 0 || !Read(left))
+        return -1;
+    }
+    return bytes;
+  }
+
+  // Swallows output until the editor has been quiet for `quietMs`, so
+  // frames from background work don't get attributed to the next key.
+  void Drain(int quietMs = 300) {
+    while (Read(quietMs))
+      ;
+    m_pending.clear();
+  }
+
+  void Quit() {
+    Send("\x11\x11\x11\x11");
+    Drain(200);
+    kill(m_child, SIGTERM);
+    waitpid(m_child, nullptr, 0);
+    close(m_master);
+  }
+
+private:
+  bool Read(int timeoutMs) {
+    struct pollfd fd = {m_master, POLLIN, 0};
+    if (poll(&fd, 1, timeoutMs) <= 0)
+      return false;
+    char buffer[65536];
+    ssize_t n = read(m_master, buffer, sizeof(buffer));
+    if (n <= 0)
+      return false;
+    m_pending.append(buffer, n);
+    return true;
+  }
+};
+
+static double percentile(std::vector<double> samples, double p) {
+  std::sort(samples.begin(), samples.end());
+  size_t index = static_cast<size_t>(p * (samples.size() - 1) + 0.5);
+  return samples[index];
+}
+
+static double microsSince(Clock::time_point start) {
+  return std::chrono::duration<double, std::micro>(Clock::now() - start)
+      .count();
+}
+
+// Sends each key on its own and times its frame.
+static bool timeKeys(Terminal &term, std::vector<std::string> const &keys,
+                     Result &result) {
+  std::vector<double> latencies;
+  long bytes = 0;
+  for (auto const &key : keys) {
+    auto start = Clock::now();
+    term.Send(key);
+    long frame = term.WaitForFrames(1);
+    if (frame < 0)
+      return false;
+    latencies.push_back(microsSince(start));
+    bytes += frame;
+  }
+  result = {percentile(latencies, 0.5), percentile(latencies, 0.99),
+            static_cast<double>(bytes) / keys.size()};
+  return true;
+}
+
+static std::string writeFixture(int lines) {
+  char path[] = "/tmp/kilo-latency-XXXXXX.c";
+  int fd = mkstemps(path, 2);
+  FILE *fp = fdopen(fd, "w");
+  for (int i = 0; i < lines; ++i) {
+    switch (i % 5) {
+    case 0:
+      fprintf(fp, "int function_%d(int argc, char **argv) {\n", i);
+      break;
+    case 1:
+      fprintf(fp, "  /* iteration %d */ for (int i = 0; i < %d; ++i)\n", i, i);
+      break;
+    case 2:
+      fprintf(fp, "\tprintf(\"%%d: %s\\n\", i); // %d\n", "hello", i);
+      break;
+    case 3:
+      fprintf(fp, "  return %d;\n", i);
+      break;
+    default:
+      fprintf(fp, "}\n");
+    }
+  }
+  fclose(fp);
+  return path;
+}
+
+static std::map<std::string, Result> run(char const *kilo) {
+  std::map<std::string, Result> results;
+  std::string fixture = writeFixture(FixtureLines);
+  Terminal term;
+  if (!term.Spawn(kilo, fixture.c_str())) {
+    perror("spawn");
+    unlink(fixture.c_str());
+    return results;
+  }
+
+  auto start = Clock::now();
+  long bytes = term.WaitForFrames(1, 60000);
+  if (bytes >= 0) {
+    double micros = microsSince(start);
+    results["startup"] = {micros, micros, static_cast<double>(bytes)};
+  }
+  term.Drain();
+  std::this_thread::sleep_until(start + HelpMessageTime);
+
+  Result result;
+  std::vector<std::string> keys;
+
+  // Page down through the file and back up.
+  keys.assign(100, "\x1b[6~");
+  keys.insert(keys.end(), 100, "\x1b[5~");
+  if (timeKeys(term, keys, result))
+    results["page"] = result;
+  term.Drain();
+
+  // Type a line of code at the top of the file.
+  keys.clear();
+  for (char c : std::string("int typed_variable = 42; // typing test"))
+    keys.emplace_back(1, c);
+  keys.emplace_back("\r");
+  if (timeKeys(term, keys, result))
+    results["typing"] = result;
+  term.Drain();
+
+  // Paste a block in a single write; its latency runs to the final frame.
+  std::string paste;
+  for (int i = 0; i < 20; ++i)
+    paste += "pasted_line(" + std::to_string(i) + ");\r";
+  std::vector<double> latencies;
+  long pasteBytes = 0;
+  for (int i = 0; i < 5; ++i) {
+    auto pasteStart = Clock::now();
+    term.Send(paste);
+    long frames = term.WaitForFrames(paste.size());
+    if (frames < 0)
+      break;
+    latencies.push_back(microsSince(pasteStart));
+    pasteBytes += frames;
+  }
+  if (latencies.size() == 5)
+    results["paste"] = {percentile(latencies, 0.5),
+                        percentile(latencies, 0.99),
+                        static_cast<double>(pasteBytes) / (5 * paste.size())};
+  term.Drain();
+
+  // Incremental search for a term near the end of the file, stepping
+  // through matches, then accept.
+  keys.assign(1, "\x1f");
+  for (char c : std::to_string(FixtureLines - 7))
+    keys.emplace_back(1, c);
+  keys.insert(keys.end(), 10, "\x1b[B");
+  keys.emplace_back("\r");
+  if (timeKeys(term, keys, result))
+    results["search"] = result;
+
+  term.Quit();
+  unlink(fixture.c_str());
+
+  // Only the first frame of the large file, then quit while it still loads.
+  fixture = writeFixture(LargeFixtureLines);
+  Terminal large;
+  if (large.Spawn(kilo, fixture.c_str())) {
+    start = Clock::now();
+    bytes = large.WaitForFrames(1, 60000);
+    if (bytes >= 0) {
+      double micros = microsSince(start);
+      results["startup-large"] = {micros, micros, static_cast<double>(bytes)};
+    }
+    large.Quit();
+  }
+  unlink(fixture.c_str());
+  return results;
+}
+
+static std::map<std::string, Result> readBaseline(char const *path) {
+  std::map<std::string, Result> baseline;
+  std::ifstream in(path);
+  std::string line;
+  while (std::getline(in, line)) {
+    if (line.empty() || line[0] == '#')
+      continue;
+    std::istringstream fields(line);
+    std::string name;
+    Result result;
+    if (fields >> name >> result.p50 >> result.p99 >> result.bytesPerFrame)
+      baseline[name] = result;
+  }
+  return baseline;
+}
+
+static bool writeBaseline(char const *path,
+                          std::map<std::string, Result> const &results) {
+  FILE *fp = fopen(path, "w");
+  if (!fp)
+    return false;
+  fprintf(fp, "# scenario p50_us p99_us bytes_per_frame\n");
+  for (auto const &[name, result] : results)
+    fprintf(fp, "%s %.0f %.0f %.0f\n", name.c_str(), result.p50, result.p99,
+            result.bytesPerFrame);
+  fclose(fp);
+  return true;
+}
+
+int main(int argc, char **argv) {
+  if (argc < 3) {
+    fprintf(stderr, "usage: %s <kilo> <baseline> [--update-baseline]\n",
+            argv[0]);
+    return 2;
+  }
+
+  std::map<std::string, Result> results = run(argv[1]);
+  if (results.size() != 6) {
+    fprintf(stderr, "kilo stopped responding (%zu of 6 scenarios ran)\n",
+            results.size());
+    return 1;
+  }
+
+  printf("%-13s %12s %12s %16s\n", "scenario", "p50 (us)", "p99 (us)",
+         "bytes/frame");
+  for (auto const &[name, result] : results)
+    printf("%-13s %12.0f %12.0f %16.0f\n", name.c_str(), result.p50,
+           result.p99, result.bytesPerFrame);
+
+  if (argc > 3 && !strcmp(argv[3], "--update-baseline"))
+    return writeBaseline(argv[2], results) ? 0 : 1;
+
+  int status = 0;
+  std::map<std::string, Result> baseline = readBaseline(argv[2]);
+  for (auto const &[name, expected] : baseline) {
+    auto it = results.find(name);
+    if (it == results.end())
+      continue;
+    Result const &actual = it->second;
+    auto check = [&](char const *what, double got, double want, double factor,
+                     double slack) {
+      if (got > want * factor + slack) {
+        printf("REGRESSION %s %s: %.0f > baseline %.0f\n", name.c_str(), what,
+               got, want);
+        status = 1;
+      }
+    };
+    check("p50", actual.p50, expected.p50, LatencySlackFactor,
+          LatencySlackMicros);
+    check("p99", actual.p99, expected.p99, LatencySlackFactor,
+          LatencySlackMicros);
+    check("bytes/frame", actual.bytesPerFrame, expected.bytesPerFrame,
+          BytesSlackFactor, 0);
+  }
+  return status;
+}
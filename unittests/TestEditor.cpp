@@ -0,0 +1,953 @@
+#include <gtest/gtest.h>
+#include <Editor.hpp>
+
+#include <dirent.h>
+#include <fcntl.h>
+#include <stdlib.h>
+#include <sys/stat.h>
+#include <unistd.h>
+#include <zlib.h>
+
+#include <string>
+#include <vector>
+
+#include <Lexer.hpp>
+
+// Shows a new buffer named `filename` holding `lines`, fully highlighted,
+// with the cursor at its start. Frames are drawn to /dev/null.
+static Buffer *newBuffer(char const *filename,
+                         std::vector<std::string> const &lines) {
+  if (E.buf == nullptr) {
+    initEditor();
+    E.outputFd = open("/dev/null", O_WRONLY);
+  }
+  editorSwitchBuffer(editorNewBuffer(filename));
+  editorSelectSyntaxHighlight();
+  for (std::string const &line : lines)
+    editorInsertRow(E.buf->numRows, const_cast<char *>(line.data()),
+                    line.size());
+  editorHighlightSome(E.buf, E.buf->numRows);
+  E.buf->dirty = 0;
+  E.view.cursorX = 0;
+  E.view.cursorY = 0;
+  return E.buf;
+}
+
+static std::vector<std::string> bufferLines(Buffer *buf) {
+  std::vector<std::string> lines;
+  for (int y = 0; y < buf->numRows; ++y)
+    lines.emplace_back(editorRowText(&buf->row[y]), buf->row[y].size);
+  return lines;
+}
+
+// Handles `keys` as though they were typed, prompts included. The pipe they
+// come through is held open until they are all read, so that a prompt
+// waiting for more would hang rather than see the end of its input.
+static void typeKeys(std::string const &keys) {
+  int fds[2];
+  ASSERT_EQ(pipe(fds), 0);
+  ASSERT_EQ(write(fds[1], keys.data(), keys.size()),
+            static_cast<ssize_t>(keys.size()));
+  int inputFd = E.inputFd;
+  E.inputFd = fds[0];
+  while (editorInputPending())
+    editorProcessKeypress();
+  E.inputFd = inputFd;
+  close(fds[0]);
+  close(fds[1]);
+}
+
+TEST(TestEditor, TypesText) {
+  Buffer *buf = newBuffer("test.c", {"int x;"});
+  E.view.cursorX = 4;
+  typeKeys("yz");
+  ASSERT_EQ(bufferLines(buf), std::vector<std::string>{"int yzx;"});
+  ASSERT_EQ(E.view.cursorX, 6);
+  ASSERT_TRUE(buf->dirty);
+  editorCloseBuffer(buf);
+}
+
+TEST(TestEditor, SplitsAndJoinsRows) {
+  Buffer *buf = newBuffer("test.c", {"abcdef"});
+  E.view.cursorX = 3;
+  typeKeys("\r");
+  ASSERT_EQ(bufferLines(buf), (std::vector<std::string>{"abc", "def"}));
+  ASSERT_EQ(E.view.cursorY, 1);
+  ASSERT_EQ(E.view.cursorX, 0);
+  typeKeys(std::string(1, Key::BackSpace));
+  ASSERT_EQ(bufferLines(buf), std::vector<std::string>{"abcdef"});
+  ASSERT_EQ(E.view.cursorX, 3);
+  editorCloseBuffer(buf);
+}
+
+TEST(TestEditor, Goto) {
+  Buffer *buf = newBuffer("test.c", {"one", "two", "three", "four"});
+  ASSERT_TRUE(editorGoto("3"));
+  ASSERT_EQ(E.view.cursorY, 2);
+  ASSERT_TRUE(editorGoto("99"));
+  ASSERT_EQ(E.view.cursorY, 3);
+  ASSERT_TRUE(editorGoto("@9"));
+  ASSERT_EQ(E.view.cursorY, 2);
+  ASSERT_EQ(E.view.cursorX, 1);
+  ASSERT_TRUE(editorGoto("0%"));
+  ASSERT_EQ(E.view.cursorY, 0);
+  ASSERT_TRUE(editorGoto("62.5%"));
+  ASSERT_EQ(E.view.cursorY, 2);
+  ASSERT_TRUE(editorGoto("@0x4"));
+  ASSERT_EQ(E.view.cursorY, 1);
+  for (char const *target : {"0", "two", "2.7", "1e3", " 2", "+2", "-1", "",
+                             "2%x", "%", "nan%", "@", "@ 3", "@-1", "@3x"})
+    ASSERT_FALSE(editorGoto(target)) << target;
+  ASSERT_EQ(E.view.cursorY, 1);
+  editorCloseBuffer(buf);
+}
+
+// Sorting moves the rows other cursors were on, so the filter drops them.
+TEST(TestEditor, FilterClearsCursors) {
+  Buffer *buf = newBuffer("test.c", {"zzzz", "yy", "x"});
+  editorSetCursors({{2, 1}, {1, 2}});
+  typeKeys(std::string(1, addCtrl('\\')) + "sort\rQ");
+  ASSERT_EQ(bufferLines(buf),
+            (std::vector<std::string>{"Qx", "yy", "zzzz"}));
+  ASSERT_TRUE(E.view.cursors.empty());
+  editorCloseBuffer(buf);
+}
+
+// What a row in one piece holding `text` renders and highlights as, starting
+// in comment state `state`, and the screen column of each byte of it.
+struct FlatRow {
+  std::string render;
+  std::vector<unsigned char> hl;
+  std::vector<int> rx;
+  int openComment;
+};
+
+static FlatRow flatRow(Buffer *buf, std::string const &text, int state) {
+  Row row{};
+  row.size = text.size();
+  row.chars = const_cast<char *>(text.c_str());
+  editorRenderRow(&row);
+  row.hl = static_cast<unsigned char *>(RowPool.Allocate(row.rsize));
+  FlatRow flat;
+  flat.openComment =
+      buf->syntax->highlight(buf->syntax, &row, state) == Lexer::InBlockComment;
+  flat.render.assign(row.render, row.rsize);
+  flat.hl.assign(row.hl, row.hl + row.rsize);
+  for (int cx = 0; cx <= row.size; ++cx)
+    flat.rx.push_back(editorRowCxToRx(&row, cx));
+  RowPool.Deallocate(row.render);
+  RowPool.Deallocate(row.hl);
+  RowPool.Deallocate(row.stops);
+  return flat;
+}
+
+// Checks chunked row `y` of `buf` against `text` kept in one piece: its
+// text, rendering, highlighting, comment state and column mapping.
+static void checkChunkedRow(Buffer *buf, int y, std::string const &text) {
+  Row *row = &buf->row[y];
+  ASSERT_NE(row->chunks, nullptr);
+  ASSERT_EQ(std::string(editorRowText(row), row->size), text);
+  FlatRow flat =
+      flatRow(buf, text, y > 0 ? buf->row[y - 1].hl_open_comment : 0);
+
+  std::string render;
+  std::vector<unsigned char> hl;
+  std::vector<int> starts;
+  for (int k = 0; k < editorChunkCount(row); ++k) {
+    Row piece;
+    ColumnStop start = editorChunkPiece(buf, row, k, &piece);
+    starts.push_back(start.cxEnd);
+    ASSERT_EQ(start.renderEnd, static_cast<int>(render.size()));
+    ASSERT_EQ(start.rxEnd, flat.rx[start.cxEnd]);
+    render.append(piece.render, piece.rsize);
+    hl.insert(hl.end(), piece.hl, piece.hl + piece.rsize);
+  }
+  ASSERT_EQ(render, flat.render);
+  for (size_t j = 0; j < hl.size(); ++j)
+    ASSERT_EQ(hl[j], flat.hl[j]) << "at " << j;
+  ASSERT_EQ(row->rsize, static_cast<int>(flat.render.size()));
+  ASSERT_EQ(row->hl_open_comment, flat.openComment);
+
+  // Every character near the edge of a chunk, and a sample of the rest.
+  starts.push_back(row->size);
+  for (int start : starts) {
+    for (int cx = editorRowCharStart(row, std::max(start - 4, 0));
+         cx <= std::min(start + 4, row->size);
+         cx = editorRowNextBoundary(row, cx)) {
+      ASSERT_EQ(editorRowCxToRx(row, cx), flat.rx[cx]) << "at " << cx;
+      ASSERT_EQ(editorRowRxToCx(row, flat.rx[cx]), cx) << "at " << cx;
+      if (cx == row->size)
+        break;
+    }
+  }
+  for (int cx = 0; cx < row->size; cx += 97) {
+    cx = editorRowCharStart(row, cx);
+    ASSERT_EQ(editorRowCxToRx(row, cx), flat.rx[cx]) << "at " << cx;
+    ASSERT_EQ(editorRowRxToCx(row, flat.rx[cx]), cx) << "at " << cx;
+  }
+}
+
+// Pieces of C to build long rows from: tabs, multibyte characters, and what
+// opens and closes strings and comments. No keywords or numbers, which a
+// chunk may cut in two, and comment markers stand apart so that no `//`
+// forms to make the rest of the row one comment.
+static std::string randomText(int bytes) {
+  static char const *const Pieces[] = {
+      "xyz", " ", "\t", "\xc3\xa9", "\xe4\xb8\xad", "\"", "\\\"",
+      " /* ", " */ ", "zz",  "\t\t", "xx",       "y",              "  ",
+  };
+  std::string text;
+  while (static_cast<int>(text.size()) < bytes)
+    text += Pieces[rand() % (sizeof(Pieces) / sizeof(*Pieces))];
+  return text;
+}
+
+// Where chunk `k` of `row` starts.
+static int chunkStart(Buffer *buf, Row *row, int k) {
+  Row piece;
+  return editorChunkPiece(buf, row, k, &piece).cxEnd;
+}
+
+// Random edits of a long row, kept in one piece alongside, at random places
+// and right at the edges of its chunks.
+TEST(TestEditor, ChunkedRowMatchesFlat) {
+  srand(42);
+  std::string text = randomText(LongRowBytes + 8 * 1024);
+  Buffer *buf = newBuffer("test.c", {"/* open", text, "after */ x"});
+  Row *row = &buf->row[1];
+  checkChunkedRow(buf, 1, text);
+
+  for (int i = 0; i < 200; ++i) {
+    int at = rand() % 2 ? rand() % (row->size + 1)
+                        : chunkStart(buf, row, rand() % editorChunkCount(row));
+    at = editorRowCharStart(row, at);
+    switch (rand() % 3) {
+    case 0: {
+      std::string s = randomText(rand() % 8 + 1);
+      editorRowInsertString(row, at, s.data(), s.size());
+      text.insert(at, s);
+      break;
+    }
+    case 1:
+      // Just before the edge of a chunk, the character is the last of the
+      // chunk before.
+      at = editorRowPrevBoundary(row, at);
+      [[fallthrough]];
+    case 2:
+      if (at < row->size) {
+        int len = editorRowNextBoundary(row, at) - at;
+        editorRowDelChar(row, at);
+        text.erase(at, len);
+      }
+      break;
+    }
+    checkChunkedRow(buf, 1, text);
+  }
+  editorCloseBuffer(buf);
+}
+
+// A chunk that grows to twice ChunkBytes is split, and one emptied by
+// deletes goes away.
+TEST(TestEditor, ChunksSplitAndEmpty) {
+  srand(7);
+  std::string text = randomText(LongRowBytes);
+  Buffer *buf = newBuffer("test.c", {text});
+  Row *row = &buf->row[0];
+  int chunks = editorChunkCount(row);
+
+  int at = editorRowCharStart(row, chunkStart(buf, row, 3) + 10);
+  std::string s = randomText(2 * 4096);
+  editorRowInsertString(row, at, s.data(), s.size());
+  text.insert(at, s);
+  ASSERT_GT(editorChunkCount(row), chunks + 1);
+  checkChunkedRow(buf, 0, text);
+
+  chunks = editorChunkCount(row);
+  at = chunkStart(buf, row, 2);
+  int end = chunkStart(buf, row, 3);
+  while (end > at) {
+    int len = editorRowNextBoundary(row, at) - at;
+    editorRowDelChar(row, at);
+    text.erase(at, len);
+    end -= len;
+    if (end % 64 == 0)
+      checkChunkedRow(buf, 0, text);
+  }
+  ASSERT_EQ(editorChunkCount(row), chunks - 1);
+  checkChunkedRow(buf, 0, text);
+  editorCloseBuffer(buf);
+}
+
+// A tab's width depends on the column it starts at, so chunks with tabs that
+// an edit moves by less than a tab stop are measured again. Those without
+// just move.
+TEST(TestEditor, ChunksRemeasureTabs) {
+  std::string text(LongRowBytes / 2, 'y');
+  while (text.size() < static_cast<size_t>(LongRowBytes))
+    text += "x\ty\t\xc3\xa9\t";
+  Buffer *buf = newBuffer("test.c", {text});
+  Row *row = &buf->row[0];
+  for (int i = 0; i < 5; ++i) {
+    editorRowInsertChar(row, 1, 'z');
+    text.insert(1, "z");
+    checkChunkedRow(buf, 0, text);
+  }
+  for (int i = 0; i < 3; ++i) {
+    editorRowDelChar(row, 0);
+    text.erase(0, 1);
+    checkChunkedRow(buf, 0, text);
+  }
+  editorCloseBuffer(buf);
+}
+
+// Opening a string or comment in the first chunk changes how every chunk
+// after it is highlighted, and the rows after it.
+TEST(TestEditor, ChunksCarryState) {
+  std::string text(LongRowBytes, 'x');
+  Buffer *buf = newBuffer("test.c", {text, "y"});
+  Row *row = &buf->row[0];
+  for (char const *s : {"\"", "\"", "/*", "//"}) {
+    editorRowInsertString(row, 0, s, strlen(s));
+    text.insert(0, s);
+    checkChunkedRow(buf, 0, text);
+    ASSERT_EQ(buf->row[1].hl[0], text[0] == '/' && text[1] == '*'
+                                     ? Highlight::MultiLineComment
+                                     : Highlight::Normal);
+  }
+  editorCloseBuffer(buf);
+}
+
+// `lines` with every `query` in them replaced.
+static std::vector<std::string> replaced(std::vector<std::string> lines,
+                                         std::string const &query,
+                                         std::string const &replacement) {
+  for (std::string &line : lines)
+    for (size_t at = line.find(query); at != std::string::npos;
+         at = line.find(query, at + replacement.size()))
+      line.replace(at, query.size(), replacement);
+  return lines;
+}
+
+// Enough rows to be split between replace worker threads, some of them
+// packed away cold and one long enough to be in chunks.
+static std::vector<std::string> replaceLines() {
+  std::vector<std::string> lines;
+  for (int i = 0; i < 40000; ++i)
+    lines.push_back(i % 3 ? "  return argc + " + std::to_string(i) + ";"
+                          : "int x = " + std::to_string(i) + ";");
+  std::string text;
+  while (text.size() < static_cast<size_t>(LongRowBytes))
+    text += "argc, \"argc\" /* argc */ ";
+  lines[20000] = text;
+  return lines;
+}
+
+TEST(TestEditor, ReplaceAllUndo) {
+  std::vector<std::string> lines = replaceLines();
+  Buffer *buf = newBuffer("test.c", lines);
+  E.memoryBudget = 1;
+  while (editorCompactSome(buf, buf->numRows))
+    ;
+  ASSERT_NE(buf->row[lines.size() - 1].cold, nullptr);
+  ASSERT_NE(buf->row[20000].chunks, nullptr);
+  unsigned long version = buf->version;
+
+  int rows;
+  int count = editorReplaceAll("argc", "count", &rows);
+  std::vector<std::string> after = replaced(lines, "argc", "count");
+  ASSERT_EQ(bufferLines(buf), after);
+  ASSERT_EQ(rows, 26666);
+  ASSERT_EQ(count, 26665 + 3 * static_cast<int>(lines[20000].size() / 24));
+  ASSERT_EQ(buf->undo.size(), 1u);
+
+  editorUndo();
+  ASSERT_EQ(bufferLines(buf), lines);
+  ASSERT_EQ(buf->version, version);
+  ASSERT_TRUE(buf->undo.empty());
+  E.memoryBudget = 0;
+  editorCloseBuffer(buf);
+}
+
+TEST(TestEditor, ReplaceAllWithNothingUndo) {
+  std::vector<std::string> lines = {"argc argc", "x", "", "(argc)"};
+  Buffer *buf = newBuffer("test.c", lines);
+  ASSERT_EQ(editorReplaceAll("argc", ""), 3);
+  ASSERT_EQ(bufferLines(buf),
+            (std::vector<std::string>{" ", "x", "", "()"}));
+  editorUndo();
+  ASSERT_EQ(bufferLines(buf), lines);
+  editorCloseBuffer(buf);
+}
+
+// Rows are saved by index, so an edit since leaves nothing to undo.
+TEST(TestEditor, UndoRefusedAfterEdit) {
+  Buffer *buf = newBuffer("test.c", {"argc", "argc"});
+  editorReplaceAll("argc", "n");
+  E.view.cursorY = 0;
+  E.view.cursorX = 0;
+  editorInsertRow(0, const_cast<char *>("new"), 3);
+  ASSERT_NE(buf->undo.back().after, buf->version);
+  editorUndo();
+  ASSERT_EQ(bufferLines(buf),
+            (std::vector<std::string>{"new", "n", "n"}));
+  ASSERT_TRUE(buf->undo.empty());
+  ASSERT_STREQ(E.statusmsg, "Can't undo: the buffer was edited since");
+  editorCloseBuffer(buf);
+}
+
+// Only the last UndoDepth (8) replaces can be undone.
+TEST(TestEditor, UndoDepth) {
+  Buffer *buf = newBuffer("test.c", {"v0", "x"});
+  for (int i = 0; i < 10; ++i)
+    ASSERT_EQ(editorReplaceAll(("v" + std::to_string(i)).c_str(),
+                               ("v" + std::to_string(i + 1)).c_str()),
+              1);
+  ASSERT_EQ(buf->undo.size(), 8u);
+  for (int i = 10; i > 2; --i) {
+    ASSERT_EQ(bufferLines(buf)[0], "v" + std::to_string(i));
+    editorUndo();
+  }
+  ASSERT_EQ(bufferLines(buf)[0], "v2");
+  editorUndo();
+  ASSERT_EQ(bufferLines(buf)[0], "v2");
+  ASSERT_STREQ(E.statusmsg, "Nothing to undo");
+  editorCloseBuffer(buf);
+}
+
+static void select(Cursor from, Cursor to) {
+  E.view.selecting = true;
+  E.view.anchor = from;
+  E.view.cursorX = to.x;
+  E.view.cursorY = to.y;
+}
+
+static std::vector<std::string> clipboardLines() {
+  std::vector<std::string> lines;
+  for (Row const &row : E.clipboard)
+    lines.emplace_back(editorRowText(&row), row.size);
+  return lines;
+}
+
+static std::string joinLines(std::vector<std::string> const &lines) {
+  std::string text;
+  for (std::string const &line : lines)
+    text += line + "\n";
+  return text;
+}
+
+static std::vector<std::string> splitLines(std::string const &text) {
+  std::vector<std::string> lines;
+  for (size_t at = 0; at < text.size();) {
+    size_t end = text.find('\n', at);
+    lines.push_back(text.substr(at, end - at));
+    at = end + 1;
+  }
+  return lines;
+}
+
+static size_t offsetOf(std::vector<std::string> const &lines, Cursor at) {
+  size_t offset = at.x;
+  for (int y = 0; y < at.y; ++y)
+    offset += lines[y].size() + 1;
+  return offset;
+}
+
+// Copied lines share their rows' storage, but editing either side leaves the
+// other as it was.
+TEST(TestEditor, ClipboardCopyOnWrite) {
+  Buffer *buf = newBuffer("test.c", {"int a;", "int b;", "int c;", "x"});
+  select({0, 0}, {0, 3});
+  editorCopy();
+  std::vector<std::string> copied = {"int a;", "int b;", "int c;", ""};
+  ASSERT_EQ(clipboardLines(), copied);
+  ASSERT_EQ(E.clipboard[1].chars, buf->row[1].chars);
+
+  editorRowInsertString(&buf->row[1], 4, "not_", 4);
+  ASSERT_EQ(bufferLines(buf)[1], "int not_b;");
+  ASSERT_EQ(clipboardLines(), copied);
+  ASSERT_EQ(std::string(E.clipboard[1].render, E.clipboard[1].rsize),
+            "int b;");
+
+  E.view.cursorY = 4;
+  E.view.cursorX = 0;
+  editorPaste();
+  editorRowDelChar(&buf->row[5], 0);
+  ASSERT_EQ(bufferLines(buf),
+            (std::vector<std::string>{"int a;", "int not_b;", "int c;", "x",
+                                      "int a;", "nt b;", "int c;", ""}));
+  ASSERT_EQ(clipboardLines(), copied);
+  editorCloseBuffer(buf);
+}
+
+// Cuts a range from inside one cold row to inside a chunked one and pastes
+// it back, then again elsewhere.
+TEST(TestEditor, CutPasteColdAndChunked) {
+  std::vector<std::string> lines;
+  for (int i = 0; i < 2000; ++i)
+    lines.push_back("  int line" + std::to_string(i) + " = " +
+                    std::to_string(i) + ";");
+  std::string text;
+  while (text.size() < static_cast<size_t>(LongRowBytes))
+    text += "\tint x = \"long\\trow\"; /* \xc3\xa9 */";
+  lines[1500] = text;
+  Buffer *buf = newBuffer("test.c", lines);
+  E.memoryBudget = 1;
+  while (editorCompactSome(buf, buf->numRows))
+    ;
+  ASSERT_NE(buf->row[100].cold, nullptr);
+  ASSERT_NE(buf->row[1500].chunks, nullptr);
+
+  Cursor from{3, 100}, to{7, 1999};
+  std::string all = joinLines(lines);
+  std::string cut = all.substr(offsetOf(lines, from),
+                               offsetOf(lines, to) - offsetOf(lines, from));
+  select(from, to);
+  editorCut();
+  ASSERT_EQ(joinLines(clipboardLines()), cut + "\n");
+  ASSERT_EQ(bufferLines(buf),
+            splitLines(std::string(all).erase(offsetOf(lines, from),
+                                              cut.size())));
+  ASSERT_EQ(E.view.cursorX, from.x);
+  ASSERT_EQ(E.view.cursorY, from.y);
+
+  editorPaste();
+  ASSERT_EQ(bufferLines(buf), lines);
+  ASSERT_EQ(E.view.cursorX, to.x);
+  ASSERT_EQ(E.view.cursorY, to.y);
+
+  E.view.cursorX = 0;
+  E.view.cursorY = 0;
+  editorPaste();
+  ASSERT_EQ(bufferLines(buf), splitLines(cut + all));
+  ASSERT_EQ(buf->row[1400].size, static_cast<int>(text.size()));
+  E.memoryBudget = 0;
+  editorCloseBuffer(buf);
+}
+
+static std::string readFile(std::string const &path) {
+  std::string contents;
+  FILE *fp = fopen(path.c_str(), "r");
+  if (fp == nullptr)
+    return contents;
+  char buffer[4096];
+  for (size_t n; (n = fread(buffer, 1, sizeof(buffer), fp)) > 0;)
+    contents.append(buffer, n);
+  fclose(fp);
+  unlink(path.c_str());
+  return contents;
+}
+
+static std::string tempPath(char const *name) {
+  char const *dir = getenv("TMPDIR");
+  return std::string(dir ? dir : "/tmp") + "/" + name;
+}
+
+// Ctrl-S with a selection writes it to a file, or to a command's input.
+TEST(TestEditor, WriteSelection) {
+  Buffer *buf = newBuffer("test.c", {"one", "two", "three"});
+  std::string path = tempPath("kilo-test-selection");
+  select({1, 0}, {2, 2});
+  typeKeys(std::string(1, addCtrl('s')) + path + "\r");
+  ASSERT_EQ(readFile(path), "ne\ntwo\nth");
+  ASSERT_STREQ(E.statusmsg, ("9 bytes written to " + path).c_str());
+  ASSERT_FALSE(E.view.selecting);
+
+  select({0, 1}, {0, 3});
+  typeKeys(std::string(1, addCtrl('s')) + "|tr a-z A-Z >" + path + "\r");
+  ASSERT_EQ(readFile(path), "TWO\nTHREE\n");
+
+  select({0, 0}, {0, 1});
+  typeKeys(std::string(1, addCtrl('s')) + "|exit 3\r");
+  ASSERT_STREQ(E.statusmsg, "exit 3 exited with status 3");
+  ASSERT_TRUE(E.view.selecting);
+  E.view.selecting = false;
+  editorCloseBuffer(buf);
+}
+
+static std::string const Backspace(1, Key::BackSpace);
+static std::string const DeleteKey = "\x1b[3~";
+
+// The main cursor goes at `cursors[0]`.
+static void placeCursors(std::vector<Cursor> cursors) {
+  E.view.cursorX = cursors[0].x;
+  E.view.cursorY = cursors[0].y;
+  editorSetCursors(std::move(cursors));
+}
+
+static std::vector<Cursor> allCursors() {
+  std::vector<Cursor> all = E.view.cursors;
+  all.push_back({E.view.cursorX, E.view.cursorY});
+  std::sort(all.begin(), all.end());
+  return all;
+}
+
+TEST(TestEditor, CursorsEditOneRow) {
+  Buffer *buf = newBuffer("test.c", {"abcdef", "ghi"});
+  placeCursors({{1, 0}, {3, 0}, {5, 0}, {1, 1}});
+  typeKeys("XY");
+  ASSERT_EQ(bufferLines(buf),
+            (std::vector<std::string>{"aXYbcXYdeXYf", "gXYhi"}));
+  ASSERT_EQ(allCursors(),
+            (std::vector<Cursor>{{3, 0}, {7, 0}, {11, 0}, {3, 1}}));
+  ASSERT_EQ(E.view.cursorX, 3);
+  ASSERT_EQ(E.view.cursorY, 0);
+
+  typeKeys(Backspace);
+  ASSERT_EQ(bufferLines(buf),
+            (std::vector<std::string>{"aXbcXdeXf", "gXhi"}));
+  typeKeys(DeleteKey);
+  ASSERT_EQ(bufferLines(buf), (std::vector<std::string>{"aXcXeX", "gXi"}));
+  ASSERT_EQ(allCursors(),
+            (std::vector<Cursor>{{2, 0}, {4, 0}, {6, 0}, {2, 1}}));
+  editorClearCursors();
+  editorCloseBuffer(buf);
+}
+
+// Cursors that end up in the same place become one.
+TEST(TestEditor, CursorsMerge) {
+  Buffer *buf = newBuffer("test.c", {"abc", "defg"});
+  placeCursors({{2, 0}, {1, 0}, {3, 1}});
+  typeKeys(Backspace);
+  ASSERT_EQ(bufferLines(buf), (std::vector<std::string>{"c", "deg"}));
+  ASSERT_EQ(allCursors(), (std::vector<Cursor>{{0, 0}, {2, 1}}));
+
+  placeCursors({{0, 1}, {1, 1}, {2, 1}});
+  typeKeys(std::string(1, addCtrl('a')));
+  ASSERT_TRUE(E.view.cursors.empty());
+  ASSERT_EQ(E.view.cursorX, 0);
+  ASSERT_EQ(E.view.cursorY, 1);
+  editorCloseBuffer(buf);
+}
+
+// Each cursor deletes a whole character, however many bytes it takes.
+TEST(TestEditor, CursorsDeleteUtf8) {
+  Buffer *buf = newBuffer("test.c", {"\xc3\xa9" "1\xe4\xb8\xad" "2",
+                                     "\xc3\xa9x\xe4\xb8\xady"});
+  placeCursors({{2, 0}, {6, 0}});
+  typeKeys(Backspace);
+  ASSERT_EQ(bufferLines(buf)[0], "12");
+  ASSERT_EQ(allCursors(), (std::vector<Cursor>{{0, 0}, {1, 0}}));
+  placeCursors({{0, 1}, {3, 1}});
+  typeKeys(DeleteKey);
+  ASSERT_EQ(bufferLines(buf)[1], "xy");
+  ASSERT_EQ(allCursors(), (std::vector<Cursor>{{0, 1}, {1, 1}}));
+  editorClearCursors();
+  editorCloseBuffer(buf);
+}
+
+// Deleting at the edge of a row would join it to the next and move every
+// cursor below, so those cursors delete nothing.
+TEST(TestEditor, CursorsStopAtRowEdges) {
+  Buffer *buf = newBuffer("test.c", {"ab", "cd", "ef"});
+  placeCursors({{0, 1}, {0, 2}, {2, 0}});
+  unsigned long version = buf->version;
+  typeKeys(Backspace);
+  ASSERT_EQ(bufferLines(buf), (std::vector<std::string>{"a", "cd", "ef"}));
+  ASSERT_EQ(allCursors(), (std::vector<Cursor>{{1, 0}, {0, 1}, {0, 2}}));
+  ASSERT_NE(buf->version, version);
+
+  placeCursors({{2, 1}, {2, 2}});
+  version = buf->version;
+  typeKeys(DeleteKey);
+  ASSERT_EQ(bufferLines(buf), (std::vector<std::string>{"a", "cd", "ef"}));
+  ASSERT_EQ(buf->version, version);
+  editorClearCursors();
+  editorCloseBuffer(buf);
+}
+
+static void writeFile(std::string const &path, std::string const &contents) {
+  FILE *fp = fopen(path.c_str(), "w");
+  fwrite(contents.data(), 1, contents.size(), fp);
+  fclose(fp);
+}
+
+// A C file with a comment running over several rows, and its lines.
+static std::vector<std::string> sessionLines() {
+  std::vector<std::string> lines;
+  for (int i = 0; i < 100; ++i)
+    lines.push_back(i % 10 == 2   ? "  /* opens"
+                    : i % 10 == 5 ? "  closes */"
+                                  : "  int x" + std::to_string(i) + ";");
+  return lines;
+}
+
+static Buffer *openFile(std::string const &path) {
+  Buffer *buf = editorOpen(path.c_str());
+  editorFinishLoad(buf);
+  editorHighlightSome(buf, buf->numRows);
+  return buf;
+}
+
+// The comment state every row of `buf` ends in.
+static std::vector<int> commentStates(Buffer *buf) {
+  std::vector<int> states;
+  for (int y = 0; y < buf->numRows; ++y)
+    states.push_back(buf->row[y].hl_open_comment);
+  return states;
+}
+
+// Sessions of files in a scratch directory, each test starting with one
+// saved for `path` holding sessionLines(), closed with the cursor at (3, 47).
+class TestSession : public testing::Test {
+protected:
+  void SetUp() override {
+    dir = tempPath(("kilo-test-sessions-" + std::to_string(getpid())).c_str());
+    path = dir + "-file.c";
+    newBuffer(nullptr, {});
+    E.sessionDir = dir;
+    lines = sessionLines();
+    writeFile(path, joinLines(lines));
+    Buffer *buf = openFile(path);
+    E.view.cursorX = 3;
+    E.view.cursorY = 47;
+    E.view.rowOffset = 40;
+    editorCloseBuffer(buf);
+    stat(path.c_str(), &st);
+  }
+
+  void TearDown() override {
+    E.sessionDir.clear();
+    unlink(path.c_str());
+    unlink(sessionPath().c_str());
+    rmdir(dir.c_str());
+  }
+
+  // The one session in the directory.
+  std::string sessionPath() {
+    std::string found;
+    DIR *d = opendir(dir.c_str());
+    while (dirent *entry = d ? readdir(d) : nullptr)
+      if (entry->d_name[0] != '.')
+        found = dir + "/" + entry->d_name;
+    if (d)
+      closedir(d);
+    return found;
+  }
+
+  // Rewrites the file with `contents`, as of the time it had before.
+  void rewrite(std::string const &contents) {
+    writeFile(path, contents);
+    struct timespec times[2] = {st.st_atim, st.st_mtim};
+    utimensat(AT_FDCWD, path.c_str(), times, 0);
+  }
+
+  // Whether the file as it is now has a session that fits it.
+  bool sessionFits() {
+    struct stat now;
+    stat(path.c_str(), &now);
+    Session *session = editorOpenSession(path.c_str(), now, nullptr);
+    editorCloseSession(session);
+    return session != nullptr;
+  }
+
+  // Opens the file, checks its lines and comment states against those of
+  // the file opened without a session, and closes it.
+  void checkOpens(std::vector<std::string> const &expected) {
+    Buffer *buf = openFile(path);
+    ASSERT_EQ(bufferLines(buf), expected);
+    std::vector<int> states = commentStates(buf);
+    E.sessionDir.clear();
+    editorCloseBuffer(buf);
+    buf = openFile(path);
+    ASSERT_EQ(commentStates(buf), states);
+    editorCloseBuffer(buf);
+    E.sessionDir = dir;
+  }
+
+  std::string dir;
+  std::string path;
+  std::vector<std::string> lines;
+  struct stat st;
+};
+
+TEST_F(TestSession, RestoresView) {
+  ASSERT_TRUE(sessionFits());
+  Buffer *buf = openFile(path);
+  ASSERT_EQ(bufferLines(buf), lines);
+  ASSERT_EQ(E.view.cursorX, 3);
+  ASSERT_EQ(E.view.cursorY, 47);
+  ASSERT_EQ(E.view.rowOffset, 40);
+  ASSERT_EQ(commentStates(buf)[3], 1);
+  ASSERT_EQ(commentStates(buf)[5], 0);
+  editorCloseBuffer(buf);
+}
+
+TEST_F(TestSession, IgnoresTruncated) {
+  std::string session = sessionPath();
+  struct stat sst;
+  stat(session.c_str(), &sst);
+  for (off_t size : {sst.st_size - 1, off_t(40), off_t(0)}) {
+    truncate(session.c_str(), size);
+    ASSERT_FALSE(sessionFits()) << size;
+  }
+  checkOpens(lines);
+}
+
+// Flips a byte of the header's magic, format and size, of a line length,
+// and of the file's path.
+TEST_F(TestSession, IgnoresCorrupted) {
+  std::string session = sessionPath();
+  std::string contents = readFile(session);
+  for (size_t at : {size_t(0), size_t(8), size_t(16), size_t(72),
+                    contents.size() - 8}) {
+    std::string corrupted = contents;
+    corrupted[at] ^= 0x40;
+    writeFile(session, corrupted);
+    if (at != 72) {
+      ASSERT_FALSE(sessionFits()) << at;
+    }
+    checkOpens(lines);
+  }
+
+  // A first line length, after the 72 bytes of header, that takes in the
+  // next line too, which ends in a newline just the same.
+  std::string corrupted = contents;
+  uint32_t length = lines[0].size() + 1 + lines[1].size();
+  memcpy(&corrupted[72], &length, sizeof(length));
+  writeFile(session, corrupted);
+  ASSERT_TRUE(sessionFits());
+  checkOpens(lines);
+}
+
+TEST_F(TestSession, IgnoresOtherSizeOrTime) {
+  lines.push_back("int y;");
+  writeFile(path, joinLines(lines));
+  ASSERT_FALSE(sessionFits());
+  checkOpens(lines);
+
+  lines.pop_back();
+  rewrite(joinLines(lines));
+  ASSERT_TRUE(sessionFits());
+  struct timespec times[2] = {st.st_atim, {st.st_mtim.tv_sec + 1, 0}};
+  utimensat(AT_FDCWD, path.c_str(), times, 0);
+  ASSERT_FALSE(sessionFits());
+  checkOpens(lines);
+}
+
+// Contents changed without the size or time changing: the rows are
+// highlighted afresh, and if the lines moved, cut afresh too.
+TEST_F(TestSession, HashMismatch) {
+  lines[2] = "  // opens";
+  rewrite(joinLines(lines));
+  ASSERT_TRUE(sessionFits());
+  checkOpens(lines);
+
+  // Cut at the old length, the row takes in the new line break.
+  lines[1] = "  int";
+  lines.insert(lines.begin() + 2, "x1;");
+  rewrite(joinLines(lines));
+  ASSERT_TRUE(sessionFits());
+  checkOpens(lines);
+}
+
+// Appends a gzip member holding `text` to `path`.
+static void appendGzip(std::string const &path, std::string const &text,
+                       char const *mode = "ab") {
+  gzFile gz = gzopen(path.c_str(), mode);
+  gzwrite(gz, text.data(), text.size());
+  gzclose(gz);
+}
+
+// Lines that barely compress, so a gzip file of them is cut short easily.
+static std::vector<std::string> noiseLines(int count) {
+  std::vector<std::string> lines;
+  srand(3);
+  for (int i = 0; i < count; ++i) {
+    std::string line;
+    for (int j = rand() % 60; j > 0; --j)
+      line += 'a' + rand() % 26;
+    lines.push_back(line);
+  }
+  return lines;
+}
+
+// Concatenated gzip members read as one file, even with a line split
+// between two of them.
+TEST(TestEditor, GzipMembers) {
+  std::string path = tempPath("kilo-test-members.c.gz");
+  unlink(path.c_str());
+  appendGzip(path, "int one;\ntwo", "wb");
+  appendGzip(path, "_halves;\n");
+  appendGzip(path, "three\n");
+  newBuffer(nullptr, {});
+  E.statusmsg[0] = '\0';
+  Buffer *buf = openFile(path);
+  ASSERT_TRUE(buf->gzip);
+  ASSERT_EQ(bufferLines(buf),
+            (std::vector<std::string>{"int one;", "two_halves;", "three"}));
+  ASSERT_STREQ(E.statusmsg, "");
+  editorCloseBuffer(buf);
+  unlink(path.c_str());
+}
+
+// A gzip file cut short keeps the lines read before the cut, and says so.
+// One garbled only shows it once what follows fails to inflate or to match
+// the checksum, but says so too.
+TEST(TestEditor, GzipDamaged) {
+  std::string path = tempPath("kilo-test-damaged.gz");
+  std::vector<std::string> lines = noiseLines(20000);
+  appendGzip(path, joinLines(lines), "wb");
+  std::string contents = readFile(path);
+
+  writeFile(path, contents.substr(0, contents.size() / 2));
+  newBuffer(nullptr, {});
+  Buffer *buf = openFile(path);
+  std::vector<std::string> read = bufferLines(buf);
+  ASSERT_GT(read.size(), 100u);
+  ASSERT_LT(read.size(), lines.size());
+  for (size_t y = 0; y + 1 < read.size(); ++y)
+    ASSERT_EQ(read[y], lines[y]);
+  ASSERT_EQ(lines[read.size() - 1].compare(0, read.back().size(),
+                                           read.back()),
+            0);
+  ASSERT_EQ(std::string(E.statusmsg), path + ": file is truncated");
+  editorCloseBuffer(buf);
+
+  contents[contents.size() / 2] ^= 0xff;
+  writeFile(path, contents);
+  newBuffer(nullptr, {});
+  E.statusmsg[0] = '\0';
+  buf = openFile(path);
+  read = bufferLines(buf);
+  ASSERT_GT(read.size(), 100u);
+  for (size_t y = 0; y < 100; ++y)
+    ASSERT_EQ(read[y], lines[y]);
+  ASSERT_EQ(std::string(E.statusmsg).find(path + ": "), 0u) << E.statusmsg;
+  editorCloseBuffer(buf);
+  unlink(path.c_str());
+}
+
+// Saving a *.gz buffer compresses it at E.gzipLevel, and it opens again
+// as it was.
+TEST(TestEditor, GzipSaveOpen) {
+  std::string path = tempPath("kilo-test-save.c.gz");
+  std::vector<std::string> lines = noiseLines(2000);
+  for (int i = 0; i < 2000; ++i)
+    lines.push_back("  int x = 1; // the same every time");
+  std::string text = joinLines(lines);
+  std::vector<off_t> sizes;
+  for (int level : {0, 1, 9, -1}) {
+    Buffer *buf = newBuffer(path.c_str(), lines);
+    ASSERT_TRUE(buf->gzip);
+    E.gzipLevel = level;
+    editorSave();
+    struct stat st;
+    stat(path.c_str(), &st);
+    sizes.push_back(st.st_size);
+    ASSERT_EQ(std::string(E.statusmsg),
+              std::to_string(text.size()) + " bytes written to disk, " +
+                  std::to_string(st.st_size) + " compressed");
+    editorCloseBuffer(buf);
+
+    buf = openFile(path);
+    ASSERT_TRUE(buf->gzip);
+    ASSERT_EQ(bufferLines(buf), lines);
+    editorCloseBuffer(buf);
+  }
+  E.gzipLevel = -1;
+  ASSERT_GT(sizes[0], static_cast<off_t>(text.size()));
+  ASSERT_LT(sizes[1], static_cast<off_t>(text.size()));
+  ASSERT_LE(sizes[2], sizes[1]);
+  ASSERT_LE(sizes[3], sizes[1]);
+  unlink(path.c_str());
+}
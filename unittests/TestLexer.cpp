@@ -0,0 +1,145 @@
+#include <gtest/gtest.h>
+#include <Lexer.hpp>
+
+#include <string>
+
+// One letter per token, so expected highlighting reads like the text.
+static unsigned char const Letters[Lexer::NumTokens] = {'.', 'c', 'b', 's',
+                                                        'n', 'k', 't'};
+
+static std::unique_ptr<Lexer> compile(char const *definition) {
+  LexerSpec spec;
+  std::string error;
+  EXPECT_TRUE(parseLexerSpec(definition, spec, error)) << error;
+  auto lexer = Lexer::Compile(spec, Letters, error);
+  EXPECT_TRUE(lexer) << error;
+  return lexer;
+}
+
+static std::string scan(Lexer const &lexer, std::string const &text,
+                        bool *inBlock = nullptr) {
+  std::string hl(text.size(), '?');
+  bool open = lexer.Scan(text.data(), text.size(),
+                         reinterpret_cast<unsigned char *>(hl.data()),
+                         inBlock && *inBlock);
+  if (inBlock)
+    *inBlock = open;
+  return hl;
+}
+
+static char const *const CLike = "name = c\n"
+                                 "files = .c .h\n"
+                                 "keywords = if while return\n"
+                                 "types = int char\n"
+                                 "line_comment = //\n"
+                                 "block_comment = /* */\n"
+                                 "strings = \" '\n"
+                                 "numbers = yes\n";
+
+TEST(TestLexer, ParseSpec) {
+  LexerSpec spec;
+  std::string error;
+  ASSERT_TRUE(parseLexerSpec(CLike, spec, error)) << error;
+  ASSERT_EQ(spec.name, "c");
+  ASSERT_EQ(spec.files, (std::vector<std::string>{".c", ".h"}));
+  ASSERT_EQ(spec.keywords.size(), 3u);
+  ASSERT_EQ(spec.types.size(), 2u);
+  ASSERT_EQ(spec.lineComments, (std::vector<std::string>{"//"}));
+  ASSERT_EQ(spec.blockCommentStart, "/*");
+  ASSERT_EQ(spec.blockCommentEnd, "*/");
+  ASSERT_EQ(spec.quotes, "\"'");
+  ASSERT_EQ(spec.escape, '\\');
+  ASSERT_TRUE(spec.numbers);
+}
+
+TEST(TestLexer, ParseErrors) {
+  LexerSpec spec;
+  std::string error;
+  ASSERT_FALSE(parseLexerSpec("name = x\nbogus = 1\n", spec, error));
+  ASSERT_EQ(error, "line 2: unknown key `bogus`");
+  ASSERT_FALSE(parseLexerSpec("# no name\nfiles = .x\n", spec, error));
+  ASSERT_FALSE(parseLexerSpec("name x\n", spec, error));
+  ASSERT_EQ(error, "line 1: expected `key = value`");
+  ASSERT_FALSE(parseLexerSpec("name = x\nstrings = ''\n", spec, error));
+  ASSERT_FALSE(parseLexerSpec("name = x\nblock_comment = {-\n", spec, error));
+}
+
+TEST(TestLexer, CompileErrors) {
+  LexerSpec spec;
+  spec.name = "x";
+  std::string error;
+  spec.keywords = {"not-a-word"};
+  ASSERT_FALSE(Lexer::Compile(spec, Letters, error));
+  spec.keywords = {};
+  spec.lineComments = {"rem"};
+  ASSERT_FALSE(Lexer::Compile(spec, Letters, error));
+  spec.lineComments = {"--", "-->"};
+  ASSERT_FALSE(Lexer::Compile(spec, Letters, error));
+}
+
+TEST(TestLexer, KeywordsOnlyAsWholeWords) {
+  auto lexer = compile(CLike);
+  ASSERT_EQ(scan(*lexer, "if iffy i int x_int"), "kk........ttt......");
+  ASSERT_EQ(scan(*lexer, "while(x)return;"), "kkkkk...kkkkkk.");
+}
+
+TEST(TestLexer, Numbers) {
+  auto lexer = compile(CLike);
+  ASSERT_EQ(scan(*lexer, "x1 = 12.5 + 0x1F;"), ".....nnnn...nnnn.");
+}
+
+TEST(TestLexer, Strings) {
+  auto lexer = compile(CLike);
+  ASSERT_EQ(scan(*lexer, "\"a\\\"b\" 'c' \"open"), "ssssss.sss.sssss");
+  ASSERT_EQ(scan(*lexer, "\"// not a comment\""), "ssssssssssssssssss");
+}
+
+TEST(TestLexer, Comments) {
+  auto lexer = compile(CLike);
+  ASSERT_EQ(scan(*lexer, "x / y // if"), "......ccccc");
+  bool inBlock = false;
+  ASSERT_EQ(scan(*lexer, "int /* if", &inBlock), "ttt.bbbbb");
+  ASSERT_TRUE(inBlock);
+  ASSERT_EQ(scan(*lexer, "", &inBlock), "");
+  ASSERT_TRUE(inBlock);
+  ASSERT_EQ(scan(*lexer, "still **/ if", &inBlock), "bbbbbbbbb.kk");
+  ASSERT_FALSE(inBlock);
+  ASSERT_EQ(scan(*lexer, "/*/ x */", &inBlock), "bbbbbbbb");
+  ASSERT_FALSE(inBlock);
+}
+
+// Scans `text` from state `from`, as one piece of a longer row.
+static std::string scanFrom(Lexer const &lexer, std::string const &text,
+                            int &from) {
+  std::string hl(text.size(), '?');
+  from = lexer.ScanFrom(text.data(), text.size(),
+                        reinterpret_cast<unsigned char *>(hl.data()), from);
+  return hl;
+}
+
+TEST(TestLexer, StringsAcrossPieces) {
+  auto lexer = compile(CLike);
+  int state = Lexer::Outside;
+  ASSERT_EQ(scanFrom(*lexer, "x = \"if ", state), "....ssss");
+  ASSERT_GE(state, Lexer::InString);
+  ASSERT_EQ(scanFrom(*lexer, "", state), "");
+  ASSERT_GE(state, Lexer::InString);
+  ASSERT_EQ(scanFrom(*lexer, "while\\", state), "ssssss");
+  ASSERT_GE(state, Lexer::InString);
+  ASSERT_EQ(scanFrom(*lexer, "\" int\" \"x", state), "ssssss.ss");
+  ASSERT_GE(state, Lexer::InString);
+  ASSERT_EQ(scanFrom(*lexer, "\" if", state), "s.kk");
+  ASSERT_EQ(state, Lexer::Outside);
+
+  // A whole row ends outside a string however it scans.
+  bool inBlock = false;
+  ASSERT_EQ(scan(*lexer, "\"open", &inBlock), "sssss");
+  ASSERT_FALSE(inBlock);
+}
+
+TEST(TestLexer, DelimitersBacktrack) {
+  auto lexer = compile("name = html\n"
+                       "block_comment = <!-- -->\n"
+                       "keywords = div\n");
+  ASSERT_EQ(scan(*lexer, "<!-x <div"), "......kkk");
+}
@@ -0,0 +1,133 @@
+#include <gtest/gtest.h>
+#include <LineIndex.hpp>
+
+#include <algorithm>
+#include <cstdlib>
+#include <vector>
+
+static void checkAgainst(LineIndex const &index,
+                         std::vector<uint64_t> const &lengths) {
+  ASSERT_EQ(index.Size(), lengths.size());
+  uint64_t offset = 0;
+  for (size_t line = 0; line < lengths.size(); ++line) {
+    ASSERT_EQ(index.Offset(line), offset);
+    for (uint64_t b = 0; b < lengths[line]; ++b)
+      ASSERT_EQ(index.LineAt(offset + b), line);
+    offset += lengths[line];
+  }
+  ASSERT_EQ(index.TotalBytes(), offset);
+}
+
+TEST(TestLineIndex, Append) {
+  LineIndex index;
+  index.Clear();
+  std::vector<uint64_t> lengths;
+  for (uint64_t i = 0; i < 100; ++i) {
+    index.Append(i % 7 + 1);
+    lengths.push_back(i % 7 + 1);
+    checkAgainst(index, lengths);
+  }
+}
+
+TEST(TestLineIndex, RandomEdits) {
+  LineIndex index;
+  index.Clear();
+  std::vector<uint64_t> lengths;
+  srand(42);
+  for (int i = 0; i < 2000; ++i) {
+    uint64_t length = rand() % 9 + 1;
+    size_t at = lengths.empty() ? 0 : rand() % lengths.size();
+    switch (rand() % 4) {
+    case 0:
+      index.Append(length);
+      lengths.push_back(length);
+      break;
+    case 1:
+      index.Insert(at, length);
+      lengths.insert(lengths.begin() + at, length);
+      break;
+    case 2:
+      if (!lengths.empty()) {
+        index.Erase(at);
+        lengths.erase(lengths.begin() + at);
+      }
+      break;
+    case 3:
+      if (!lengths.empty()) {
+        index.Set(at, length);
+        lengths[at] = length;
+      }
+      break;
+    }
+    if (i % 50 == 0)
+      checkAgainst(index, lengths);
+  }
+  checkAgainst(index, lengths);
+}
+
+TEST(TestLineIndex, InsertAndEraseRuns) {
+  LineIndex index;
+  index.Clear();
+  std::vector<uint64_t> lengths;
+  srand(7);
+  for (int i = 0; i < 300; ++i) {
+    size_t at = lengths.empty() ? 0 : rand() % (lengths.size() + 1);
+    size_t count = rand() % 20;
+    if (rand() % 3 != 0) {
+      std::vector<uint64_t> run;
+      for (size_t j = 0; j < count; ++j)
+        run.push_back(rand() % 9 + 1);
+      index.Insert(at, run.data(), run.size());
+      lengths.insert(lengths.begin() + at, run.begin(), run.end());
+    } else {
+      count = std::min(count, lengths.size() - at);
+      index.Erase(at, count);
+      lengths.erase(lengths.begin() + at, lengths.begin() + at + count);
+    }
+    if (i % 30 == 0)
+      checkAgainst(index, lengths);
+  }
+  checkAgainst(index, lengths);
+}
+
+// Runs long enough to split blocks, and erasures that span several of them.
+TEST(TestLineIndex, EditsAcrossBlocks) {
+  LineIndex index;
+  index.Clear();
+  std::vector<uint64_t> lengths;
+  for (uint64_t i = 0; i < 5000; ++i) {
+    index.Append(i % 13 + 1);
+    lengths.push_back(i % 13 + 1);
+  }
+  srand(11);
+  for (int i = 0; i < 200; ++i) {
+    size_t at = rand() % (lengths.size() + 1);
+    size_t count = rand() % 3000;
+    if (rand() % 2 == 0) {
+      std::vector<uint64_t> run;
+      for (size_t j = 0; j < count; ++j)
+        run.push_back(rand() % 9 + 1);
+      index.Insert(at, run.data(), run.size());
+      lengths.insert(lengths.begin() + at, run.begin(), run.end());
+    } else {
+      count = std::min(count, lengths.size() - at);
+      index.Erase(at, count);
+      lengths.erase(lengths.begin() + at, lengths.begin() + at + count);
+    }
+    if (i % 20 == 0)
+      checkAgainst(index, lengths);
+  }
+  checkAgainst(index, lengths);
+  for (size_t line = 0; line < lengths.size(); ++line)
+    ASSERT_EQ(index.Length(line), lengths[line]);
+}
+
+TEST(TestLineIndex, LineAtClampsToLastLine) {
+  LineIndex index;
+  index.Clear();
+  ASSERT_EQ(index.LineAt(10), 0u);
+  index.Append(3);
+  index.Append(4);
+  ASSERT_EQ(index.LineAt(7), 1u);
+  ASSERT_EQ(index.LineAt(1000), 1u);
+}
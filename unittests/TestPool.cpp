@@ -0,0 +1,99 @@
+#include <gtest/gtest.h>
+#include <Pool.hpp>
+
+#include <cstring>
+#include <vector>
+
+TEST(TestPool, AllocateAndReuse) {
+  Pool pool;
+  void *a = pool.Allocate(10);
+  ASSERT_GE(pool.Capacity(a), 10u);
+  ASSERT_EQ(pool.BytesInUse(), pool.Capacity(a));
+  pool.Deallocate(a);
+  ASSERT_EQ(pool.BytesInUse(), 0u);
+
+  // The freed block comes straight back for the same class.
+  void *b = pool.Allocate(12);
+  ASSERT_EQ(a, b);
+  pool.Deallocate(b);
+}
+
+TEST(TestPool, ReallocatePreservesContents) {
+  Pool pool;
+  char *p = static_cast<char *>(pool.Allocate(4));
+  memcpy(p, "abc", 4);
+  for (size_t size : {8, 100, 5000, 100000, 300000, 20, 3}) {
+    p = static_cast<char *>(pool.Reallocate(p, size));
+    ASSERT_GE(pool.Capacity(p), size);
+    ASSERT_EQ(memcmp(p, "abc", size < 3 ? size : 3), 0);
+  }
+  pool.Deallocate(p);
+  ASSERT_EQ(pool.BytesInUse(), 0u);
+}
+
+TEST(TestPool, SharedBlocks) {
+  Pool pool;
+  char *a = static_cast<char *>(pool.Allocate(8));
+  memcpy(a, "abcdefg", 8);
+  size_t used = pool.BytesInUse();
+  pool.Share(a);
+  pool.Share(a);
+  ASSERT_EQ(pool.BytesInUse(), used);
+
+  // A shared block is copied rather than resized in place, even when the new
+  // size fits.
+  char *b = static_cast<char *>(pool.Reallocate(a, 7));
+  ASSERT_NE(a, b);
+  ASSERT_EQ(memcmp(b, "abcdefg", 7), 0);
+
+  char *c = static_cast<char *>(pool.Unshare(a));
+  ASSERT_NE(a, c);
+  c[0] = 'x';
+  ASSERT_EQ(a[0], 'a');
+
+  // The last owner gets the block itself, and frees it.
+  ASSERT_EQ(pool.Unshare(a), a);
+  pool.Deallocate(a);
+  pool.Deallocate(b);
+  pool.Deallocate(c);
+  ASSERT_EQ(pool.BytesInUse(), 0u);
+}
+
+TEST(TestPool, LargeBlocks) {
+  Pool pool;
+  std::vector<void *> blocks;
+  for (int i = 0; i < 10; ++i)
+    blocks.push_back(pool.Allocate(Pool::LargestClass + i));
+  ASSERT_GE(pool.BytesReserved(), pool.BytesInUse());
+  for (void *p : blocks)
+    pool.Deallocate(p);
+  ASSERT_EQ(pool.BytesInUse(), 0u);
+}
+
+TEST(TestPool, Categories) {
+  Pool pool;
+  void *a = pool.Allocate(100, 1);
+  void *b = pool.Allocate(Pool::LargestClass + 1, 2);
+  ASSERT_EQ(pool.BytesInUse(1), pool.Capacity(a));
+  ASSERT_EQ(pool.BytesInUse(2), pool.Capacity(b));
+  ASSERT_EQ(pool.BytesInUse(0), 0u);
+
+  // A moved block goes to the category it is given, and a copy made by
+  // Unshare stays in its block's.
+  a = pool.Reallocate(a, 1000, 3);
+  ASSERT_EQ(pool.BytesInUse(1), 0u);
+  ASSERT_EQ(pool.BytesInUse(3), pool.Capacity(a));
+  pool.Share(a);
+  void *c = pool.Unshare(a);
+  ASSERT_EQ(pool.BytesInUse(3), 2 * pool.Capacity(a));
+
+  pool.Deallocate(a);
+  pool.Deallocate(b);
+  pool.Deallocate(c);
+  for (int category = 0; category < 4; ++category)
+    ASSERT_EQ(pool.BytesInUse(category), 0u);
+  // Peaks stay where they got to.
+  ASSERT_EQ(pool.PeakBytesInUse(1), 128u);
+  ASSERT_EQ(pool.PeakBytesInUse(3), 2048u);
+  ASSERT_GE(pool.PeakBytesInUse(), Pool::LargestClass + 1 + 2048);
+}
@@ -0,0 +1,157 @@
+#include <gtest/gtest.h>
+#include <Trace.hpp>
+
+#include <stdlib.h>
+#include <unistd.h>
+
+#include <atomic>
+#include <fstream>
+#include <set>
+#include <sstream>
+#include <string>
+#include <thread>
+
+static std::string tracePath() {
+  char path[] = "/tmp/kilo-trace-XXXXXX";
+  close(mkstemp(path));
+  return path;
+}
+
+static std::string readFile(std::string const &path) {
+  std::ifstream in(path);
+  std::stringstream contents;
+  contents << in.rdbuf();
+  unlink(path.c_str());
+  return contents.str();
+}
+
+static size_t count(std::string const &haystack, std::string const &needle) {
+  size_t n = 0;
+  for (size_t at = haystack.find(needle); at != std::string::npos;
+       at = haystack.find(needle, at + 1))
+    ++n;
+  return n;
+}
+
+TEST(TestTrace, DisabledUntilStarted) {
+  Tracer tracer;
+  ASSERT_FALSE(tracer.Enabled());
+  ASSERT_FALSE(tracer.Flush());
+
+  std::string path = tracePath();
+  ASSERT_TRUE(tracer.Start(path.c_str()));
+  ASSERT_TRUE(tracer.Enabled());
+  ASSERT_TRUE(tracer.Flush());
+  ASSERT_FALSE(tracer.Enabled());
+  ASSERT_EQ(readFile(path),
+            "{\"traceEvents\":[\n],\"displayTimeUnit\":\"ns\"}\n");
+}
+
+TEST(TestTrace, RecordsCompleteEvents) {
+  Tracer tracer;
+  std::string path = tracePath();
+  ASSERT_TRUE(tracer.Start(path.c_str()));
+
+  uint64_t begin = Tracer::Now();
+  tracer.Record("outer", begin, begin + 5000);
+  tracer.Record("inner", begin + 1000, begin + 2000);
+  ASSERT_TRUE(tracer.Flush());
+
+  std::string json = readFile(path);
+  ASSERT_NE(json.find("\"name\":\"outer\",\"ph\":\"X\""), std::string::npos);
+  ASSERT_NE(json.find("\"dur\":5.000"), std::string::npos);
+  ASSERT_NE(json.find("\"name\":\"inner\""), std::string::npos);
+  ASSERT_NE(json.find("\"dur\":1.000"), std::string::npos);
+}
+
+TEST(TestTrace, ThreadsGetTheirOwnIds) {
+  Tracer tracer;
+  std::string path = tracePath();
+  ASSERT_TRUE(tracer.Start(path.c_str()));
+
+  auto work = [&] {
+    for (int i = 0; i < 100; ++i) {
+      uint64_t now = Tracer::Now();
+      tracer.Record("work", now, now + 1);
+    }
+  };
+  std::thread a(work), b(work);
+  a.join();
+  b.join();
+  work();
+  ASSERT_TRUE(tracer.Flush());
+
+  std::string json = readFile(path);
+  ASSERT_EQ(count(json, "\"name\":\"work\""), 300u);
+  std::set<std::string> tids;
+  for (size_t at = json.find("\"tid\":"); at != std::string::npos;
+       at = json.find("\"tid\":", at + 1))
+    tids.insert(json.substr(at, json.find('}', at) - at));
+  ASSERT_EQ(tids.size(), 3u);
+}
+
+TEST(TestTrace, ExitedThreadsHandOnTheirRings) {
+  Tracer tracer;
+  std::string path = tracePath();
+  ASSERT_TRUE(tracer.Start(path.c_str()));
+
+  for (int i = 0; i < 10; ++i)
+    std::thread([&] {
+      uint64_t now = Tracer::Now();
+      tracer.Record("short", now, now + 1);
+    }).join();
+  ASSERT_EQ(tracer.Rings(), 1u);
+  ASSERT_TRUE(tracer.Flush());
+
+  // Each thread's event still carries its own id.
+  std::string json = readFile(path);
+  ASSERT_EQ(count(json, "\"name\":\"short\""), 10u);
+  std::set<std::string> tids;
+  for (size_t at = json.find("\"tid\":"); at != std::string::npos;
+       at = json.find("\"tid\":", at + 1))
+    tids.insert(json.substr(at, json.find('}', at) - at));
+  ASSERT_GT(tids.size(), 1u);
+}
+
+TEST(TestTrace, FlushWhileThreadsRecord) {
+  Tracer tracer;
+  std::string path = tracePath();
+  ASSERT_TRUE(tracer.Start(path.c_str()));
+
+  std::atomic<bool> started{false};
+  auto spin = [&] {
+    for (int i = 0; i < 1000000; ++i) {
+      uint64_t now = Tracer::Now();
+      tracer.Record("spin", now, now + 1);
+      started = true;
+    }
+  };
+  std::thread a(spin), b(spin);
+  while (!started)
+    ;
+  ASSERT_TRUE(tracer.Flush());
+  a.join();
+  b.join();
+
+  // Whatever made it out was whole.
+  std::string json = readFile(path);
+  ASSERT_EQ(count(json, "{\"name\":"), count(json, "{\"name\":\"spin\""));
+  std::string end = "\n],\"displayTimeUnit\":\"ns\"}\n";
+  ASSERT_EQ(json.substr(json.size() - end.size()), end);
+}
+
+TEST(TestTrace, RingKeepsTheNewestEvents) {
+  Tracer tracer;
+  std::string path = tracePath();
+  ASSERT_TRUE(tracer.Start(path.c_str()));
+
+  uint64_t now = Tracer::Now();
+  tracer.Record("old", now, now + 1);
+  for (size_t i = 0; i < Tracer::RingSize; ++i)
+    tracer.Record("new", now, now + 1);
+  ASSERT_TRUE(tracer.Flush());
+
+  std::string json = readFile(path);
+  ASSERT_EQ(count(json, "\"name\":\"old\""), 0u);
+  ASSERT_EQ(count(json, "\"name\":\"new\""), Tracer::RingSize);
+}
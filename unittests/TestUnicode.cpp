@@ -0,0 +1,57 @@
+#include <gtest/gtest.h>
+#include <Unicode.hpp>
+
+#include <cstring>
+#include <string>
+
+TEST(TestUnicode, IsAscii) {
+  std::string s(200, 'a');
+  ASSERT_TRUE(utf8IsAscii(s.data(), s.size()));
+  for (size_t i : {0, 15, 16, 63, 64, 130, 199}) {
+    std::string t = s;
+    t[i] = '\xc3';
+    ASSERT_FALSE(utf8IsAscii(t.data(), t.size())) << i;
+    ASSERT_TRUE(utf8IsAscii(t.data(), i)) << i;
+  }
+}
+
+TEST(TestUnicode, Decode) {
+  uint32_t cp;
+  ASSERT_EQ(utf8Decode("A", 1, &cp), 1);
+  ASSERT_EQ(cp, 'A');
+  ASSERT_EQ(utf8Decode("\xc3\xa9", 2, &cp), 2);
+  ASSERT_EQ(cp, 0xe9u);
+  ASSERT_EQ(utf8Decode("\xe4\xbd\xa0", 3, &cp), 3);
+  ASSERT_EQ(cp, 0x4f60u);
+  ASSERT_EQ(utf8Decode("\xf0\x9f\x98\x80", 4, &cp), 4);
+  ASSERT_EQ(cp, 0x1f600u);
+}
+
+TEST(TestUnicode, DecodeMalformed) {
+  uint32_t cp;
+  // Truncated, overlong, surrogate, stray continuation.
+  for (char const *s : {"\xe4\xbd", "\xc0\xaf", "\xed\xa0\x80", "\x80"}) {
+    ASSERT_EQ(utf8Decode(s, strlen(s), &cp), 1);
+    ASSERT_EQ(cp, ReplacementCharacter);
+  }
+}
+
+TEST(TestUnicode, Width) {
+  ASSERT_EQ(codepointWidth('a'), 1);
+  ASSERT_EQ(codepointWidth(0xe9), 1);
+  ASSERT_EQ(codepointWidth(0x301), 0);
+  ASSERT_EQ(codepointWidth(0x4f60), 2);
+  ASSERT_EQ(codepointWidth(0x1f600), 2);
+}
+
+TEST(TestUnicode, Boundaries) {
+  char const *s = "a\xe4\xbd\xa0\xff" "b";
+  int len = strlen(s);
+  ASSERT_EQ(utf8NextBoundary(s, len, 0), 1);
+  ASSERT_EQ(utf8NextBoundary(s, len, 1), 4);
+  ASSERT_EQ(utf8NextBoundary(s, len, 4), 5);
+  ASSERT_EQ(utf8PrevBoundary(s, 6), 5);
+  ASSERT_EQ(utf8PrevBoundary(s, 5), 4);
+  ASSERT_EQ(utf8PrevBoundary(s, 4), 1);
+  ASSERT_EQ(utf8PrevBoundary(s, 1), 0);
+}